@@ -4,14 +4,28 @@
 #include "crypto.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <gcrypt.h>
 #include <stdint.h>
 
 #define GCRY_CIPHER GCRY_CIPHER_AES128   // Pick the cipher here
-#define GCRY_C_MODE GCRY_CIPHER_MODE_ECB // Pick the cipher mode here
+#define GCRY_C_MODE GCRY_CIPHER_MODE_GCM // Pick the cipher mode here (has to be an AEAD mode)
 
-gcry_error_t gcry_error_handle;
-gcry_cipher_hd_t gcry_cipher_hd;
+#define GCRYPT_KEY_LEN 16
+
+// shared key, derived from the configured secret
+static unsigned char gcry_key[GCRYPT_KEY_LEN];
+static int gcry_key_generation = 0;
+
+// every thread keeps its own cipher handle and output buffer
+static __thread gcry_cipher_hd_t gcry_cipher_hd;
+static __thread int gcry_cipher_hd_generation = 0;
+static __thread char *gcry_out_buf = NULL;
+static __thread size_t gcry_out_buf_len = 0;
+
+static int gcrypt_get_handle();
+
+static char *gcrypt_get_out_buf(size_t len);
 
 void gcrypt_init() {
     if (!gcry_check_version(GCRYPT_VERSION)) {
@@ -28,73 +42,128 @@ void gcrypt_init() {
     }
 }
 
-void gcrypt_set_key_and_iv(const char *key, const char *iv) {
-    size_t keylen = gcry_cipher_get_algo_keylen(GCRY_CIPHER);
-    size_t blklen = gcry_cipher_get_algo_blklen(GCRY_CIPHER);
-
-    gcry_error_handle = gcry_cipher_open(
-            &gcry_cipher_hd, // gcry_cipher_hd_t *
-            GCRY_CIPHER,   // int
-            GCRY_C_MODE,   // int
-            0);
-    if (gcry_error_handle) {
-        fprintf(stderr, "gcry_cipher_open failed:  %s/%s\n",
-                gcry_strsource(gcry_error_handle),
-                gcry_strerror(gcry_error_handle));
-        return;
+void gcrypt_set_key(const char *key) {
+    unsigned char digest[32];
+
+    if (key == NULL) {
+        fprintf(stderr, "gcrypt: no shared key configured!\n");
+        key = "";
+    }
+
+    // the configured key is a string of arbitrary length, hash it to the cipher key length
+    gcry_md_hash_buffer(GCRY_MD_SHA256, digest, key, strlen(key));
+    memcpy(gcry_key, digest, GCRYPT_KEY_LEN);
+
+    // other threads pick up the new key with their next message
+    __sync_add_and_fetch(&gcry_key_generation, 1);
+}
+
+static int gcrypt_get_handle() {
+    gcry_error_t err;
+    int generation = gcry_key_generation;
+
+    if (gcry_cipher_hd_generation == generation) {
+        return 0;
     }
 
-    gcry_error_handle = gcry_cipher_setkey(gcry_cipher_hd, key, keylen);
-    if (gcry_error_handle) {
-        fprintf(stderr, "gcry_cipher_setkey failed:  %s/%s\n",
-                gcry_strsource(gcry_error_handle),
-                gcry_strerror(gcry_error_handle));
-        return;
+    if (gcry_cipher_hd_generation != 0) {
+        gcry_cipher_close(gcry_cipher_hd);
+        gcry_cipher_hd_generation = 0;
     }
 
-    gcry_error_handle = gcry_cipher_setiv(gcry_cipher_hd, iv, blklen);
-    if (gcry_error_handle) {
-        fprintf(stderr, "gcry_cipher_setiv failed:  %s/%s\n",
-                gcry_strsource(gcry_error_handle),
-                gcry_strerror(gcry_error_handle));
-        return;
+    err = gcry_cipher_open(&gcry_cipher_hd, GCRY_CIPHER, GCRY_C_MODE, 0);
+    if (err) {
+        fprintf(stderr, "gcry_cipher_open failed:  %s/%s\n", gcry_strsource(err), gcry_strerror(err));
+        return -1;
+    }
+
+    err = gcry_cipher_setkey(gcry_cipher_hd, gcry_key, GCRYPT_KEY_LEN);
+    if (err) {
+        fprintf(stderr, "gcry_cipher_setkey failed:  %s/%s\n", gcry_strsource(err), gcry_strerror(err));
+        gcry_cipher_close(gcry_cipher_hd);
+        return -1;
     }
+
+    gcry_cipher_hd_generation = generation;
+    return 0;
 }
 
-// free out buffer after using!
-char *gcrypt_encrypt_msg(char *msg, size_t msg_length, int *out_length) {
-    if (0U != (msg_length & 0xfU))
-        msg_length += 0x10U - (msg_length & 0xfU);
-
-    char *out = malloc(msg_length);
-    gcry_error_handle = gcry_cipher_encrypt(gcry_cipher_hd, out, msg_length, msg, msg_length);
-    if (gcry_error_handle) {
-        fprintf(stderr, "gcry_cipher_encrypt failed:  %s/%s\n",
-                gcry_strsource(gcry_error_handle),
-                gcry_strerror(gcry_error_handle));
-        return NULL;
+static char *gcrypt_get_out_buf(size_t len) {
+    if (len > gcry_out_buf_len) {
+        char *tmp = realloc(gcry_out_buf, len);
+        if (tmp == NULL) {
+            return NULL;
+        }
+        gcry_out_buf = tmp;
+        gcry_out_buf_len = len;
     }
-    *out_length = msg_length;
-    return out;
+    return gcry_out_buf;
 }
 
-// free out buffer after using!
-char *gcrypt_decrypt_msg(char *msg, size_t msg_length) {
-    if (0U != (msg_length & 0xfU))
-        msg_length += 0x10U - (msg_length & 0xfU);
-
-    char *out_buffer = malloc(msg_length);
-    gcry_error_handle = gcry_cipher_decrypt(gcry_cipher_hd, out_buffer, msg_length, msg, msg_length);
-    if (gcry_error_handle) {
-        fprintf(stderr, "gcry_cipher_encrypt failed:  %s/%s\n",
-                gcry_strsource(gcry_error_handle),
-                gcry_strerror(gcry_error_handle));
-        free(out_buffer);
+// out buffer belongs to the calling thread, don't free it!
+char *gcrypt_encrypt_msg(const char *msg, size_t msg_length, int *out_length) {
+    gcry_error_t err;
+
+    if (gcrypt_get_handle()) {
+        return NULL;
+    }
+
+    char *out = gcrypt_get_out_buf(msg_length + GCRYPT_OVERHEAD);
+    if (out == NULL) {
+        fprintf(stderr, "gcrypt: failed to allocate buffer\n");
         return NULL;
     }
-    char *out = malloc(strlen(out_buffer) + 1);
-    strcpy(out, out_buffer);
-    free(out_buffer);
+
+    // [NONCE|GCRYPT_NONCE_LEN][CIPHERTEXT|msg_length][TAG|GCRYPT_TAG_LEN]
+    char *ciphertext = out + GCRYPT_NONCE_LEN;
+    gcry_create_nonce(out, GCRYPT_NONCE_LEN);
+    memcpy(ciphertext, msg, msg_length);
+
+    err = gcry_cipher_setiv(gcry_cipher_hd, out, GCRYPT_NONCE_LEN);
+    if (!err)
+        err = gcry_cipher_encrypt(gcry_cipher_hd, ciphertext, msg_length, NULL, 0);
+    if (!err)
+        err = gcry_cipher_gettag(gcry_cipher_hd, ciphertext + msg_length, GCRYPT_TAG_LEN);
+    if (err) {
+        fprintf(stderr, "gcry_cipher_encrypt failed:  %s/%s\n", gcry_strsource(err), gcry_strerror(err));
+        return NULL;
+    }
+
+    *out_length = msg_length + GCRYPT_OVERHEAD;
     return out;
 }
 
+// decrypts in place, the returned string points into msg!
+char *gcrypt_decrypt_msg(char *msg, size_t msg_length, int *out_length) {
+    gcry_error_t err;
+
+    if (msg_length < GCRYPT_OVERHEAD) {
+        fprintf(stderr, "gcrypt: message too short\n");
+        return NULL;
+    }
+
+    if (gcrypt_get_handle()) {
+        return NULL;
+    }
+
+    size_t plain_length = msg_length - GCRYPT_OVERHEAD;
+    char *plaintext = msg + GCRYPT_NONCE_LEN;
+
+    err = gcry_cipher_setiv(gcry_cipher_hd, msg, GCRYPT_NONCE_LEN);
+    if (!err)
+        err = gcry_cipher_decrypt(gcry_cipher_hd, plaintext, plain_length, NULL, 0);
+    if (!err)
+        err = gcry_cipher_checktag(gcry_cipher_hd, plaintext + plain_length, GCRYPT_TAG_LEN);
+    if (err) {
+        fprintf(stderr, "gcry_cipher_decrypt failed:  %s/%s\n", gcry_strsource(err), gcry_strerror(err));
+        return NULL;
+    }
+
+    // overwrites the first byte of the (already checked) tag
+    plaintext[plain_length] = '\0';
+
+    if (out_length != NULL) {
+        *out_length = plain_length;
+    }
+    return plaintext;
+}
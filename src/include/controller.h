@@ -0,0 +1,61 @@
+#ifndef DAWN_CONTROLLER_H
+#define DAWN_CONTROLLER_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "datastorage.h"
+
+// Decisions of the controller for (bssid, client), direct mapped.
+#define DECISION_CACHE_LEN 4096
+// Agents forget decisions after this many seconds, the controller repeats them before.
+#define DECISION_TIMEOUT 60
+
+// Agents that can be served by one controller.
+#define CONTROLLER_OWNER_LEN 2048
+
+#define DECISION_ALLOW_PROBE 0x01
+#define DECISION_ALLOW_AUTH 0x02
+#define DECISION_ALLOW_ASSOC 0x04
+
+/**
+ * Store a decision that was received from the controller (agent).
+ * @param bssid_addr
+ * @param client_addr
+ * @param allow - DECISION_ALLOW_* flags.
+ */
+void decision_cache_set(const uint8_t *bssid_addr, const uint8_t *client_addr, uint8_t allow);
+
+/**
+ * Look up the decision of the controller (agent).
+ * @param bssid_addr
+ * @param client_addr
+ * @param flag - DECISION_ALLOW_* flag of the request.
+ * @return 1 if allowed, 0 if denied or -1 if the controller didn't decide yet.
+ */
+int decision_cache_get(const uint8_t *bssid_addr, const uint8_t *client_addr, uint8_t flag);
+
+/**
+ * Check if a decision has to be sent to the agent and remember it (controller).
+ * @param bssid_addr
+ * @param client_addr
+ * @param allow - DECISION_ALLOW_* flags.
+ * @return 1 if the agent doesn't know the decision yet.
+ */
+int decision_cache_update(const uint8_t *bssid_addr, const uint8_t *client_addr, uint8_t allow);
+
+/**
+ * Remember the connection of the agent that serves the bssid (controller).
+ * @param bssid_addr
+ * @param con_id
+ */
+void controller_set_owner(const uint8_t *bssid_addr, uint32_t con_id);
+
+/**
+ * Get the connection of the agent that serves the bssid (controller).
+ * @param bssid_addr
+ * @return the connection id or 0 if unknown.
+ */
+uint32_t controller_get_owner(const uint8_t *bssid_addr);
+
+#endif //DAWN_CONTROLLER_H
@@ -3,6 +3,12 @@
 
 #include <stdlib.h>
 
+#define GCRYPT_NONCE_LEN 12
+#define GCRYPT_TAG_LEN 16
+
+// Bytes added to every encrypted message (nonce and authentication tag).
+#define GCRYPT_OVERHEAD (GCRYPT_NONCE_LEN + GCRYPT_TAG_LEN)
+
 /**
  * Initialize gcrypt.
  * Has to be called before using the other functions!
@@ -10,29 +16,31 @@
 void gcrypt_init();
 
 /**
- * Set the Key and the iv.
+ * Set the shared key.
+ * The key is hashed to the cipher key length, so any string can be used.
  * @param key
- * @param iv
  */
-void gcrypt_set_key_and_iv(const char *key, const char *iv);
+void gcrypt_set_key(const char *key);
 
 /**
- * Function that encrypts the message.
- * Free the string after using it!
+ * Function that encrypts and authenticates the message.
+ * Output format: [nonce][ciphertext][tag]
+ * The returned buffer is reused by the calling thread, don't free it!
  * @param msg
  * @param msg_length
  * @param out_length
- * @return the encrypted string.
+ * @return the encrypted message or NULL on failure.
  */
-char *gcrypt_encrypt_msg(char *msg, size_t msg_length, int *out_length);
+char *gcrypt_encrypt_msg(const char *msg, size_t msg_length, int *out_length);
 
 /**
- * FUnction that decrypts a message.
- * Free the string after using it!
+ * Function that decrypts a message in place and checks its authentication tag.
+ * The returned string points into msg and is '\0' terminated.
  * @param msg
  * @param msg_length
- * @return the decrypted string.
+ * @param out_length - length of the decrypted string, can be NULL.
+ * @return the decrypted string or NULL if the message was corrupted or forged.
  */
-char *gcrypt_decrypt_msg(char *msg, size_t msg_length);
+char *gcrypt_decrypt_msg(char *msg, size_t msg_length, int *out_length);
 
 #endif //DAWN_CRYPTO_H
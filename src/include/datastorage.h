@@ -68,6 +68,21 @@ struct probe_metric_s {
     int duration;
     int mode;
     int scan_channel;
+    int probe_signal_delta;
+    int probe_rcpi_delta;
+    int probe_refresh;
+    int ratelimit_rate;
+    int ratelimit_burst;
+    int kick_budget;
+    int kick_per_target;
+    int lb_planner;
+    int lb_capacity;
+    int lb_min_gain;
+    int roam_cooldown;
+    int roam_hysteresis;
+    int bss_tm_candidates;
+    int nr_max_neighbors;
+    int nr_min_heard;
 };
 
 struct time_config_s {
@@ -80,8 +95,19 @@ struct time_config_s {
     time_t denied_req_threshold;
     time_t update_chan_util;
     time_t update_beacon_reports;
+    time_t heartbeat;
+    time_t peer_timeout;
+    time_t overload_lag;
+    time_t overload_queue;
+    time_t overload_hold;
+    time_t beacon_req_gap;
 };
 
+// Role of this instance, only used with the tcp transport.
+#define DAWN_ROLE_PEER 0 // decentralized, every instance keeps the full state
+#define DAWN_ROLE_AGENT 1 // forwards events to the controller and applies its decisions
+#define DAWN_ROLE_CONTROLLER 2 // holds the state of all agents and decides for them
+
 struct network_config_s {
     const char *broadcast_ip;
     int broadcast_port;
@@ -94,6 +120,12 @@ struct network_config_s {
     int use_symm_enc;
     int collision_domain;
     int bandwidth;
+    int gossip_fanout;
+    int gossip_ttl;
+    int gossip_peers;
+    int role;
+    const char *controller_ip;
+    int msg_max_age;
 };
 
 struct network_config_s network_config;
@@ -121,6 +153,10 @@ typedef struct probe_entry_s {
     uint8_t min_supp_datarate;
     uint32_t rcpi;
     uint32_t rsni;
+    // last values that were forwarded to the other nodes
+    time_t sent_time;
+    uint32_t sent_signal;
+    uint32_t sent_rcpi;
 } probe_entry;
 
 typedef struct auth_entry_s {
@@ -147,13 +183,22 @@ pthread_mutex_t denied_array_mutex;
 auth_entry insert_to_denied_req_array(auth_entry entry, int inc_counter);
 
 // ---------------- Defines ----------------
+#ifndef PROBE_ARRAY_LEN
 #define PROBE_ARRAY_LEN 1000
+#endif
 
 #define SSID_MAX_LEN 32
 #define NEIGHBOR_REPORT_LEN 200
+// Aps that are offered to a client in a bss transition request.
+#define BSS_TM_MAX_CANDIDATES 6
+// BSS Transition Candidate Preference subelement of a neighbor report element.
+#define NR_SUBELEM_CANDIDATE_PREF 3
+// Comma separated neighbor reports, each with a preference subelement (6 hex characters).
+#define NEIGHBOR_REPORT_LIST_LEN (BSS_TM_MAX_CANDIDATES * (NEIGHBOR_REPORT_LEN + 7))
 
 // ---------------- Global variables ----------------
 struct probe_entry_s probe_array[PROBE_ARRAY_LEN];
+extern int probe_entry_last;
 pthread_mutex_t probe_array_mutex;
 
 // ---------------- Functions ----------------
@@ -210,25 +255,40 @@ typedef struct ap_s {
     time_t time;
     uint32_t station_count;
     uint8_t ssid[SSID_MAX_LEN];
-    char neighbor_report[NEIGHBOR_REPORT_LEN];
     uint32_t collision_domain;
     uint32_t bandwidth;
     uint32_t ap_weight;
 } ap;
 
 // ---------------- Defines ----------------
+#ifndef ARRAY_AP_LEN
 #define ARRAY_AP_LEN 50
+#endif
 #define TIME_THRESHOLD_AP 30
+#ifndef ARRAY_CLIENT_LEN
 #define ARRAY_CLIENT_LEN 1000
+#endif
 #define TIME_THRESHOLD_CLIENT 30
 #define TIME_THRESHOLD_CLIENT_UPDATE 10
 #define TIME_THRESHOLD_CLIENT_KICK 60
 
+// Kick evaluation runs as a job per bssid, this many clients are evaluated per uloop iteration.
+#define KICK_SLICE_CLIENTS 4
+#define KICK_MAX_JOBS ARRAY_AP_LEN
+// Clients waiting to be kicked, the ones with the smallest score gain are dropped first.
+#define KICK_MAX_CANDIDATES 64
+// Kicks that are remembered for the kick rate.
+#define KICK_HIST_LEN 64
+// Clients with a roaming history, the one that was not seen for the longest time is forgotten.
+#define ROAM_TABLE_LEN ARRAY_CLIENT_LEN
+
 // ---------------- Global variables ----------------
 struct client_s client_array[ARRAY_CLIENT_LEN];
 pthread_mutex_t client_array_mutex;
+extern int client_entry_last;
 struct ap_s ap_array[ARRAY_AP_LEN];
 pthread_mutex_t ap_array_mutex;
+extern int ap_entry_last;
 
 int mac_is_equal(uint8_t addr1[], uint8_t addr2[]);
 
@@ -242,8 +302,96 @@ int probe_array_update_rcpi_rsni(uint8_t bssid_addr[], uint8_t client_addr[], ui
 
 void insert_client_to_array(client entry);
 
+/**
+ * Refresh the timestamp of a client of an ap.
+ * Used for delta updates that only list unchanged clients.
+ * @param bssid_addr
+ * @param client_addr
+ */
+void client_array_touch(uint8_t bssid_addr[], uint8_t client_addr[]);
+
+/**
+ * Remove the clients of an ap that are not in the list.
+ * Used for updates that carry all clients of the ap.
+ * @param bssid_addr
+ * @param clients
+ * @param num_clients
+ */
+void client_array_keep(uint8_t bssid_addr[], uint8_t clients[][ETH_ALEN], int num_clients);
+
+/**
+ * Remove the ap, probe and client entries of the bssids at once.
+ * Used when the node owning them is gone.
+ * There is no index by bssid (aps are sorted by ssid, probes by client), so this is one compacting scan
+ * per table for all bssids together instead of a delete and shift per entry.
+ * @param bssids
+ * @param num_bssids
+ */
+void remove_bssid_entries(uint8_t bssids[][ETH_ALEN], int num_bssids);
+
+/**
+ * Merge a probe entry of a state snapshot.
+ * Unlike insert_to_array the timestamp of the entry is kept and newer local entries win.
+ * @param entry
+ * @return 1 if the entry was inserted.
+ */
+int probe_array_merge(probe_entry entry);
+
+/**
+ * Check if a probe of an own ap has to be forwarded to the other nodes and remember it as sent.
+ * Forwarded are the first probe of a client, probes whose signal or rcpi changed by more than
+ * probe_signal_delta / probe_rcpi_delta and probes after probe_refresh seconds.
+ * @param entry - probe that was just inserted.
+ * @return 1 if the probe should be sent.
+ */
+int probe_array_forward(probe_entry entry);
+
+/**
+ * Store the measurement of a beacon report in the probe array.
+ * An existing entry gets the rcpi and rsni, a new one gets the signal derived from the rcpi and
+ * the capabilities the client announced in its probes to other aps.
+ * @param entry - bssid, client, freq, rcpi and rsni have to be set, is updated to the stored entry.
+ * @return 1 if a new entry was created, 0 if an entry was updated.
+ */
+int probe_array_beacon_report(probe_entry *entry);
+
+/**
+ * Add the counters of forwarded and suppressed probes to the blob buffer.
+ * @param b
+ * @return
+ */
+int build_probe_stats(struct blob_buf *b);
+
+/**
+ * Merge an ap entry of a state snapshot.
+ * Unlike insert_to_ap_array the timestamp of the entry is kept and newer local entries win.
+ * @param entry
+ * @return 1 if the entry was inserted.
+ */
+int ap_array_merge(ap entry);
+
+/**
+ * Schedule the kick evaluation of the clients of an ap.
+ * The clients are evaluated in slices between the other events, a job that is
+ * already running for the ap continues where it stopped.
+ * @param bssid
+ * @param id - ubus id of the hostapd socket.
+ */
 void kick_clients(uint8_t bssid[], uint32_t id);
 
+/**
+ * Replace the evaluation of a single client by kick_clients, used by the tests.
+ * @param evaluate - called with the index in the client array, the bssid and the ubus id, NULL restores the default.
+ */
+void kick_clients_set_evaluator(void (*evaluate)(int j, uint8_t bssid[], uint32_t id));
+
+/**
+ * Add the kick backlog and the kick statistics to the blob buffer.
+ * @param b
+ * @return
+ */
+int build_kick_plan(struct blob_buf *b);
+
 void client_array_insert(client entry);
 
 client client_array_delete(client entry);
@@ -268,7 +416,24 @@ int ap_get_collision_count(int col_domain);
 
 void send_beacon_reports(uint8_t bssid[], int id);
 
-int ap_get_nr(struct blob_buf *b, uint8_t own_bssid_addr[]);
+/**
+ * Check if the client is connected to the ap, client_array_mutex has to be locked.
+ * @param bssid_addr
+ * @param client_addr
+ * @return 1 if it is connected.
+ */
+int is_connected(uint8_t bssid_addr[], uint8_t client_addr[]);
+
+/**
+ * Add the neighbor list of an ap for rrm_nr_set to the blob buffer.
+ * Neighbors are the aps of the same ssid that at least nr_min_heard percent of the clients hearing
+ * this ap hear as well, the most heard first and at most nr_max_neighbors.
+ * @param b
+ * @param own_bssid_addr
+ * @param hash - hash of the list content, to push it only when it changed.
+ * @return the number of neighbors.
+ */
+int ap_get_nr(struct blob_buf *b, uint8_t own_bssid_addr[], uint32_t *hash);
 
 /* Utils */
 
@@ -281,4 +446,26 @@ char *sort_string;
 // ---------------- Functions -------------------
 int better_ap_available(uint8_t bssid_addr[], uint8_t client_addr[], char* neighbor_report, int automatic_kick);
 
+/**
+ * Score of a probe without looking up the ap and without logging.
+ * @param probe_entry
+ * @param ap_entry - ap the probe is for, NULL if it is unknown.
+ * @return the score, -2 if it is negative.
+ */
+int eval_probe_score(probe_entry *probe_entry, ap *ap_entry);
+
+/**
+ * Like better_ap_available, also returns the chosen ap.
+ * The neighbor report becomes a list of up to bss_tm_candidates aps, the chosen one first.
+ * @param bssid_addr
+ * @param client_addr
+ * @param neighbor_report
+ * @param automatic_kick
+ * @param target_addr - bssid of the better ap, can be NULL.
+ * @param score_gap - score of the better ap minus the own score, can be NULL.
+ * @return 1 if there is a better ap, -1 if there is no probe entry for the own ap.
+ */
+int better_ap_target(uint8_t bssid_addr[], uint8_t client_addr[], char *neighbor_report, int automatic_kick,
+                     uint8_t *target_addr, int *score_gap);
+
 #endif
\ No newline at end of file
@@ -60,7 +60,24 @@ int get_bssid(const char *ifname, uint8_t *bssid_addr);
 
 int get_ssid(const char *ifname, char *ssid);
 
-int get_channel_utilization(const char *ifname, uint64_t *last_channel_time, uint64_t *last_channel_time_busy);
+/**
+ * Read the survey counters of the channel the interface is on.
+ * The survey covers the whole radio, all interfaces of a phy get the same counters.
+ * @param ifname
+ * @param freq - returns the frequency of the interface.
+ * @param active_time - returns the time the radio was on the channel (ms).
+ * @param busy_time - returns the time the channel was busy (ms).
+ * @return 0 if successful, -1 otherwise.
+ */
+int get_channel_survey(const char *ifname, int *freq, uint64_t *active_time, uint64_t *busy_time);
+
+/**
+ * Get the name of the radio (phy) of an interface.
+ * @param ifname
+ * @param phy - buffer for the name, at least 32 characters.
+ * @return 0 if successful, -1 otherwise.
+ */
+int get_phy_name(const char *ifname, char *phy);
 
 int support_ht(const char *ifname);
 
@@ -0,0 +1,75 @@
+#ifndef DAWN_GOSSIP_H
+#define DAWN_GOSSIP_H
+
+#include <libubox/blobmsg.h>
+#include <stdint.h>
+
+// Number of (node, seq) pairs that are remembered to suppress duplicates.
+#define GOSSIP_SEEN_LEN 4096
+// Hops above this are counted in the last bucket of the histogram.
+#define GOSSIP_HOPS_HIST_LEN 16
+
+enum gossip_action {
+    // own, already seen or too old message, ignore it
+    GOSSIP_DROP,
+    // handle the message locally
+    GOSSIP_DELIVER,
+    // handle the message locally and pass it on to other peers
+    GOSSIP_RELAY,
+};
+
+struct gossip_stats_s {
+    uint32_t originated;
+    uint32_t received;
+    uint32_t duplicates;
+    uint32_t self;
+    uint32_t stale;
+    uint32_t relayed;
+    uint32_t ttl_expired;
+    uint32_t hops_max;
+    uint64_t hops_sum;
+    uint32_t hops_hist[GOSSIP_HOPS_HIST_LEN];
+    uint32_t delay_samples;
+    uint32_t delay_max;
+    uint64_t delay_sum;
+};
+
+/**
+ * Generate the node id, has to be called before sending any message.
+ */
+void gossip_init();
+
+/**
+ * Add the envelope (origin node, sequence number, hop count and origin time) to a network message.
+ * Messages to all peers also get the next number of a second sequence, the receivers count its gaps as lost messages.
+ * @param b
+ * @param to_all - the message is sent to all peers.
+ */
+void gossip_add_envelope(struct blob_buf *b, int to_all);
+
+/**
+ * Decide what to do with a received message.
+ * Own messages, duplicates and (if may_expire is set) messages older than msg_max_age are dropped,
+ * messages are only relayed if gossip is enabled.
+ * @param node - origin node.
+ * @param seq - sequence number of the origin node.
+ * @param all_seq - number of the message among the messages to all peers, negative if it was not sent to all peers.
+ * @param hops - hops the message already travelled.
+ * @param ts - origin time (seconds).
+ * @param ts_ms - origin time (milliseconds part).
+ * @param may_expire - the message is useless once it is old.
+ * @return the gossip action.
+ */
+enum gossip_action gossip_handle_envelope(uint32_t node, uint32_t seq, int64_t all_seq, uint32_t hops, uint32_t ts,
+                                          uint32_t ts_ms, int may_expire);
+
+/**
+ * Add the gossip statistics to the blob buffer.
+ * @param b
+ * @return
+ */
+int build_gossip_overview(struct blob_buf *b);
+
+uint32_t gossip_node_id;
+
+#endif //DAWN_GOSSIP_H
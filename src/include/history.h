@@ -0,0 +1,51 @@
+#ifndef DAWN_HISTORY_H
+#define DAWN_HISTORY_H
+
+#include <libubox/blobmsg.h>
+#include <stdint.h>
+
+// Length of a history slot (s).
+#define HISTORY_RESOLUTION 60
+// Slots per ap, one day with a resolution of a minute.
+#define HISTORY_LEN 1440
+// Own aps with a history, the one updated longest ago is replaced.
+// Every ap takes HISTORY_LEN * sizeof(struct history_slot_s) bytes.
+#ifndef HISTORY_MAX_APS
+#define HISTORY_MAX_APS 16
+#endif
+
+// Value of a slot without a sample.
+#define HISTORY_NONE 0xffff
+
+/**
+ * Record the channel utilization and station count of an own ap, the aps of other nodes are ignored.
+ * A slot keeps the highest values of its interval.
+ * @param bssid_addr
+ * @param channel_utilization
+ * @param station_count
+ */
+void history_sample_ap(uint8_t *bssid_addr, uint32_t channel_utilization, uint32_t station_count);
+
+/**
+ * Count a kick of a client from an own ap.
+ * @param bssid_addr
+ */
+void history_add_kick(uint8_t *bssid_addr);
+
+/**
+ * Count a denied authentication or association at an own ap.
+ * @param bssid_addr
+ */
+void history_add_deny(uint8_t *bssid_addr);
+
+/**
+ * Add the history of the aps to the blob buffer, one array per value from the oldest to the current slot.
+ * Slots without a sample are -1.
+ * @param b
+ * @param bssid_addr - only this ap, NULL for all.
+ * @param len - number of slots, 0 for all.
+ * @return
+ */
+int build_history_overview(struct blob_buf *b, uint8_t *bssid_addr, int len);
+
+#endif //DAWN_HISTORY_H
@@ -0,0 +1,71 @@
+#ifndef DAWN_LBPLANNER_H
+#define DAWN_LBPLANNER_H
+
+#include <libubox/blobmsg.h>
+#include <stdint.h>
+
+// possible move of a client, gain is the score difference to the current ap
+struct lb_edge_s {
+    int client;
+    int ap;
+    int score;
+    int gain;
+};
+
+struct lb_problem_s {
+    int num_aps;
+    // clients an ap may have after the planning, and the ones it has
+    int *capacity;
+    int *load;
+
+    int num_clients;
+    int *cur_ap;
+    // result, the ap the client should be on and the gain of the move
+    int *new_ap;
+    int *new_gain;
+
+    int num_edges;
+    struct lb_edge_s *edges;
+
+    // moves that only improve the score need at least this gain
+    int min_gain;
+};
+
+struct lb_move_s {
+    uint8_t *bssid_addr;
+    uint8_t *client_addr;
+    uint8_t *target_addr;
+    char *neighbor_report;
+    int gain;
+};
+
+/**
+ * Assign the clients to the aps, greedy with capacities.
+ * First the moves with the biggest gain are taken as long as the target has room,
+ * then clients of aps that are over their capacity are moved to the best ap with room.
+ * Sorts the edges.
+ * @param p
+ * @return the number of clients that should move.
+ */
+int lb_solve(struct lb_problem_s *p);
+
+/**
+ * Plan the assignment of all known clients to the aps from the hearing map and the ap load.
+ * The capacity of an ap is lb_capacity or the average station count of its ssid plus max_station_diff,
+ * aps with a bad channel utilization get no additional clients.
+ * The plan is computed on a copy of the tables without holding their mutexes.
+ * A move is only passed on after it was planned min_kick_count times in a row.
+ * @param cb - called with client_array_mutex locked for every client that should move,
+ * the move is only valid during the call.
+ * @return the number of moves or -1 on failure.
+ */
+int lb_plan(void (*cb)(struct lb_move_s *move));
+
+/**
+ * Add the statistics of the last planning run to the blob buffer.
+ * @param b
+ * @return
+ */
+int build_lb_overview(struct blob_buf *b);
+
+#endif //DAWN_LBPLANNER_H
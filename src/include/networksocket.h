@@ -3,16 +3,21 @@
 
 #include <pthread.h>
 
+// Longer datagrams are truncated by the receivers.
+#define MAX_RECV_STRING 2048
+
 pthread_mutex_t send_mutex;
 
 /**
- * Init a socket using the runopts.
+ * Init the broadcast or multicast socket, it is read in the uloop like tcp and ubus,
+ * so all messages are handled in one thread.
+ * Has to be called after uloop_init().
  * @param _ip - ip to use.
  * @param _port - port to use.
  * @param _multicast_socket - if socket should be multicast or broadcast.
- * @return the socket.
+ * @return 0 on success.
  */
-int init_socket_runopts(const char *_ip, int _port, int _multicast_socket);
+int init_socket_uloop(const char *_ip, int _port, int _multicast_socket);
 
 /**
  * Send message via network.
@@ -0,0 +1,71 @@
+#ifndef DAWN_NRSTORE_H
+#define DAWN_NRSTORE_H
+
+#include <stdint.h>
+
+#include "datastorage.h"
+
+// Neighbor report elements of the known aps, one per bssid.
+#define NR_STORE_LEN ARRAY_AP_LEN
+// BSSID, BSSID information, operating class, channel number and PHY type.
+#define NR_FIXED_LEN 13
+// The hex string of the element and its terminating zero fit into NEIGHBOR_REPORT_LEN.
+#define NR_MAX_LEN ((NEIGHBOR_REPORT_LEN - 1) / 2)
+// Optional subelements.
+#define NR_SUBELEM_MAX_LEN (NR_MAX_LEN - NR_FIXED_LEN)
+
+/*
+[Element ID|1][LENGTH|1][BSSID|6][BSSID INFORMATION|4][Operating Class|1][Channel Number|1][PHY Type|1][Optional Subelements]
+Only the part after the length is stored, like hostapd takes it.
+*/
+struct nr_element_s {
+    uint8_t bssid_addr[ETH_ALEN];
+    uint32_t bssid_info;
+    uint8_t op_class;
+    uint8_t channel;
+    uint8_t phy_type;
+    uint8_t subelem_len;
+    uint8_t subelems[NR_SUBELEM_MAX_LEN];
+};
+
+/**
+ * Parse the neighbor report of an ap from the hex string of hostapd and store it.
+ * An empty string removes it.
+ * @param bssid_addr
+ * @param hex
+ * @return 1 if the stored element changed, 0 if it is the same, -1 if it is invalid or the store is full.
+ */
+int nr_store_set(uint8_t *bssid_addr, const char *hex);
+
+/**
+ * Copy the neighbor report of an ap.
+ * @param bssid_addr
+ * @param nr - can be NULL to only check if there is one.
+ * @return 0 if found, -1 otherwise.
+ */
+int nr_store_get(uint8_t *bssid_addr, struct nr_element_s *nr);
+
+/**
+ * Render the neighbor report of an ap to the hex string hostapd takes.
+ * @param bssid_addr
+ * @param preference - adds a BSS Transition Candidate Preference subelement, -1 for none.
+ * @param buf - set to an empty string if there is no neighbor report.
+ * @param len
+ * @return the length of the string, -1 if there is no neighbor report or the buffer is too small.
+ */
+int nr_store_get_hex(uint8_t *bssid_addr, int preference, char *buf, int len);
+
+/**
+ * Hash of the neighbor report of an ap, to notice changes.
+ * @param bssid_addr
+ * @return the hash, 0 if there is no neighbor report.
+ */
+uint32_t nr_store_hash(uint8_t *bssid_addr);
+
+/**
+ * Forget the neighbor report of an ap.
+ * @param bssid_addr
+ */
+void nr_store_remove(uint8_t *bssid_addr);
+
+#endif //DAWN_NRSTORE_H
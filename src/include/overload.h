@@ -0,0 +1,46 @@
+#ifndef DAWN_OVERLOAD_H
+#define DAWN_OVERLOAD_H
+
+#include <libubox/blobmsg.h>
+#include <stdint.h>
+
+// Interval of the event loop lag samples (ms).
+#define OVERLOAD_SAMPLE_INTERVAL 200
+// Mode transitions that are remembered.
+#define OVERLOAD_HIST_LEN 8
+
+// Each mode includes the ones before it.
+enum overload_mode {
+    OVERLOAD_NONE,
+    // hostapd requests are allowed without scoring
+    OVERLOAD_SKIP_SCORING,
+    // probe updates of other nodes are dropped and own ones not forwarded
+    OVERLOAD_DROP_PEER,
+    // kick evaluation waits for the next client update
+    OVERLOAD_DEFER_KICKS,
+    __OVERLOAD_MAX,
+};
+
+/**
+ * Current degradation mode.
+ * @return
+ */
+enum overload_mode overload_get_mode();
+
+/**
+ * Feed a sample of the event loop lag and the queue depth.
+ * Every multiple of overload_lag / overload_queue raises the mode by one at once,
+ * the mode is only lowered after the load stayed below it for overload_hold seconds.
+ * @param lag_ms - how late the sample timer fired.
+ * @param queue_bytes - bytes waiting in the send queue of the fullest tcp connection.
+ */
+void overload_sample(uint32_t lag_ms, int queue_bytes);
+
+/**
+ * Add the current mode, the load and the last transitions to the blob buffer.
+ * @param b
+ * @return
+ */
+int build_overload_overview(struct blob_buf *b);
+
+#endif //DAWN_OVERLOAD_H
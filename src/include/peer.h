@@ -0,0 +1,153 @@
+#ifndef DAWN_PEER_H
+#define DAWN_PEER_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "datastorage.h"
+#include "tcpsocket.h"
+
+// One entry per node of the network, a controller has one per agent.
+#ifndef PEER_TABLE_LEN
+#define PEER_TABLE_LEN 128
+#endif
+#define PEER_MAX_SSIDS 16
+#define PEER_MAX_BSSIDS 16
+// Own heartbeats that are remembered to match the echoes of the peers.
+#define PEER_HEARTBEAT_HIST_LEN 16
+
+// Bands a peer serves a ssid on.
+#define PEER_BAND_2G 0x01
+#define PEER_BAND_5G 0x02
+
+struct peer_ssid_s {
+    char ssid[SSID_MAX_LEN + 1];
+    uint8_t bands;
+};
+
+struct peer_s {
+    uint32_t node_id;
+    // address and tcp port of the node, several nodes can run on one host
+    struct in_addr addr;
+    uint16_t port;
+    time_t last_seen;
+
+    // ssids the peer is interested in, unknown until it advertised them
+    time_t interest_time;
+    int num_ssids;
+    struct peer_ssid_s ssids[PEER_MAX_SSIDS];
+
+    // messages of the node, gaps in the numbers of its messages to all peers are counted as missed
+    int last_seq_valid;
+    uint32_t last_seq;
+    uint32_t rx_msgs;
+    uint32_t missed_msgs;
+    uint32_t reordered_msgs;
+    uint32_t stale_msgs;
+
+    // propagation delay in ms, only meaningful with synchronized clocks
+    uint32_t delay_samples;
+    uint32_t delay_avg;
+    uint32_t delay_max;
+
+    // liveness, only known for peers that send heartbeats
+    time_t heartbeat_time;
+    int alive;
+    // last heartbeat received directly from the peer, echoed back for the rtt
+    uint32_t heartbeat_seq;
+    uint64_t heartbeat_rx_ms;
+    uint32_t rtt_samples;
+    uint32_t rtt_avg;
+
+    // aps of the peer, their state is removed when the peer dies
+    int num_bssids;
+    uint8_t bssids[PEER_MAX_BSSIDS][ETH_ALEN];
+};
+
+/**
+ * Get the peer with the node id.
+ * When the table is full the peer that was not seen for the longest time is replaced,
+ * a peer whose last heartbeat is younger than peer_timeout is never replaced.
+ * @param node_id
+ * @param create - add the peer if it is unknown.
+ * @return the peer or NULL (also if the table is full of live peers).
+ */
+struct peer_s *peer_get(uint32_t node_id, int create);
+
+/**
+ * Get the peer with the address and tcp port.
+ * @param addr
+ * @param port - tcp port of the peer (host byte order).
+ * @return the peer or NULL.
+ */
+struct peer_s *peer_find_addr(struct in_addr addr, uint16_t port);
+
+/**
+ * Account a message that was received from the node.
+ * @param peer
+ * @param all_seq - number of the message among the messages of the node to all peers, negative if it was not
+ * sent to all peers.
+ * @param delay - propagation delay in ms, negative if unknown.
+ */
+void peer_handle_msg(struct peer_s *peer, int64_t all_seq, int64_t delay);
+
+/**
+ * Remember when an own heartbeat was sent.
+ * @param seq
+ */
+void peer_heartbeat_sent(uint32_t seq);
+
+/**
+ * Add the echo of the last heartbeat of every peer (its sequence number and how long ago it was received).
+ * @param b
+ */
+void peer_add_heartbeat_echo(struct blob_buf *b);
+
+/**
+ * Handle a heartbeat of the peer.
+ * @param peer
+ * @param seq - heartbeat sequence number.
+ * @param direct - the heartbeat was not relayed, it can be used for the rtt.
+ */
+void peer_heartbeat_received(struct peer_s *peer, uint32_t seq, int direct);
+
+/**
+ * Handle the echo of an own heartbeat that the peer sent back.
+ * @param peer
+ * @param seq - own heartbeat sequence number.
+ * @param held_ms - time the peer held the heartbeat before echoing it.
+ */
+void peer_handle_echo(struct peer_s *peer, uint32_t seq, uint32_t held_ms);
+
+/**
+ * Set the bssids the peer owns.
+ * The state of bssids that the peer no longer owns is removed.
+ * @param peer
+ * @param bssids
+ * @param num_bssids
+ */
+void peer_set_bssids(struct peer_s *peer, uint8_t bssids[][ETH_ALEN], int num_bssids);
+
+/**
+ * Declare peers dead that didn't send a heartbeat for peer_timeout and remove the state of their aps.
+ */
+void peer_check_timeouts();
+
+/**
+ * Check if the peer wants messages about a ssid.
+ * Peers that didn't advertise their ssids (or did too long ago) get everything.
+ * @param peer - can be NULL.
+ * @param ssid - can be NULL, messages without ssid go to everyone.
+ * @return
+ */
+int peer_is_interested(struct peer_s *peer, const char *ssid);
+
+/**
+ * Add the peer table to the blob buffer.
+ * @param b
+ * @return
+ */
+int build_peer_overview(struct blob_buf *b);
+
+#endif //DAWN_PEER_H
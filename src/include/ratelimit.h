@@ -0,0 +1,74 @@
+#ifndef DAWN_RATELIMIT_H
+#define DAWN_RATELIMIT_H
+
+#include <libubox/blobmsg.h>
+#include <stdint.h>
+
+#include "datastorage.h"
+
+// Clients with a token bucket, the least recently active one is replaced when the table is full.
+#define RATELIMIT_TABLE_LEN 128
+// Heavy hitters that are tracked (space saving sketch).
+#define RATELIMIT_TOP_LEN 16
+// Seconds after which the heavy hitter counts are halved, so old storms fade out.
+#define RATELIMIT_DECAY_PERIOD 60
+// Interval of the flush of the aggregated probes (ms).
+#define RATELIMIT_FLUSH_INTERVAL 1000
+
+enum ratelimit_event {
+    RATELIMIT_PROBE,
+    RATELIMIT_AUTH,
+    RATELIMIT_ASSOC,
+    RATELIMIT_NUM_EVENTS,
+};
+
+/**
+ * Take a token from the bucket of the client for the event, every event type has its own bucket.
+ * The bucket is refilled with ratelimit_rate tokens per second up to ratelimit_burst.
+ * Events without a token are counted for the client and the heavy hitters.
+ * @param client_addr
+ * @param event
+ * @return 1 if the event should be processed, 0 if the client is limited.
+ */
+int ratelimit_event(uint8_t *client_addr, enum ratelimit_event event);
+
+/**
+ * Remember the answer that was given to the client, limited events get the same answer.
+ * @param client_addr
+ * @param bssid_addr
+ * @param event
+ * @param status
+ */
+void ratelimit_set_verdict(uint8_t *client_addr, uint8_t *bssid_addr, enum ratelimit_event event, int status);
+
+/**
+ * Answer of the last processed event of the client on the bssid.
+ * @param client_addr
+ * @param bssid_addr
+ * @param event
+ * @param fallback - returned if there is no answer for the bssid.
+ * @return the status.
+ */
+int ratelimit_get_verdict(uint8_t *client_addr, uint8_t *bssid_addr, enum ratelimit_event event, int fallback);
+
+/**
+ * Keep a probe of a limited client, only the newest probe per client is kept.
+ * @param entry
+ */
+void ratelimit_defer_probe(probe_entry entry);
+
+/**
+ * Hand the kept probes to the callback, together with the number of probes they replace.
+ * Also decays the heavy hitters.
+ * @param cb
+ */
+void ratelimit_flush(void (*cb)(probe_entry entry, uint32_t count));
+
+/**
+ * Add the limiter statistics and the heavy hitters to the blob buffer.
+ * @param b
+ * @return
+ */
+int build_ratelimit_overview(struct blob_buf *b);
+
+#endif //DAWN_RATELIMIT_H
@@ -1,23 +1,114 @@
 #ifndef DAWN_TCPSOCKET_H
 #define DAWN_TCPSOCKET_H
 
+#include <libubox/blobmsg.h>
 #include <libubox/ustream.h>
 #include <netinet/in.h>
 #include <pthread.h>
+#include <time.h>
 
 #define ARRAY_NETWORK_LEN 50
 
+// Every tcp message is prefixed with its length (4 bytes, network byte order).
+#define TCP_FRAME_HEADER_LEN 4
+#define TCP_MAX_FRAME_LEN (1024 * 1024)
+
+// Bound of the messages that are queued for one peer.
+#define TCP_QUEUE_MAX_BYTES (256 * 1024)
+// Queued messages are only handed to the stream while it holds less than this.
+#define TCP_WRITE_HIGH_WATERMARK (32 * 1024)
+// Seconds a peer may not accept any data before it is disconnected.
+#define TCP_STALL_TIMEOUT 30
+#define TCP_FRAME_KEY_LEN 64
+
+// Reconnect delay (seconds) of a discovered peer, doubled with every failed attempt.
+#define TCP_BACKOFF_MIN 1
+#define TCP_BACKOFF_MAX 300
+// Seconds a connection attempt may take.
+#define TCP_CONNECT_TIMEOUT 5
+// Peers that were not discovered for this many update_tcp_con periods are forgotten.
+#define TCP_PEER_FORGET_PERIODS 10
+
+// Dead connections are detected by keepalive probes and the user timeout instead of waiting for an EOF.
+#define TCP_KEEPALIVE_IDLE 10
+#define TCP_KEEPALIVE_INTERVAL 5
+#define TCP_KEEPALIVE_COUNT 3
+#define TCP_USER_TIMEOUT_MS (30 * 1000)
+
+struct tcp_buf {
+    char *data;
+    int len;
+    int size;
+};
+
+enum tcp_prio {
+    // config, maclist, ... never dropped, a peer that can't keep up is disconnected
+    TCP_PRIO_RELIABLE,
+    // probe, clients, ... dropped under pressure and superseded by newer messages with the same key
+    TCP_PRIO_DROPPABLE,
+};
+
+struct tcp_frame {
+    struct list_head list;
+    enum tcp_prio prio;
+    char key[TCP_FRAME_KEY_LEN];
+    int len;
+    // frame header and payload
+    char data[];
+};
+
+enum tcp_peer_state {
+    TCP_PEER_IDLE,
+    TCP_PEER_CONNECTING,
+    TCP_PEER_CONNECTED,
+    // waiting for the next attempt after a failure or a lost connection
+    TCP_PEER_BACKOFF,
+};
+
+// discovered peer, the connection manager keeps an outgoing connection to it
+struct tcp_peer_s {
+    struct sockaddr_in addr;
+    enum tcp_peer_state state;
+    time_t state_time;
+    time_t next_attempt;
+    time_t last_discovered;
+    int failures;
+    uint32_t transitions;
+    // outgoing connection, 0 if there is none
+    uint32_t con_id;
+};
+
 struct network_con_s {
     struct list_head list;
+    // unique, connections are referenced by id after they may have been freed
+    uint32_t id;
 
     struct uloop_fd fd;
     struct ustream_fd stream;
     struct sockaddr_in sock_addr;
     int connected;
+    int inbound;
+    int closing;
+
+    // incomplete frame that was read from the stream
+    struct tcp_buf read_buf;
+
+    // frames that are not yet handed to the stream
+    struct list_head send_queue;
+    int queued_frames;
+    int queued_bytes;
+    time_t last_write;
+
+    // statistics
+    uint32_t sent_frames;
+    uint32_t dropped_frames;
+    uint32_t superseded_frames;
 };
 
 /**
- * Add tcp connection.
+ * Add a discovered tcp peer.
+ * The connection manager connects to it and reconnects with exponential backoff.
+ * Calling it again for a known peer only refreshes the discovery time.
  * @param ipv4
  * @param port
  * @return
@@ -33,9 +124,65 @@ int run_server(int port);
 
 /**
  * Send message via tcp to all other hosts.
+ * In gossip mode the message is only sent to gossip_fanout random peers.
+ * In full mesh mode peers that advertised their ssids only get messages about them.
+ * Messages are queued per peer and written together at the end of the uloop iteration.
+ * @param msg
+ * @param prio - if the message may be dropped when the peer is slow.
+ * @param key - droppable messages with the same key replace each other in the queue, can be NULL.
+ * @param ssid - ssid the message is about, can be NULL.
+ */
+void send_tcp(char *msg, enum tcp_prio prio, const char *key, const char *ssid);
+
+/**
+ * Send message via tcp to one connection.
+ * @param con_id
  * @param msg
+ * @param prio
+ * @param key
+ * @return 0 on success or -1 if the connection is gone.
+ */
+int send_tcp_to(uint32_t con_id, char *msg, enum tcp_prio prio, const char *key);
+
+/**
+ * Bytes queued for a connection that were not yet handed to the stream.
+ * @param con_id
+ * @return the queued bytes or -1 if the connection is gone.
+ */
+int tcp_con_queued_bytes(uint32_t con_id);
+
+/**
+ * Bytes queued for the fullest connection that were not yet handed to the kernel.
+ * Each connection has its own queue of TCP_QUEUE_MAX_BYTES.
+ * @return
+ */
+int tcp_queued_bytes_max();
+
+/**
+ * Connection the currently handled message was received from.
+ * @return the connection id or 0 if the message was not received via tcp.
+ */
+uint32_t tcp_rx_con_id();
+
+/**
+ * Address of the peer the currently handled message was received from.
+ * @param addr
+ * @return 0 on success or -1 if the message was not received via tcp.
+ */
+int tcp_rx_addr(struct in_addr *addr);
+
+/**
+ * Number of outgoing tcp connections (connected or connecting).
+ * @return
+ */
+int tcp_outgoing_count();
+
+/**
+ * Add the state of all tcp connections (queue depth, drop counts, ...) to the blob buffer.
+ * @param b
+ * @return
  */
-void send_tcp(char *msg);
+int build_tcp_overview(struct blob_buf *b);
 
 /**
  * Debug message.
@@ -103,7 +103,16 @@ void del_client_interface(uint32_t id, const uint8_t *client_addr, uint32_t reas
  */
 void del_client_all_interfaces(const uint8_t *client_addr, uint32_t reason, uint8_t deauth, uint32_t ban_time);
 
-void wnm_disassoc_imminent(uint32_t id, const uint8_t *client_addr, char* dest_ap, uint32_t duration);
+/**
+ * Ask a client to move to another ap (BSS transition request).
+ * The request is sent asynchronously, the answer of hostapd is not awaited.
+ * @param id - ubus id of the hostapd interface the client is connected to.
+ * @param client_addr
+ * @param dest_ap - neighbor report of the preferred ap, can be NULL.
+ * @param duration
+ * @return 0 if the request was sent, -1 if too many requests are pending or sending failed.
+ */
+int wnm_disassoc_imminent(uint32_t id, const uint8_t *client_addr, char* dest_ap, uint32_t duration);
 
 /**
  * Send probe message via the network.
@@ -131,6 +140,13 @@ void add_client_update_timer(time_t time);
  */
 int handle_network_msg(char *msg);
 
+/**
+ * Called when an outgoing tcp connection is established.
+ * A node that just started requests the state of the network from the first peer.
+ * @param con_id
+ */
+void handle_tcp_connected(uint32_t con_id);
+
 /**
  * Send message via network.
  * @param msg
@@ -151,9 +167,28 @@ void blobmsg_add_macaddr(struct blob_buf *buf, const char *name, const uint8_t *
  * Function to set the probe counter to the min probe request.
  * This allows that the client is able to connect directly without sending multiple probe requests to the Access Point.
  * @param client_addr
+ * @param bssid_addr - ap the client was kicked from, its ssid limits the receivers.
+ * @return
+ */
+int send_set_probe(uint8_t client_addr[], uint8_t bssid_addr[]);
+
+/**
+ * Get the ubus id of the own hostapd interface with the bssid.
+ * @param bssid_addr
+ * @param id
+ * @return 0 on success or -1 if the bssid is not served here.
+ */
+int ubus_get_hostapd_id(uint8_t *bssid_addr, uint32_t *id);
+
+/**
+ * Send a kick command to the agent that serves the bssid (controller).
+ * @param bssid_addr
+ * @param client_addr
+ * @param neighbor_report - ap the client should move to, can be NULL.
+ * @param deauth - deauthenticate instead of a bss transition request.
  * @return
  */
-int send_set_probe(uint8_t client_addr[]);
+int send_kick_via_network(uint8_t *bssid_addr, uint8_t *client_addr, char *neighbor_report, int deauth);
 
 /**
  * Send control message to all hosts to add the mac to a don't control list.
@@ -166,4 +201,13 @@ int uci_send_via_network();
 
 void ubus_send_beacon_report(uint8_t client[], int id);
 
+/**
+ * Queue a beacon request for the current period, the requests are sent one by one.
+ * @param bssid_addr - ap the client is connected to.
+ * @param client_addr
+ * @param id - hostapd object of the ap.
+ * @return 0 on success, -1 if the queue is full.
+ */
+int beacon_req_enqueue(uint8_t *bssid_addr, uint8_t *client_addr, uint32_t id);
+
 #endif
@@ -50,4 +50,16 @@ int string_is_greater(uint8_t *str, uint8_t *str_2);
 
 int rcpi_to_rssi(int rcpi);
 
+// Start value of hash_update.
+#define HASH_INIT 2166136261u
+
+/**
+ * Add bytes to a hash (FNV-1a), to notice changes without keeping a copy.
+ * @param hash - HASH_INIT or the result of the last call.
+ * @param data
+ * @param len
+ * @return the new hash.
+ */
+uint32_t hash_update(uint32_t hash, const void *data, int len);
+
 #endif
\ No newline at end of file
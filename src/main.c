@@ -10,6 +10,7 @@
 #include "dawn_uci.h"
 #include "tcpsocket.h"
 #include "crypto.h"
+#include "gossip.h"
 
 void daemon_shutdown();
 
@@ -94,7 +95,9 @@ int main(int argc, char **argv) {
 
     // init crypto
     gcrypt_init();
-    gcrypt_set_key_and_iv(net_config.shared_key, net_config.iv);
+    gcrypt_set_key(net_config.shared_key);
+
+    gossip_init();
 
     struct time_config_s time_config = uci_get_time_config();
     timeout_config = time_config; // TODO: Refactor...
@@ -104,16 +107,7 @@ int main(int argc, char **argv) {
 
     init_mutex();
 
-    switch (net_config.network_option) {
-        case 0:
-            init_socket_runopts(net_config.broadcast_ip, net_config.broadcast_port, 0);
-            break;
-        case 1:
-            init_socket_runopts(net_config.broadcast_ip, net_config.broadcast_port, 1);
-            break;
-        default:
-            break;
-    }
+    // the datagram sockets are set up in dawn_init_ubus(), they are read in the uloop
 
     insert_macs_from_file();
     dawn_init_ubus(ubus_socket, hostapd_dir_glob);
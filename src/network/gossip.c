@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "gossip.h"
+#include "datastorage.h"
+#include "peer.h"
+
+struct gossip_seen_s {
+    uint32_t node;
+    uint32_t seq;
+    int valid;
+};
+
+// direct mapped, a collision only forgets an older message
+static struct gossip_seen_s gossip_seen[GOSSIP_SEEN_LEN];
+
+static struct gossip_stats_s gossip_stats;
+
+// identifies a message for the duplicate check
+static uint32_t gossip_seq = 0;
+// counts the messages that are sent to all peers, a gap means a lost message
+static uint32_t gossip_all_seq = 0;
+
+static int gossip_check_seen(uint32_t node, uint32_t seq);
+
+void gossip_init() {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    srandom(tv.tv_sec ^ tv.tv_usec ^ getpid());
+
+    // random() is 31 bit, so the id survives the json round trip as int32
+    gossip_node_id = random();
+    while (gossip_node_id == 0) {
+        gossip_node_id = random();
+    }
+
+    printf("Gossip node id: %08x\n", gossip_node_id);
+}
+
+static int gossip_check_seen(uint32_t node, uint32_t seq) {
+    uint32_t idx = ((node * 2654435761u) ^ seq) % GOSSIP_SEEN_LEN;
+
+    if (gossip_seen[idx].valid && gossip_seen[idx].node == node && gossip_seen[idx].seq == seq) {
+        return 1;
+    }
+
+    gossip_seen[idx].node = node;
+    gossip_seen[idx].seq = seq;
+    gossip_seen[idx].valid = 1;
+    return 0;
+}
+
+void gossip_add_envelope(struct blob_buf *b, int to_all) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    gossip_seq = (gossip_seq + 1) & 0x7fffffff;
+
+    blobmsg_add_u32(b, "node", gossip_node_id);
+    blobmsg_add_u32(b, "seq", gossip_seq);
+    if (to_all) {
+        gossip_all_seq = (gossip_all_seq + 1) & 0x7fffffff;
+        blobmsg_add_u32(b, "all_seq", gossip_all_seq);
+    }
+    blobmsg_add_u32(b, "hops", 0);
+    blobmsg_add_u32(b, "ts", tv.tv_sec);
+    blobmsg_add_u32(b, "ts_ms", tv.tv_usec / 1000);
+
+    gossip_stats.originated++;
+}
+
+enum gossip_action gossip_handle_envelope(uint32_t node, uint32_t seq, int64_t all_seq, uint32_t hops, uint32_t ts,
+                                          uint32_t ts_ms, int may_expire) {
+    struct timeval tv;
+    struct peer_s *peer;
+
+    // multicast and broadcast deliver our own messages, gossip may bring them back
+    if (node == gossip_node_id) {
+        gossip_stats.self++;
+        return GOSSIP_DROP;
+    }
+
+    if (gossip_check_seen(node, seq)) {
+        gossip_stats.duplicates++;
+        return GOSSIP_DROP;
+    }
+
+    // only meaningful with synchronized clocks, negative delays are ignored
+    gettimeofday(&tv, NULL);
+    int64_t delay = ts ? ((int64_t) tv.tv_sec - ts) * 1000 + tv.tv_usec / 1000 - ts_ms : -1;
+
+    // NULL if the peer table is full of live peers
+    peer = peer_get(node, 1);
+    if (peer != NULL) {
+        peer_handle_msg(peer, all_seq, delay);
+    }
+
+    if (may_expire && network_config.msg_max_age > 0 && delay > (int64_t) network_config.msg_max_age * 1000) {
+        gossip_stats.stale++;
+        if (peer != NULL) {
+            peer->stale_msgs++;
+        }
+        return GOSSIP_DROP;
+    }
+
+    gossip_stats.received++;
+    gossip_stats.hops_sum += hops;
+    gossip_stats.hops_hist[hops < GOSSIP_HOPS_HIST_LEN ? hops : GOSSIP_HOPS_HIST_LEN - 1]++;
+    if (hops > gossip_stats.hops_max) {
+        gossip_stats.hops_max = hops;
+    }
+
+    if (delay >= 0) {
+        gossip_stats.delay_samples++;
+        gossip_stats.delay_sum += delay;
+        if (delay > gossip_stats.delay_max) {
+            gossip_stats.delay_max = delay;
+        }
+    }
+
+    // tcp and hybrid have the tcp connections to relay over
+    if ((network_config.network_option != 2 && network_config.network_option != 3) ||
+        network_config.gossip_fanout <= 0) {
+        return GOSSIP_DELIVER;
+    }
+
+    if (hops + 1 >= network_config.gossip_ttl) {
+        gossip_stats.ttl_expired++;
+        return GOSSIP_DELIVER;
+    }
+
+    gossip_stats.relayed++;
+    return GOSSIP_RELAY;
+}
+
+int build_gossip_overview(struct blob_buf *b) {
+    char node_buf[9];
+    void *hist;
+
+    blob_buf_init(b, 0);
+    sprintf(node_buf, "%08x", gossip_node_id);
+    blobmsg_add_string(b, "node", node_buf);
+    blobmsg_add_u32(b, "fanout", network_config.gossip_fanout);
+    blobmsg_add_u32(b, "ttl", network_config.gossip_ttl);
+    blobmsg_add_u32(b, "originated", gossip_stats.originated);
+    blobmsg_add_u32(b, "received", gossip_stats.received);
+    blobmsg_add_u32(b, "duplicates", gossip_stats.duplicates);
+    blobmsg_add_u32(b, "self", gossip_stats.self);
+    blobmsg_add_u32(b, "stale", gossip_stats.stale);
+    blobmsg_add_u32(b, "relayed", gossip_stats.relayed);
+    blobmsg_add_u32(b, "ttl_expired", gossip_stats.ttl_expired);
+    blobmsg_add_u32(b, "hops_max", gossip_stats.hops_max);
+    blobmsg_add_u32(b, "hops_avg_x100",
+                    gossip_stats.received ? gossip_stats.hops_sum * 100 / gossip_stats.received : 0);
+    blobmsg_add_u32(b, "delay_max_ms", gossip_stats.delay_max);
+    blobmsg_add_u32(b, "delay_avg_ms", gossip_stats.delay_samples ? gossip_stats.delay_sum / gossip_stats.delay_samples : 0);
+
+    hist = blobmsg_open_array(b, "hops");
+    for (int i = 0; i < GOSSIP_HOPS_HIST_LEN; i++) {
+        blobmsg_add_u32(b, NULL, gossip_stats.hops_hist[i]);
+    }
+    blobmsg_close_array(b, hist);
+    return 0;
+}
@@ -4,6 +4,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <libubox/blobmsg_json.h>
+#include <libubox/uloop.h>
 
 #include "networksocket.h"
 #include "datastorage.h"
@@ -12,9 +13,6 @@
 #include "ubus.h"
 #include "crypto.h"
 
-/* Network Defines */
-#define MAX_RECV_STRING 2048
-
 /* Network Attributes */
 int sock;
 struct sockaddr_in addr;
@@ -24,11 +22,13 @@ char recv_string[MAX_RECV_STRING + 1];
 int recv_string_len;
 int multicast_socket;
 
-void *receive_msg(void *args);
+static void receive_msg_cb(struct uloop_fd *fd, unsigned int events);
 
-void *receive_msg_enc(void *args);
+static struct uloop_fd sock_fd = {
+        .cb = receive_msg_cb
+};
 
-int init_socket_runopts(const char *_ip, int _port, int _multicast_socket) {
+int init_socket_uloop(const char *_ip, int _port, int _multicast_socket) {
 
     port = _port;
     ip = _ip;
@@ -41,71 +41,34 @@ int init_socket_runopts(const char *_ip, int _port, int _multicast_socket) {
         sock = setup_broadcast_socket(ip, port, &addr);
     }
 
-    pthread_t sniffer_thread;
-    if (network_config.use_symm_enc) {
-        if (pthread_create(&sniffer_thread, NULL, receive_msg_enc, NULL)) {
-            fprintf(stderr, "Could not create receiving thread!\n");
-            return -1;
-        }
-    } else {
-        if (pthread_create(&sniffer_thread, NULL, receive_msg, NULL)) {
-            fprintf(stderr, "Could not create receiving thread!\n");
-            return -1;
-        }
+    if (sock < 0) {
+        fprintf(stderr, "Could not create datagram socket!\n");
+        return -1;
     }
 
-    fprintf(stdout, "Connected to %s:%d\n", ip, port);
+    sock_fd.fd = sock;
+    uloop_fd_add(&sock_fd, ULOOP_READ);
+
+    fprintf(stdout, "Connected to %s:%d (uloop)\n", ip, port);
 
     return 0;
 }
 
-void *receive_msg(void *args) {
-    while (1) {
-        if ((recv_string_len =
-                     recvfrom(sock, recv_string, MAX_RECV_STRING, 0, NULL, 0)) < 0) {
-            fprintf(stderr, "Could not receive message!");
-            continue;
-        }
-
-        if (recv_string == NULL) {
-            return 0;
-        }
-
-        if (strlen(recv_string) <= 0) {
-            return 0;
-        }
+static void receive_msg_cb(struct uloop_fd *fd, unsigned int events) {
+    // read everything that arrived, the socket is level triggered but this saves wakeups
+    while ((recv_string_len = recvfrom(fd->fd, recv_string, MAX_RECV_STRING, MSG_DONTWAIT, NULL, 0)) > 0) {
         recv_string[recv_string_len] = '\0';
 
-        printf("Received network message: %s\n", recv_string);
-        handle_network_msg(recv_string);
-    }
-}
-
-void *receive_msg_enc(void *args) {
-    while (1) {
-        if ((recv_string_len =
-                     recvfrom(sock, recv_string, MAX_RECV_STRING, 0, NULL, 0)) < 0) {
-            fprintf(stderr, "Could not receive message!\n");
-            continue;
-        }
-
-        if (recv_string == NULL) {
-            return 0;
+        if (network_config.use_symm_enc) {
+            char *dec = gcrypt_decrypt_msg(recv_string, recv_string_len, NULL);
+            if (dec == NULL) {
+                fprintf(stderr, "Could not decrypt message!\n");
+                continue;
+            }
+            handle_network_msg(dec);
+        } else {
+            handle_network_msg(recv_string);
         }
-
-        if (strlen(recv_string) <= 0) {
-            return 0;
-        }
-        recv_string[recv_string_len] = '\0';
-
-        char *base64_dec_str = malloc(B64_DECODE_LEN(strlen(recv_string)));
-        int base64_dec_length = b64_decode(recv_string, base64_dec_str, B64_DECODE_LEN(strlen(recv_string)));
-        char *dec = gcrypt_decrypt_msg(base64_dec_str, base64_dec_length);
-
-        printf("Received network message: %s\n", dec);
-        free(base64_dec_str);
-        handle_network_msg(dec);
-        free(dec);
     }
 }
 
@@ -133,14 +96,16 @@ int send_string_enc(char *msg) {
 
     int length_enc;
     size_t msglen = strlen(msg);
-    char *enc = gcrypt_encrypt_msg(msg, msglen + 1, &length_enc);
-
-    char *base64_enc_str = malloc(B64_ENCODE_LEN(length_enc));
-    size_t base64_enc_length = b64_encode(enc, length_enc, base64_enc_str, B64_ENCODE_LEN(length_enc));
+    char *enc = gcrypt_encrypt_msg(msg, msglen, &length_enc);
+    if (enc == NULL) {
+        fprintf(stderr, "Could not encrypt message!\n");
+        pthread_mutex_unlock(&send_mutex);
+        return -1;
+    }
 
     if (sendto(sock,
-               base64_enc_str,
-               base64_enc_length, // very important to use actual length of string because of '\0' in encrypted msg
+               enc,
+               length_enc, // binary message, don't use strlen
                0,
                (struct sockaddr *) &addr,
                sizeof(addr)) < 0) {
@@ -148,8 +113,6 @@ int send_string_enc(char *msg) {
         pthread_mutex_unlock(&send_mutex);
         exit(EXIT_FAILURE);
     }
-    free(base64_enc_str);
-    free(enc);
     pthread_mutex_unlock(&send_mutex);
     return 0;
 }
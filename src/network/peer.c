@@ -0,0 +1,307 @@
+#include <arpa/inet.h>
+#include <libubox/blobmsg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "peer.h"
+#include "ubus.h"
+#include "utils.h"
+
+struct peer_heartbeat_s {
+    uint32_t seq;
+    uint64_t sent_ms;
+};
+
+static struct peer_s peer_table[PEER_TABLE_LEN];
+static int peer_last = -1;
+
+static struct peer_heartbeat_s peer_heartbeats[PEER_HEARTBEAT_HIST_LEN];
+
+static uint64_t peer_now_ms();
+
+static int peer_bssid_owned(struct peer_s *except, uint8_t *bssid_addr);
+
+static void peer_remove_aps(struct peer_s *peer);
+
+static uint64_t peer_now_ms() {
+    struct timespec ts;
+
+    // not affected by clock changes, the rtt is measured against the own clock only
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct peer_s *peer_get(uint32_t node_id, int create) {
+    time_t now = time(0);
+    int oldest = -1;
+
+    for (int i = 0; i <= peer_last; i++) {
+        if (peer_table[i].node_id == node_id) {
+            return &peer_table[i];
+        }
+        // a live peer keeps its entry, its aps would be removed with it
+        if (peer_table[i].heartbeat_time != 0 && now - peer_table[i].heartbeat_time <= timeout_config.peer_timeout) {
+            continue;
+        }
+        if (oldest < 0 || peer_table[i].last_seen < peer_table[oldest].last_seen) {
+            oldest = i;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    // table is full, replace the peer that was not seen for the longest time
+    int replace = peer_last >= PEER_TABLE_LEN - 1;
+    if (replace && oldest < 0) {
+        // the messages of the new peer are handled, but not tracked
+        return NULL;
+    }
+    int idx = replace ? oldest : ++peer_last;
+    if (replace) {
+        struct peer_s *old = &peer_table[idx];
+
+        // nobody would remove the state of the aps of the old peer anymore
+        printf("Peer table full, replacing peer %08x and removing the state of its %d aps\n", old->node_id,
+               old->num_bssids);
+        peer_remove_aps(old);
+    }
+    memset(&peer_table[idx], 0, sizeof(struct peer_s));
+    peer_table[idx].node_id = node_id;
+    peer_table[idx].last_seen = now;
+    return &peer_table[idx];
+}
+
+struct peer_s *peer_find_addr(struct in_addr addr, uint16_t port) {
+    for (int i = 0; i <= peer_last; i++) {
+        if (peer_table[i].addr.s_addr == addr.s_addr && peer_table[i].port == port) {
+            return &peer_table[i];
+        }
+    }
+    return NULL;
+}
+
+void peer_handle_msg(struct peer_s *peer, int64_t all_seq, int64_t delay) {
+    // sequence numbers are 31 bit
+    uint32_t diff = ((uint32_t) all_seq - peer->last_seq) & 0x7fffffff;
+
+    peer->last_seen = time(0);
+
+    // unicast and interest filtered messages are not numbered, they would leave gaps for the other peers
+    if (all_seq >= 0) {
+        if (!peer->last_seq_valid) {
+            peer->last_seq = all_seq;
+            peer->last_seq_valid = 1;
+        } else if (diff < 0x40000000) {
+            peer->missed_msgs += diff - 1;
+            peer->last_seq = all_seq;
+        } else {
+            // arrived late, it was counted as missed before
+            peer->reordered_msgs++;
+            if (peer->missed_msgs > 0) {
+                peer->missed_msgs--;
+            }
+        }
+    }
+    peer->rx_msgs++;
+
+    if (delay >= 0) {
+        // ewma with 1/8 weight for the new sample
+        if (peer->delay_samples == 0) {
+            peer->delay_avg = delay;
+        } else {
+            peer->delay_avg = (peer->delay_avg * 7 + delay) / 8;
+        }
+        if (delay > peer->delay_max) {
+            peer->delay_max = delay;
+        }
+        peer->delay_samples++;
+    }
+}
+
+void peer_heartbeat_sent(uint32_t seq) {
+    peer_heartbeats[seq % PEER_HEARTBEAT_HIST_LEN].seq = seq;
+    peer_heartbeats[seq % PEER_HEARTBEAT_HIST_LEN].sent_ms = peer_now_ms();
+}
+
+void peer_add_heartbeat_echo(struct blob_buf *b) {
+    void *echo_list, *echo;
+    char node_buf[9];
+    uint64_t now = peer_now_ms();
+
+    echo_list = blobmsg_open_table(b, "echo");
+    for (int i = 0; i <= peer_last; i++) {
+        if (!peer_table[i].alive || peer_table[i].heartbeat_rx_ms == 0) {
+            continue;
+        }
+        sprintf(node_buf, "%08x", peer_table[i].node_id);
+        echo = blobmsg_open_table(b, node_buf);
+        blobmsg_add_u32(b, "seq", peer_table[i].heartbeat_seq);
+        blobmsg_add_u32(b, "held", now - peer_table[i].heartbeat_rx_ms);
+        blobmsg_close_table(b, echo);
+    }
+    blobmsg_close_table(b, echo_list);
+}
+
+void peer_heartbeat_received(struct peer_s *peer, uint32_t seq, int direct) {
+    if (!peer->alive) {
+        printf("Peer %08x is alive\n", peer->node_id);
+    }
+    peer->alive = 1;
+    peer->heartbeat_time = time(0);
+
+    if (direct) {
+        peer->heartbeat_seq = seq;
+        peer->heartbeat_rx_ms = peer_now_ms();
+    }
+}
+
+void peer_handle_echo(struct peer_s *peer, uint32_t seq, uint32_t held_ms) {
+    struct peer_heartbeat_s *sent = &peer_heartbeats[seq % PEER_HEARTBEAT_HIST_LEN];
+
+    // too old, the slot was reused
+    if (sent->seq != seq || sent->sent_ms == 0) {
+        return;
+    }
+
+    int64_t rtt = (int64_t) (peer_now_ms() - sent->sent_ms) - held_ms;
+    if (rtt < 0) {
+        return;
+    }
+
+    // ewma with 1/8 weight for the new sample
+    if (peer->rtt_samples == 0) {
+        peer->rtt_avg = rtt;
+    } else {
+        peer->rtt_avg = (peer->rtt_avg * 7 + rtt) / 8;
+    }
+    peer->rtt_samples++;
+}
+
+void peer_set_bssids(struct peer_s *peer, uint8_t bssids[][ETH_ALEN], int num_bssids) {
+    uint8_t removed[PEER_MAX_BSSIDS][ETH_ALEN];
+    int num_removed = 0;
+
+    // an ap of the peer went down
+    for (int i = 0; i < peer->num_bssids; i++) {
+        int found = 0;
+        for (int j = 0; j < num_bssids; j++) {
+            if (mac_is_equal(peer->bssids[i], bssids[j])) {
+                found = 1;
+                break;
+            }
+        }
+        if (!found) {
+            printf("Peer %08x removed ap " MACSTR "\n", peer->node_id, MAC2STR(peer->bssids[i]));
+            memcpy(removed[num_removed++], peer->bssids[i], ETH_ALEN);
+        }
+    }
+    remove_bssid_entries(removed, num_removed);
+
+    if (num_bssids > PEER_MAX_BSSIDS) {
+        num_bssids = PEER_MAX_BSSIDS;
+    }
+    memcpy(peer->bssids, bssids, num_bssids * ETH_ALEN);
+    peer->num_bssids = num_bssids;
+}
+
+// check if another live peer owns the bssid
+static int peer_bssid_owned(struct peer_s *except, uint8_t *bssid_addr) {
+    for (int i = 0; i <= peer_last; i++) {
+        if (&peer_table[i] == except || !peer_table[i].alive) {
+            continue;
+        }
+        for (int j = 0; j < peer_table[i].num_bssids; j++) {
+            if (mac_is_equal(peer_table[i].bssids[j], bssid_addr)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// remove the state of the aps of the peer, the aps another live peer announces are kept
+static void peer_remove_aps(struct peer_s *peer) {
+    // a restarted node comes back with a new id and the same aps
+    for (int j = 0; j < peer->num_bssids; j++) {
+        if (peer_bssid_owned(peer, peer->bssids[j])) {
+            memmove(peer->bssids[j], peer->bssids[j + 1], (peer->num_bssids - j - 1) * ETH_ALEN);
+            peer->num_bssids--;
+            j--;
+        }
+    }
+    remove_bssid_entries(peer->bssids, peer->num_bssids);
+    peer->num_bssids = 0;
+}
+
+void peer_check_timeouts() {
+    time_t now = time(0);
+
+    for (int i = 0; i <= peer_last; i++) {
+        struct peer_s *peer = &peer_table[i];
+
+        if (!peer->alive || now - peer->heartbeat_time <= timeout_config.peer_timeout) {
+            continue;
+        }
+
+        printf("Peer %08x is dead, removing the state of its %d aps\n", peer->node_id, peer->num_bssids);
+        peer->alive = 0;
+        peer->heartbeat_rx_ms = 0;
+        peer_remove_aps(peer);
+    }
+}
+
+int peer_is_interested(struct peer_s *peer, const char *ssid) {
+    if (peer == NULL || ssid == NULL || peer->interest_time == 0) {
+        return 1;
+    }
+
+    // the advertisement is repeated with every tcp update, an old one may be outdated
+    if (time(0) - peer->interest_time > 3 * timeout_config.update_tcp_con) {
+        return 1;
+    }
+
+    for (int i = 0; i < peer->num_ssids; i++) {
+        if (strcmp(peer->ssids[i].ssid, ssid) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int build_peer_overview(struct blob_buf *b) {
+    void *peer_list, *ssid_list, *bssid_list;
+    char node_buf[9];
+
+    blob_buf_init(b, 0);
+    for (int i = 0; i <= peer_last; i++) {
+        sprintf(node_buf, "%08x", peer_table[i].node_id);
+        peer_list = blobmsg_open_table(b, node_buf);
+        blobmsg_add_string(b, "address", inet_ntoa(peer_table[i].addr));
+        blobmsg_add_u32(b, "port", peer_table[i].port);
+        blobmsg_add_u32(b, "last_seen", time(0) - peer_table[i].last_seen);
+        blobmsg_add_u8(b, "alive", peer_table[i].alive);
+        blobmsg_add_u32(b, "rtt_ms", peer_table[i].rtt_avg);
+        blobmsg_add_u32(b, "rx_msgs", peer_table[i].rx_msgs);
+        blobmsg_add_u32(b, "missed_msgs", peer_table[i].missed_msgs);
+        blobmsg_add_u32(b, "reordered_msgs", peer_table[i].reordered_msgs);
+        blobmsg_add_u32(b, "stale_msgs", peer_table[i].stale_msgs);
+        blobmsg_add_u32(b, "delay_avg_ms", peer_table[i].delay_avg);
+        blobmsg_add_u32(b, "delay_max_ms", peer_table[i].delay_max);
+
+        ssid_list = blobmsg_open_table(b, "ssids");
+        for (int j = 0; j < peer_table[i].num_ssids; j++) {
+            blobmsg_add_u32(b, peer_table[i].ssids[j].ssid, peer_table[i].ssids[j].bands);
+        }
+        blobmsg_close_table(b, ssid_list);
+
+        bssid_list = blobmsg_open_array(b, "bssids");
+        for (int j = 0; j < peer_table[i].num_bssids; j++) {
+            blobmsg_add_macaddr(b, NULL, peer_table[i].bssids[j]);
+        }
+        blobmsg_close_array(b, bssid_list);
+        blobmsg_close_table(b, peer_list);
+    }
+    return 0;
+}
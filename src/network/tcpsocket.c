@@ -1,8 +1,8 @@
 #include <libubox/usock.h>
 #include <libubox/ustream.h>
 #include <libubox/uloop.h>
-#include <libubox/utils.h> // base64 encoding
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,127 +10,461 @@
 #include <arpa/inet.h>
 #include "ubus.h"
 #include "crypto.h"
+#include "peer.h"
 
+// outgoing connections, used for sending
 LIST_HEAD(tcp_sock_list);
 
-struct network_con_s *tcp_list_contains_address(struct sockaddr_in entry);
+// incoming connections, used for receiving
+LIST_HEAD(tcp_client_list);
+
+static void tcp_flush_cb(struct uloop_timeout *t);
+
+static void tcp_manager_cb(struct uloop_timeout *t);
+
+static void tcp_peer_con_closed(struct network_con_s *con);
+
+static struct network_con_s *tcp_find_con(uint32_t id);
 
 static struct uloop_fd server;
-struct client *next_client = NULL;
 
-struct client {
-    struct sockaddr_in sin;
+// scratch buffer used to write several queued frames at once
+static struct tcp_buf tcp_write_buf;
+
+// connection the currently handled message was received from
+static struct network_con_s *tcp_rx_con = NULL;
 
-    struct ustream_fd s;
-    int ctr;
-    int counter;
+static uint32_t tcp_con_next_id = 1;
+
+static struct uloop_timeout tcp_flush_timer = {
+        .cb = tcp_flush_cb
+};
+
+static struct uloop_timeout tcp_manager_timer = {
+        .cb = tcp_manager_cb
 };
 
-static void client_close(struct ustream *s) {
-    struct client *cl = container_of(s,
-    struct client, s.stream);
+// discovered peers, kept even while they are not reachable
+static struct tcp_peer_s tcp_peers[ARRAY_NETWORK_LEN];
+static int tcp_num_peers = 0;
+
+static const char *tcp_peer_state_names[] = {
+        [TCP_PEER_IDLE] = "idle",
+        [TCP_PEER_CONNECTING] = "connecting",
+        [TCP_PEER_CONNECTED] = "connected",
+        [TCP_PEER_BACKOFF] = "backoff",
+};
 
-    fprintf(stderr, "Connection closed\n");
-    ustream_free(s);
-    close(cl->s.fd.fd);
-    free(cl);
+static int tcp_buf_append(struct tcp_buf *buf, const char *data, int len) {
+    if (buf->len + len + 1 > buf->size) {
+        int size = buf->size ? buf->size : 2048;
+        while (size < buf->len + len + 1)
+            size *= 2;
+
+        char *tmp = realloc(buf->data, size);
+        if (tmp == NULL) {
+            fprintf(stderr, "Failed to grow tcp buffer!\n");
+            return -1;
+        }
+        buf->data = tmp;
+        buf->size = size;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    return 0;
 }
 
-static void client_notify_write(struct ustream *s, int bytes) {
-    return;
+static void tcp_buf_free(struct tcp_buf *buf) {
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+    buf->size = 0;
 }
 
-static void client_notify_state(struct ustream *s) {
-    struct client *cl = container_of(s,
-    struct client, s.stream);
+static void tcp_con_free(struct network_con_s *con) {
+    if (!con->inbound) {
+        tcp_peer_con_closed(con);
+    }
 
-    if (!s->eof)
-        return;
+    if (con->connected) {
+        ustream_free(&con->stream.stream);
+        close(con->stream.fd.fd);
+    } else {
+        uloop_fd_delete(&con->fd);
+        close(con->fd.fd);
+    }
+    list_del(&con->list);
+    tcp_buf_free(&con->read_buf);
 
-    fprintf(stderr, "eof!, pending: %d, total: %d\n", s->w.data_bytes, cl->ctr);
+    struct tcp_frame *frame, *tmp;
+    list_for_each_entry_safe(frame, tmp, &con->send_queue, list)
+    {
+        list_del(&frame->list);
+        free(frame);
+    }
+    free(con);
+}
 
-    if (!s->w.data_bytes)
-        return client_close(s);
+static struct network_con_s *tcp_con_alloc() {
+    struct network_con_s *con = calloc(1, sizeof(struct network_con_s));
+    if (con == NULL) {
+        return NULL;
+    }
+    INIT_LIST_HEAD(&con->send_queue);
+    con->last_write = time(0);
+    con->id = tcp_con_next_id++;
+    return con;
+}
 
+static void tcp_con_drop_frame(struct network_con_s *con, struct tcp_frame *frame) {
+    list_del(&frame->list);
+    con->queued_frames--;
+    con->queued_bytes -= frame->len;
+    con->dropped_frames++;
+    free(frame);
 }
 
-static void client_to_server_close(struct ustream *s) {
-    struct network_con_s *con = container_of(s,
-    struct network_con_s, stream.stream);
+// queue a frame for the peer, returns -1 if the peer can't keep up with reliable messages
+static int tcp_con_enqueue(struct network_con_s *con, uint32_t header, const char *payload, int payload_len,
+                           enum tcp_prio prio, const char *key) {
+    struct tcp_frame *frame, *tmp, *old = NULL;
+    int len = TCP_FRAME_HEADER_LEN + payload_len;
+    int old_len = 0;
 
-    fprintf(stderr, "Connection to server closed\n");
-    ustream_free(s);
-    close(con->fd.fd);
-    list_del(&con->list);
-    free(con);
+    // a newer update replaces the queued one, so it keeps its position
+    if (prio == TCP_PRIO_DROPPABLE && key != NULL) {
+        list_for_each_entry(frame, &con->send_queue, list)
+        {
+            if (frame->prio == TCP_PRIO_DROPPABLE && strcmp(frame->key, key) == 0) {
+                old = frame;
+                old_len = frame->len;
+                break;
+            }
+        }
+    }
+
+    // make room by dropping the oldest droppable frames, the replaced one is freed anyway
+    list_for_each_entry_safe(frame, tmp, &con->send_queue, list)
+    {
+        if (con->queued_bytes - old_len + len <= TCP_QUEUE_MAX_BYTES) {
+            break;
+        }
+        if (frame->prio == TCP_PRIO_DROPPABLE && frame != old) {
+            tcp_con_drop_frame(con, frame);
+        }
+    }
+
+    if (con->queued_bytes - old_len + len > TCP_QUEUE_MAX_BYTES) {
+        if (prio == TCP_PRIO_DROPPABLE) {
+            con->dropped_frames++;
+            return 0;
+        }
+        return -1;
+    }
+
+    frame = malloc(sizeof(struct tcp_frame) + len);
+    if (frame == NULL) {
+        con->dropped_frames++;
+        return prio == TCP_PRIO_DROPPABLE ? 0 : -1;
+    }
+
+    frame->prio = prio;
+    frame->len = len;
+    frame->key[0] = '\0';
+    if (key != NULL) {
+        snprintf(frame->key, TCP_FRAME_KEY_LEN, "%s", key);
+    }
+    memcpy(frame->data, &header, TCP_FRAME_HEADER_LEN);
+    memcpy(frame->data + TCP_FRAME_HEADER_LEN, payload, payload_len);
+
+    if (old != NULL) {
+        list_add(&frame->list, &old->list);
+        list_del(&old->list);
+        con->queued_bytes += len - old->len;
+        con->superseded_frames++;
+        free(old);
+        return 0;
+    }
+
+    list_add_tail(&frame->list, &con->send_queue);
+    con->queued_frames++;
+    con->queued_bytes += len;
+    return 0;
 }
 
-static void client_to_server_state(struct ustream *s) {
-    struct client *cl = container_of(s,
-    struct client, s.stream);
+// hand queued frames to the stream until it reaches the watermark, returns -1 if the peer is stalled
+static int tcp_con_flush(struct network_con_s *con) {
+    struct tcp_frame *frame, *tmp;
+    struct ustream *s = &con->stream.stream;
 
-    if (!s->eof)
-        return;
+    if (!con->connected || list_empty(&con->send_queue)) {
+        return 0;
+    }
+
+    int pending = ustream_pending_data(s, true);
+    if (pending >= TCP_WRITE_HIGH_WATERMARK) {
+        return time(0) - con->last_write > TCP_STALL_TIMEOUT ? -1 : 0;
+    }
+
+    tcp_write_buf.len = 0;
+    list_for_each_entry_safe(frame, tmp, &con->send_queue, list)
+    {
+        if (pending + tcp_write_buf.len >= TCP_WRITE_HIGH_WATERMARK) {
+            break;
+        }
+        if (tcp_buf_append(&tcp_write_buf, frame->data, frame->len)) {
+            break;
+        }
+        list_del(&frame->list);
+        con->queued_frames--;
+        con->queued_bytes -= frame->len;
+        con->sent_frames++;
+        free(frame);
+    }
+
+    if (tcp_write_buf.len == 0) {
+        return 0;
+    }
+
+    // all frames that fit go out with one write
+    int len_ustream = ustream_write(s, tcp_write_buf.data, tcp_write_buf.len, false);
+    if (len_ustream <= 0) {
+        fprintf(stderr,"Ustream error!\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void tcp_handle_frame(char *payload, int len) {
+    if (network_config.use_symm_enc) {
+        char *dec = gcrypt_decrypt_msg(payload, len, NULL);
+        if (dec == NULL) {
+            fprintf(stderr, "Could not decrypt message!\n");
+            return;
+        }
+        handle_network_msg(dec);
+    } else {
+        // payload is followed by at least one byte of the buffer, terminate the string there
+        char next = payload[len];
+        payload[len] = '\0';
+        handle_network_msg(payload);
+        payload[len] = next;
+    }
+}
+
+// handles all complete frames in data, returns the number of consumed bytes or -1 on a protocol error
+static int tcp_handle_frames(char *data, int len) {
+    int pos = 0;
 
-    fprintf(stderr, "eof!, pending: %d, total: %d\n", s->w.data_bytes, cl->ctr);
+    while (len - pos >= TCP_FRAME_HEADER_LEN) {
+        uint32_t frame_len;
+        memcpy(&frame_len, data + pos, TCP_FRAME_HEADER_LEN);
+        frame_len = ntohl(frame_len);
 
-    if (!s->w.data_bytes)
-        return client_to_server_close(s);
+        if (frame_len == 0 || frame_len > TCP_MAX_FRAME_LEN) {
+            fprintf(stderr, "Invalid frame length: %u\n", frame_len);
+            return -1;
+        }
+
+        if (len - pos - TCP_FRAME_HEADER_LEN < frame_len) {
+            break;
+        }
 
+        tcp_handle_frame(data + pos + TCP_FRAME_HEADER_LEN, frame_len);
+        pos += TCP_FRAME_HEADER_LEN + frame_len;
+    }
+    return pos;
 }
 
-static void client_read_cb(struct ustream *s, int bytes) {
+// returns -1 if the connection was closed
+static int tcp_read_stream(struct network_con_s *con, struct ustream *s) {
     char *str;
     int len;
 
-    do {
-        str = ustream_get_read_buf(s, &len);
-        if (!str)
-            break;
+    while ((str = ustream_get_read_buf(s, &len)) != NULL && len > 0) {
+        int consumed;
 
-        if (network_config.use_symm_enc) {
-            char *base64_dec_str = malloc(B64_DECODE_LEN(strlen(str)));
-            int base64_dec_length = b64_decode(str, base64_dec_str, B64_DECODE_LEN(strlen(str)));
-            char *dec = gcrypt_decrypt_msg(base64_dec_str, base64_dec_length);
+        if (con->read_buf.len == 0) {
+            // fast path: handle frames directly in the stream buffer
+            consumed = tcp_handle_frames(str, len);
+            if (consumed < 0) {
+                tcp_con_free(con);
+                return -1;
+            }
 
-            free(base64_dec_str);
-            handle_network_msg(dec);
-            free(dec);
+            // keep the incomplete rest, it may continue in the next stream buffer
+            if (tcp_buf_append(&con->read_buf, str + consumed, len - consumed)) {
+                tcp_con_free(con);
+                return -1;
+            }
         } else {
-            handle_network_msg(str);
-        }
+            if (tcp_buf_append(&con->read_buf, str, len)) {
+                tcp_con_free(con);
+                return -1;
+            }
 
+            consumed = tcp_handle_frames(con->read_buf.data, con->read_buf.len);
+            if (consumed < 0) {
+                tcp_con_free(con);
+                return -1;
+            }
+            memmove(con->read_buf.data, con->read_buf.data + consumed, con->read_buf.len - consumed);
+            con->read_buf.len -= consumed;
+        }
         ustream_consume(s, len);
 
-    } while (1);
+        // a reply to this peer failed, it is closed after its messages are handled
+        if (con->closing) {
+            tcp_con_free(con);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void tcp_read_cb(struct ustream *s, int bytes) {
+    struct network_con_s *con = container_of(s,
+    struct network_con_s, stream.stream);
+
+    // relayed messages must not be sent back to where they came from
+    tcp_rx_con = con;
+    tcp_read_stream(con, s);
+    tcp_rx_con = NULL;
+}
+
+static void tcp_notify_write(struct ustream *s, int bytes) {
+    struct network_con_s *con = container_of(s,
+    struct network_con_s, stream.stream);
+
+    con->last_write = time(0);
+
+    // the peer accepted data, continue with the queue
+    if (!list_empty(&con->send_queue)) {
+        uloop_timeout_set(&tcp_flush_timer, 0);
+    }
+}
+
+static void tcp_notify_state(struct ustream *s) {
+    struct network_con_s *con = container_of(s,
+    struct network_con_s, stream.stream);
+
+    if (!s->eof)
+        return;
+
+    fprintf(stderr, "eof!, pending: %d\n", s->w.data_bytes);
+
+    if (!s->w.data_bytes) {
+        fprintf(stderr, "Connection closed\n");
+        tcp_con_free(con);
+    }
+}
+
+static void tcp_set_keepalive(int fd) {
+    int on = 1;
+    int idle = TCP_KEEPALIVE_IDLE;
+    int interval = TCP_KEEPALIVE_INTERVAL;
+    int count = TCP_KEEPALIVE_COUNT;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) ||
+        setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count))) {
+        perror("setsockopt keepalive");
+    }
+
+#ifdef TCP_USER_TIMEOUT
+    // unacknowledged data (and the connect) fails after this, not after the kernel default of minutes
+    unsigned int user_timeout = TCP_USER_TIMEOUT_MS;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, sizeof(user_timeout))) {
+        perror("setsockopt user timeout");
+    }
+#endif
+}
+
+static struct tcp_peer_s *tcp_peer_find(struct sockaddr_in addr) {
+    for (int i = 0; i < tcp_num_peers; i++) {
+        if (tcp_peers[i].addr.sin_addr.s_addr == addr.sin_addr.s_addr &&
+            tcp_peers[i].addr.sin_port == addr.sin_port) {
+            return &tcp_peers[i];
+        }
+    }
+    return NULL;
+}
+
+static void tcp_peer_set_state(struct tcp_peer_s *peer, enum tcp_peer_state state) {
+    if (peer->state == state) {
+        return;
+    }
+
+    printf("TCP peer %s:%d: %s -> %s\n", inet_ntoa(peer->addr.sin_addr), ntohs(peer->addr.sin_port),
+           tcp_peer_state_names[peer->state], tcp_peer_state_names[state]);
+    peer->state = state;
+    peer->state_time = time(0);
+    peer->transitions++;
+}
+
+// jittered, so peers that lost each other don't reconnect in lockstep
+static int tcp_backoff(int failures) {
+    int delay = TCP_BACKOFF_MIN;
+
+    for (int i = 0; i < failures && delay < TCP_BACKOFF_MAX; i++) {
+        delay *= 2;
+    }
+    if (delay > TCP_BACKOFF_MAX) {
+        delay = TCP_BACKOFF_MAX;
+    }
+    return delay / 2 + random() % (delay - delay / 2 + 1);
+}
+
+static void tcp_peer_con_closed(struct network_con_s *con) {
+    struct tcp_peer_s *peer = tcp_peer_find(con->sock_addr);
+
+    if (peer == NULL || peer->con_id != con->id) {
+        return;
+    }
 
-    if (s->w.data_bytes > 256 && !ustream_read_blocked(s)) {
-        fprintf(stderr, "Block read, bytes: %d\n", s->w.data_bytes);
-        ustream_set_read_blocked(s, true);
+    // a connection that was up is retried soon, failed attempts back off
+    if (peer->state == TCP_PEER_CONNECTED) {
+        peer->failures = 0;
+    } else {
+        peer->failures++;
     }
+    peer->con_id = 0;
+    peer->next_attempt = time(0) + tcp_backoff(peer->failures);
+    tcp_peer_set_state(peer, TCP_PEER_BACKOFF);
+}
+
+static void tcp_con_init_stream(struct network_con_s *con, int fd) {
+    con->stream.stream.string_data = 1;
+    con->stream.stream.notify_read = tcp_read_cb;
+    con->stream.stream.notify_state = tcp_notify_state;
+    con->stream.stream.notify_write = tcp_notify_write;
+    ustream_fd_init(&con->stream, fd);
+    con->connected = 1;
 }
 
 static void server_cb(struct uloop_fd *fd, unsigned int events) {
-    struct client *cl;
+    struct network_con_s *con;
     unsigned int sl = sizeof(struct sockaddr_in);
     int sfd;
 
-    if (!next_client)
-        next_client = calloc(1, sizeof(*next_client));
+    con = tcp_con_alloc();
+    if (con == NULL) {
+        fprintf(stderr, "Failed to allocate connection\n");
+        return;
+    }
 
-    cl = next_client;
-    sfd = accept(server.fd, (struct sockaddr *) &cl->sin, &sl);
+    sfd = accept(server.fd, (struct sockaddr *) &con->sock_addr, &sl);
     if (sfd < 0) {
         fprintf(stderr, "Accept failed\n");
+        free(con);
         return;
     }
 
-    cl->s.stream.string_data = 1;
-    cl->s.stream.notify_read = client_read_cb;
-    cl->s.stream.notify_state = client_notify_state;
-    cl->s.stream.notify_write = client_notify_write;
-    ustream_fd_init(&cl->s, sfd);
-    next_client = NULL;
+    con->inbound = 1;
+    list_add(&con->list, &tcp_client_list);
+    tcp_set_keepalive(sfd);
+    tcp_con_init_stream(con, sfd);
     fprintf(stderr, "New connection\n");
 }
 
@@ -151,15 +485,6 @@ int run_server(int port) {
     return 0;
 }
 
-static void client_not_be_used_read_cb(struct ustream *s, int bytes) {
-    int len;
-    char buf[2048];
-
-    len = ustream_read(s, buf, sizeof(buf));
-    buf[len] = '\0';
-    printf("Read %d bytes from SSL connection: %s\n", len, buf);
-}
-
 static void connect_cb(struct uloop_fd *f, unsigned int events) {
 
     struct network_con_s *entry = container_of(f,
@@ -167,123 +492,407 @@ static void connect_cb(struct uloop_fd *f, unsigned int events) {
 
     if (f->eof || f->error) {
         fprintf(stderr, "Connection failed\n");
-        close(entry->fd.fd);
-        list_del(&entry->list);
-        free(entry);
+        tcp_con_free(entry);
         return;
     }
 
     fprintf(stderr, "Connection established\n");
     uloop_fd_delete(&entry->fd);
+    entry->last_write = time(0);
 
-    entry->stream.stream.notify_read = client_not_be_used_read_cb;
-    entry->stream.stream.notify_state = client_to_server_state;
+    tcp_con_init_stream(entry, entry->fd.fd);
 
-    ustream_fd_init(&entry->stream, entry->fd.fd);
-    entry->connected = 1;
-}
+    struct tcp_peer_s *peer = tcp_peer_find(entry->sock_addr);
+    if (peer != NULL && peer->con_id == entry->id) {
+        peer->failures = 0;
+        tcp_peer_set_state(peer, TCP_PEER_CONNECTED);
+    }
 
-int add_tcp_conncection(char *ipv4, int port) {
-    struct sockaddr_in serv_addr;
+    handle_tcp_connected(entry->id);
+}
 
+static int tcp_peer_connect(struct tcp_peer_s *peer) {
     char port_str[12];
-    sprintf(port_str, "%d", port);
+    char ipv4[INET_ADDRSTRLEN];
 
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = inet_addr(ipv4);
-    serv_addr.sin_port = htons(port);
+    sprintf(port_str, "%d", ntohs(peer->addr.sin_port));
+    inet_ntop(AF_INET, &peer->addr.sin_addr, ipv4, sizeof(ipv4));
 
-    struct network_con_s *tmp = tcp_list_contains_address(serv_addr);
-    if (tmp != NULL) {
-        if(tmp->connected == true)
-        {
-            return 0;
-        } else{
-            // Delete already existing entry
-            close(tmp->fd.fd);
-            list_del(&tmp->list);
-            free(tmp);
-        }
+    struct network_con_s *tcp_entry = tcp_con_alloc();
+    if (tcp_entry == NULL) {
+        return -1;
     }
-
-    struct network_con_s *tcp_entry = calloc(1, sizeof(struct network_con_s));
     tcp_entry->fd.fd = usock(USOCK_TCP | USOCK_NONBLOCK, ipv4, port_str);
-    tcp_entry->sock_addr = serv_addr;
+    tcp_entry->sock_addr = peer->addr;
 
     if (tcp_entry->fd.fd < 0) {
         free(tcp_entry);
+        peer->failures++;
+        peer->next_attempt = time(0) + tcp_backoff(peer->failures);
+        tcp_peer_set_state(peer, TCP_PEER_BACKOFF);
         return -1;
     }
+    tcp_set_keepalive(tcp_entry->fd.fd);
     tcp_entry->fd.cb = connect_cb;
     uloop_fd_add(&tcp_entry->fd, ULOOP_WRITE | ULOOP_EDGE_TRIGGER);
 
-    printf("New TCP connection to %s:%d\n", ipv4, port);
+    printf("New TCP connection to %s:%s\n", ipv4, port_str);
     list_add(&tcp_entry->list, &tcp_sock_list);
 
+    peer->con_id = tcp_entry->id;
+    tcp_peer_set_state(peer, TCP_PEER_CONNECTING);
     return 0;
 }
 
-void send_tcp(char *msg) {
-    print_tcp_array();
-    if (network_config.use_symm_enc) {
-        int length_enc;
-        size_t msglen = strlen(msg);
-        char *enc = gcrypt_encrypt_msg(msg, msglen + 1, &length_enc);
-
-        char *base64_enc_str = malloc(B64_ENCODE_LEN(length_enc));
-        size_t base64_enc_length = b64_encode(enc, length_enc, base64_enc_str, B64_ENCODE_LEN(length_enc));
-        struct network_con_s *con;
-        list_for_each_entry(con, &tcp_sock_list, list)
-        {
-            if (con->connected) {
-                int len_ustream = ustream_write(&con->stream.stream, base64_enc_str, base64_enc_length, 0);
-                printf("Ustream send: %d\n", len_ustream);
-                if (len_ustream <= 0) {
-                    fprintf(stderr,"Ustream error!\n");
-                    //TODO: ERROR HANDLING!
-                }
+static void tcp_manager_cb(struct uloop_timeout *t) {
+    time_t now = time(0);
+    int active = tcp_outgoing_count();
+    // random start, so in gossip mode the connected subset of the peers varies
+    int start = tcp_num_peers ? random() % tcp_num_peers : 0;
+
+    for (int k = 0; k < tcp_num_peers; k++) {
+        struct tcp_peer_s *peer = &tcp_peers[(start + k) % tcp_num_peers];
+
+        if (peer->state == TCP_PEER_CONNECTING && now - peer->state_time > TCP_CONNECT_TIMEOUT) {
+            struct network_con_s *con = tcp_find_con(peer->con_id);
+
+            fprintf(stderr, "Connection to %s timed out\n", inet_ntoa(peer->addr.sin_addr));
+            if (con != NULL) {
+                tcp_con_free(con);
+                active--;
+            } else {
+                peer->con_id = 0;
+                peer->failures++;
+                peer->next_attempt = now + tcp_backoff(peer->failures);
+                tcp_peer_set_state(peer, TCP_PEER_BACKOFF);
             }
+        }
 
+        if ((peer->state != TCP_PEER_IDLE && peer->state != TCP_PEER_BACKOFF) || now < peer->next_attempt) {
+            continue;
         }
 
-        free(base64_enc_str);
-        free(enc);
-    } else {
-        struct network_con_s *con;
+        // in gossip mode only a few random peers are connected, the rest is reached via relays
+        if (network_config.gossip_fanout > 0 && active >= network_config.gossip_peers) {
+            continue;
+        }
 
-        list_for_each_entry(con, &tcp_sock_list, list)
-        {
-            if (con->connected) {
-                if (ustream_printf(&con->stream.stream, "%s", msg) == 0) {
-                    //TODO: ERROR HANDLING!
-                    fprintf(stderr,"Ustream error!\n");
-                }
+        if (tcp_peer_connect(peer) == 0) {
+            active++;
+        }
+    }
+
+    // forget peers that disappeared from the discovery
+    int j = 0;
+    for (int i = 0; i < tcp_num_peers; i++) {
+        if (tcp_peers[i].con_id == 0 &&
+            now - tcp_peers[i].last_discovered > TCP_PEER_FORGET_PERIODS * timeout_config.update_tcp_con) {
+            printf("Forgetting TCP peer %s\n", inet_ntoa(tcp_peers[i].addr.sin_addr));
+            continue;
+        }
+        tcp_peers[j++] = tcp_peers[i];
+    }
+    tcp_num_peers = j;
+
+    if (tcp_num_peers > 0) {
+        uloop_timeout_set(&tcp_manager_timer, 1000);
+    }
+}
+
+int add_tcp_conncection(char *ipv4, int port) {
+    struct sockaddr_in serv_addr;
+
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = inet_addr(ipv4);
+    serv_addr.sin_port = htons(port);
+
+    struct tcp_peer_s *peer = tcp_peer_find(serv_addr);
+    if (peer == NULL) {
+        if (tcp_num_peers >= ARRAY_NETWORK_LEN) {
+            fprintf(stderr, "Too many TCP peers!\n");
+            return -1;
+        }
+        peer = &tcp_peers[tcp_num_peers++];
+        memset(peer, 0, sizeof(struct tcp_peer_s));
+        peer->addr = serv_addr;
+        peer->state = TCP_PEER_IDLE;
+        peer->state_time = time(0);
+        printf("Discovered TCP peer %s:%d\n", ipv4, port);
+    }
+    peer->last_discovered = time(0);
+
+    // the manager connects, its timer runs as long as there are peers
+    if (!tcp_manager_timer.pending) {
+        uloop_timeout_set(&tcp_manager_timer, 0);
+    }
+    return 0;
+}
+
+static void tcp_flush_list(struct list_head *head) {
+    struct network_con_s *con, *tmp;
+
+    list_for_each_entry_safe(con, tmp, head, list)
+    {
+        if (tcp_con_flush(con)) {
+            fprintf(stderr, "Peer is not reading, closing connection!\n");
+            tcp_con_free(con);
+        }
+    }
+}
+
+static void tcp_flush_cb(struct uloop_timeout *t) {
+    tcp_flush_list(&tcp_sock_list);
+    tcp_flush_list(&tcp_client_list);
+}
+
+// number of connections in both directions, a controller has one per agent
+static int tcp_count_cons() {
+    struct network_con_s *con;
+    int n = 0;
+
+    list_for_each_entry(con, &tcp_sock_list, list)
+    {
+        n++;
+    }
+    list_for_each_entry(con, &tcp_client_list, list)
+    {
+        n++;
+    }
+    return n;
+}
+
+static int tcp_collect_peers(struct list_head *head, struct network_con_s **peers, int n) {
+    struct network_con_s *con;
+
+    list_for_each_entry(con, head, list)
+    {
+        if (con->connected && con != tcp_rx_con) {
+            peers[n++] = con;
+        }
+    }
+    return n;
+}
+
+// returns the connections a message is sent to, peers has room for all connections
+static int tcp_select_peers(struct network_con_s **peers, const char *ssid) {
+    int n = tcp_collect_peers(&tcp_sock_list, peers, 0);
+
+    // the agents connect to the controller
+    if (network_config.role == DAWN_ROLE_CONTROLLER) {
+        return tcp_collect_peers(&tcp_client_list, peers, n);
+    }
+
+    // full mesh: skip peers that don't serve the ssid of the message
+    if (network_config.gossip_fanout <= 0) {
+        int num_interested = 0;
+        for (int i = 0; i < n; i++) {
+            if (peer_is_interested(peer_find_addr(peers[i]->sock_addr.sin_addr, ntohs(peers[i]->sock_addr.sin_port)),
+                                   ssid)) {
+                peers[num_interested++] = peers[i];
             }
         }
+        return num_interested;
+    }
+
+    // gossip: both directions of the overlay are used, pick fanout random peers
+    n = tcp_collect_peers(&tcp_client_list, peers, n);
+    int fanout = network_config.gossip_fanout < n ? network_config.gossip_fanout : n;
+    for (int i = 0; i < fanout; i++) {
+        int j = i + random() % (n - i);
+        struct network_con_s *tmp = peers[i];
+        peers[i] = peers[j];
+        peers[j] = tmp;
     }
+    return fanout;
 }
 
-struct network_con_s* tcp_list_contains_address(struct sockaddr_in entry) {
+static struct network_con_s *tcp_find_con(uint32_t id) {
     struct network_con_s *con;
 
+    list_for_each_entry(con, &tcp_client_list, list)
+    {
+        if (con->id == id) {
+            return con;
+        }
+    }
     list_for_each_entry(con, &tcp_sock_list, list)
     {
-        if(entry.sin_addr.s_addr == con->sock_addr.sin_addr.s_addr)
-        {
+        if (con->id == id) {
             return con;
         }
     }
     return NULL;
 }
 
+static void tcp_send_to_peers(struct network_con_s **peers, int n, char *msg, enum tcp_prio prio, const char *key) {
+    char *payload = msg;
+    int payload_len = strlen(msg);
+
+    if (network_config.use_symm_enc) {
+        payload = gcrypt_encrypt_msg(msg, payload_len, &payload_len);
+        if (payload == NULL) {
+            fprintf(stderr, "Could not encrypt message!\n");
+            return;
+        }
+    }
+
+    if (payload_len > TCP_MAX_FRAME_LEN) {
+        fprintf(stderr, "Message too long for tcp frame: %d\n", payload_len);
+        return;
+    }
+
+    uint32_t header = htonl(payload_len);
+
+    for (int i = 0; i < n; i++) {
+        if (tcp_con_enqueue(peers[i], header, payload, payload_len, prio, key)) {
+            fprintf(stderr, "Send queue of peer is full, closing connection!\n");
+            if (peers[i] == tcp_rx_con) {
+                peers[i]->closing = 1;
+            } else {
+                tcp_con_free(peers[i]);
+            }
+        }
+    }
+
+    uloop_timeout_set(&tcp_flush_timer, 0);
+}
+
+void send_tcp(char *msg, enum tcp_prio prio, const char *key, const char *ssid) {
+    // + 1, malloc(0) may return NULL
+    struct network_con_s **peers = malloc((tcp_count_cons() + 1) * sizeof(struct network_con_s *));
+
+    if (peers == NULL) {
+        fprintf(stderr, "Could not allocate the peer list!\n");
+        return;
+    }
+    tcp_send_to_peers(peers, tcp_select_peers(peers, ssid), msg, prio, key);
+    free(peers);
+}
+
+int send_tcp_to(uint32_t con_id, char *msg, enum tcp_prio prio, const char *key) {
+    struct network_con_s *con = tcp_find_con(con_id);
+
+    if (con == NULL || !con->connected) {
+        return -1;
+    }
+
+    tcp_send_to_peers(&con, 1, msg, prio, key);
+    return 0;
+}
+
+int tcp_con_queued_bytes(uint32_t con_id) {
+    struct network_con_s *con = tcp_find_con(con_id);
+
+    if (con == NULL || !con->connected) {
+        return -1;
+    }
+    return con->queued_bytes + ustream_pending_data(&con->stream.stream, true);
+}
+
+int tcp_queued_bytes_max() {
+    struct network_con_s *con;
+    int bytes = 0;
+
+    // the queues are limited per connection, one slow peer must count like many
+    list_for_each_entry(con, &tcp_sock_list, list)
+    {
+        if (con->connected && con->queued_bytes + ustream_pending_data(&con->stream.stream, true) > bytes) {
+            bytes = con->queued_bytes + ustream_pending_data(&con->stream.stream, true);
+        }
+    }
+    list_for_each_entry(con, &tcp_client_list, list)
+    {
+        if (con->connected && con->queued_bytes + ustream_pending_data(&con->stream.stream, true) > bytes) {
+            bytes = con->queued_bytes + ustream_pending_data(&con->stream.stream, true);
+        }
+    }
+    return bytes;
+}
+
+uint32_t tcp_rx_con_id() {
+    return tcp_rx_con ? tcp_rx_con->id : 0;
+}
+
+int tcp_rx_addr(struct in_addr *addr) {
+    if (tcp_rx_con == NULL) {
+        return -1;
+    }
+    *addr = tcp_rx_con->sock_addr.sin_addr;
+    return 0;
+}
+
+int tcp_outgoing_count() {
+    struct network_con_s *con;
+    int count = 0;
+
+    list_for_each_entry(con, &tcp_sock_list, list)
+    {
+        count++;
+    }
+    return count;
+}
+
+static void tcp_overview_con(struct blob_buf *b, struct network_con_s *con) {
+    blobmsg_add_u8(b, "connected", con->connected);
+    blobmsg_add_u8(b, "inbound", con->inbound);
+    blobmsg_add_u32(b, "queued_frames", con->queued_frames);
+    blobmsg_add_u32(b, "queued_bytes", con->queued_bytes);
+    blobmsg_add_u32(b, "stream_pending", con->connected ? ustream_pending_data(&con->stream.stream, true) : 0);
+    blobmsg_add_u32(b, "sent_frames", con->sent_frames);
+    blobmsg_add_u32(b, "dropped_frames", con->dropped_frames);
+    blobmsg_add_u32(b, "superseded_frames", con->superseded_frames);
+}
+
+int build_tcp_overview(struct blob_buf *b) {
+    struct network_con_s *con;
+    char addr_buf[INET_ADDRSTRLEN + 8];
+    void *con_list;
+    time_t now = time(0);
+
+    blob_buf_init(b, 0);
+
+    // outgoing connections with the state of the connection manager
+    for (int i = 0; i < tcp_num_peers; i++) {
+        struct tcp_peer_s *peer = &tcp_peers[i];
+
+        sprintf(addr_buf, "%s:%d", inet_ntoa(peer->addr.sin_addr), ntohs(peer->addr.sin_port));
+        con_list = blobmsg_open_table(b, addr_buf);
+        con = peer->con_id ? tcp_find_con(peer->con_id) : NULL;
+        if (con != NULL) {
+            tcp_overview_con(b, con);
+        } else {
+            blobmsg_add_u8(b, "connected", 0);
+            blobmsg_add_u8(b, "inbound", 0);
+        }
+        blobmsg_add_string(b, "state", tcp_peer_state_names[peer->state]);
+        blobmsg_add_u32(b, "state_time", now - peer->state_time);
+        blobmsg_add_u32(b, "failures", peer->failures);
+        blobmsg_add_u32(b, "transitions", peer->transitions);
+        if (peer->state == TCP_PEER_BACKOFF) {
+            blobmsg_add_u32(b, "next_attempt", peer->next_attempt > now ? peer->next_attempt - now : 0);
+        }
+        blobmsg_close_table(b, con_list);
+    }
+
+    list_for_each_entry(con, &tcp_client_list, list)
+    {
+        sprintf(addr_buf, "%s:%d", inet_ntoa(con->sock_addr.sin_addr), ntohs(con->sock_addr.sin_port));
+        con_list = blobmsg_open_table(b, addr_buf);
+        tcp_overview_con(b, con);
+        blobmsg_close_table(b, con_list);
+    }
+    return 0;
+}
+
 void print_tcp_array() {
     struct network_con_s *con;
 
     printf("--------Connections------\n");
     list_for_each_entry(con, &tcp_sock_list, list)
     {
-        printf("Conenctin to Port: %d, Connected: %s\n", con->sock_addr.sin_port, con->connected ? "True" : "False");
+        printf("Conenctin to Port: %d, Connected: %s, Queued: %d, Dropped: %d\n", con->sock_addr.sin_port,
+               con->connected ? "True" : "False", con->queued_frames, con->dropped_frames);
     }
     printf("------------------\n");
-}
\ No newline at end of file
+}
@@ -0,0 +1,97 @@
+#include <string.h>
+
+#include "controller.h"
+#include "utils.h"
+
+struct decision_entry_s {
+    uint8_t bssid_addr[ETH_ALEN];
+    uint8_t client_addr[ETH_ALEN];
+    uint8_t allow;
+    time_t time;
+};
+
+struct owner_entry_s {
+    uint8_t bssid_addr[ETH_ALEN];
+    uint32_t con_id;
+};
+
+static struct decision_entry_s decision_cache[DECISION_CACHE_LEN];
+
+// open addressing, agents are never removed, only their connection changes
+static struct owner_entry_s owner_table[CONTROLLER_OWNER_LEN];
+
+static uint32_t mac_hash(const uint8_t *addr) {
+    return hash_update(HASH_INIT, addr, ETH_ALEN);
+}
+
+static struct decision_entry_s *decision_cache_slot(const uint8_t *bssid_addr, const uint8_t *client_addr) {
+    return &decision_cache[(mac_hash(bssid_addr) ^ mac_hash(client_addr)) % DECISION_CACHE_LEN];
+}
+
+static int decision_entry_matches(struct decision_entry_s *entry, const uint8_t *bssid_addr,
+                                  const uint8_t *client_addr) {
+    return entry->time != 0 && time(0) - entry->time < DECISION_TIMEOUT &&
+           memcmp(entry->bssid_addr, bssid_addr, ETH_ALEN) == 0 &&
+           memcmp(entry->client_addr, client_addr, ETH_ALEN) == 0;
+}
+
+void decision_cache_set(const uint8_t *bssid_addr, const uint8_t *client_addr, uint8_t allow) {
+    struct decision_entry_s *entry = decision_cache_slot(bssid_addr, client_addr);
+
+    memcpy(entry->bssid_addr, bssid_addr, ETH_ALEN);
+    memcpy(entry->client_addr, client_addr, ETH_ALEN);
+    entry->allow = allow;
+    entry->time = time(0);
+}
+
+int decision_cache_get(const uint8_t *bssid_addr, const uint8_t *client_addr, uint8_t flag) {
+    struct decision_entry_s *entry = decision_cache_slot(bssid_addr, client_addr);
+
+    if (!decision_entry_matches(entry, bssid_addr, client_addr)) {
+        return -1;
+    }
+    return (entry->allow & flag) != 0;
+}
+
+int decision_cache_update(const uint8_t *bssid_addr, const uint8_t *client_addr, uint8_t allow) {
+    struct decision_entry_s *entry = decision_cache_slot(bssid_addr, client_addr);
+
+    // repeat unchanged decisions after half of the timeout, so the agent never forgets them
+    if (decision_entry_matches(entry, bssid_addr, client_addr) && entry->allow == allow &&
+        time(0) - entry->time < DECISION_TIMEOUT / 2) {
+        return 0;
+    }
+
+    decision_cache_set(bssid_addr, client_addr, allow);
+    return 1;
+}
+
+void controller_set_owner(const uint8_t *bssid_addr, uint32_t con_id) {
+    uint32_t idx = mac_hash(bssid_addr) % CONTROLLER_OWNER_LEN;
+
+    for (int i = 0; i < CONTROLLER_OWNER_LEN; i++) {
+        struct owner_entry_s *entry = &owner_table[(idx + i) % CONTROLLER_OWNER_LEN];
+
+        if (entry->con_id == 0 || memcmp(entry->bssid_addr, bssid_addr, ETH_ALEN) == 0) {
+            memcpy(entry->bssid_addr, bssid_addr, ETH_ALEN);
+            entry->con_id = con_id;
+            return;
+        }
+    }
+}
+
+uint32_t controller_get_owner(const uint8_t *bssid_addr) {
+    uint32_t idx = mac_hash(bssid_addr) % CONTROLLER_OWNER_LEN;
+
+    for (int i = 0; i < CONTROLLER_OWNER_LEN; i++) {
+        struct owner_entry_s *entry = &owner_table[(idx + i) % CONTROLLER_OWNER_LEN];
+
+        if (entry->con_id == 0) {
+            return 0;
+        }
+        if (memcmp(entry->bssid_addr, bssid_addr, ETH_ALEN) == 0) {
+            return entry->con_id;
+        }
+    }
+    return 0;
+}
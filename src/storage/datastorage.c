@@ -7,6 +7,9 @@
 #include "dawn_iwinfo.h"
 #include "utils.h"
 #include "ieee80211_utils.h"
+#include "lbplanner.h"
+#include "nrstore.h"
+#include "history.h"
 
 #define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
 
@@ -28,7 +31,7 @@ void remove_old_client_entries(time_t current_time, long long int threshold);
 
 int eval_probe_metric(struct probe_entry_s probe_entry);
 
-int kick_client(struct client_s client_entry, char* neighbor_report);
+int kick_client(struct client_s client_entry, char* neighbor_report, uint8_t *target_addr, int *score_gap);
 
 void ap_array_insert(ap entry);
 
@@ -104,7 +107,7 @@ void send_beacon_reports(uint8_t bssid[], int id) {
         if (!mac_is_equal(client_array[j].bssid_addr, bssid)) {
             break;
         }
-        ubus_send_beacon_report(client_array[j].client_addr, id);
+        beacon_req_enqueue(bssid, client_array[j].client_addr, id);
     }
     pthread_mutex_unlock(&client_array_mutex);
 }
@@ -227,7 +230,7 @@ int build_network_overview(struct blob_buf *b) {
 
             char *nr;
             nr = blobmsg_alloc_string_buffer(b, "neighbor_report", NEIGHBOR_REPORT_LEN);
-            sprintf(nr, "%s", ap_entry_i.neighbor_report);
+            nr_store_get_hex(ap_entry_i.bssid_addr, -1, nr, NEIGHBOR_REPORT_LEN);
             blobmsg_add_string_buffer(b);
 
             for (k = i; k <= client_entry_last; k++) {
@@ -269,36 +272,47 @@ int build_network_overview(struct blob_buf *b) {
     return 0;
 }
 
-int eval_probe_metric(struct probe_entry_s probe_entry) {
-
+int eval_probe_score(probe_entry *probe_entry, ap *ap_entry) {
     int score = 0;
 
-    ap ap_entry = ap_array_get_ap(probe_entry.bssid_addr);
-
-    // check if ap entry is available
-    if (mac_is_equal(ap_entry.bssid_addr, probe_entry.bssid_addr)) {
-        score += probe_entry.ht_capabilities && ap_entry.ht_support ? dawn_metric.ht_support : 0;
-        score += !probe_entry.ht_capabilities && !ap_entry.ht_support ? dawn_metric.no_ht_support : 0;
+    if (ap_entry != NULL) {
+        score += probe_entry->ht_capabilities && ap_entry->ht_support ? dawn_metric.ht_support : 0;
+        score += !probe_entry->ht_capabilities && !ap_entry->ht_support ? dawn_metric.no_ht_support : 0;
 
         // performance anomaly?
         if (network_config.bandwidth >= 1000 || network_config.bandwidth == -1) {
-            score += probe_entry.vht_capabilities && ap_entry.vht_support ? dawn_metric.vht_support : 0;
+            score += probe_entry->vht_capabilities && ap_entry->vht_support ? dawn_metric.vht_support : 0;
         }
 
-        score += !probe_entry.vht_capabilities && !ap_entry.vht_support ? dawn_metric.no_vht_support : 0;
-        score += ap_entry.channel_utilization <= dawn_metric.chan_util_val ? dawn_metric.chan_util : 0;
-        score += ap_entry.channel_utilization > dawn_metric.max_chan_util_val ? dawn_metric.max_chan_util : 0;
+        score += !probe_entry->vht_capabilities && !ap_entry->vht_support ? dawn_metric.no_vht_support : 0;
+        score += ap_entry->channel_utilization <= dawn_metric.chan_util_val ? dawn_metric.chan_util : 0;
+        score += ap_entry->channel_utilization > dawn_metric.max_chan_util_val ? dawn_metric.max_chan_util : 0;
 
-        score += ap_entry.ap_weight;
+        score += ap_entry->ap_weight;
     }
 
-    score += (probe_entry.freq > 5000) ? dawn_metric.freq : 0;
-    score += (probe_entry.signal >= dawn_metric.rssi_val) ? dawn_metric.rssi : 0;
-    score += (probe_entry.signal <= dawn_metric.low_rssi_val) ? dawn_metric.low_rssi : 0;
+    score += (probe_entry->freq > 5000) ? dawn_metric.freq : 0;
+    score += (probe_entry->signal >= dawn_metric.rssi_val) ? dawn_metric.rssi : 0;
+    score += (probe_entry->signal <= dawn_metric.low_rssi_val) ? dawn_metric.low_rssi : 0;
 
     if (score < 0)
         score = -2; // -1 already used...
 
+    return score;
+}
+
+int eval_probe_metric(struct probe_entry_s probe_entry) {
+    int score;
+
+    ap ap_entry = ap_array_get_ap(probe_entry.bssid_addr);
+
+    // check if ap entry is available
+    if (mac_is_equal(ap_entry.bssid_addr, probe_entry.bssid_addr)) {
+        score = eval_probe_score(&probe_entry, &ap_entry);
+    } else {
+        score = eval_probe_score(&probe_entry, NULL);
+    }
+
     printf("Score: %d of:\n", score);
     print_probe_entry(probe_entry);
 
@@ -349,7 +363,41 @@ int compare_station_count(uint8_t *bssid_addr_own, uint8_t *bssid_addr_to_compar
 }
 
 
+// the chosen ap first, then the next best ones, each with a bss transition candidate preference subelement
+static void build_neighbor_report_list(char *neighbor_report, uint8_t *target_addr, int *ranked, int num_ranked) {
+    int len = 0, preference = 255;
+
+    neighbor_report[0] = '\0';
+    for (int i = -1; i < num_ranked && preference > 255 - dawn_metric.bss_tm_candidates; i++) {
+        uint8_t *bssid_addr = i < 0 ? target_addr : probe_array[ranked[i]].bssid_addr;
+        int n;
+
+        if (i >= 0 && mac_is_equal(bssid_addr, target_addr)) {
+            continue;
+        }
+        if (len + 1 >= NEIGHBOR_REPORT_LIST_LEN) {
+            break;
+        }
+        if (len > 0) {
+            neighbor_report[len++] = ',';
+        }
+        n = nr_store_get_hex(bssid_addr, preference, neighbor_report + len, NEIGHBOR_REPORT_LIST_LEN - len);
+        if (n <= 0) {
+            // unknown neighbor report (or no room), drop the separator again
+            neighbor_report[len > 0 ? --len : 0] = '\0';
+            continue;
+        }
+        len += n;
+        preference--;
+    }
+}
+
 int better_ap_available(uint8_t bssid_addr[], uint8_t client_addr[], char* neighbor_report, int automatic_kick) {
+    return better_ap_target(bssid_addr, client_addr, neighbor_report, automatic_kick, NULL, NULL);
+}
+
+int better_ap_target(uint8_t bssid_addr[], uint8_t client_addr[], char *neighbor_report, int automatic_kick,
+                     uint8_t *target_addr, int *score_gap) {
     int own_score = -1;
 
     // find first client entry in probe array
@@ -384,6 +432,12 @@ int better_ap_available(uint8_t bssid_addr[], uint8_t client_addr[], char* neigh
     int k;
     int max_score = 0;
     int kick = 0;
+    uint8_t chosen_addr[ETH_ALEN] = {0};
+    // probes of the aps that are better than the own one, best first
+    int ranked[BSS_TM_MAX_CANDIDATES];
+    int ranked_score[BSS_TM_MAX_CANDIDATES];
+    int num_ranked = 0;
+
     for (k = i; k <= probe_entry_last; k++) {
         int score_to_compare;
 
@@ -405,6 +459,28 @@ int better_ap_available(uint8_t bssid_addr[], uint8_t client_addr[], char* neigh
         printf("Calculating score to compare!\n");
         score_to_compare = eval_probe_metric(probe_array[k]);
 
+        if (score_to_compare > own_score) {
+            int r = num_ranked;
+
+            // list is full, the new one has to beat the last one
+            if (r == dawn_metric.bss_tm_candidates) {
+                r--;
+                if (ranked_score[r] >= score_to_compare) {
+                    r = -1;
+                }
+            } else {
+                num_ranked++;
+            }
+            for (; r > 0 && ranked_score[r - 1] < score_to_compare; r--) {
+                ranked[r] = ranked[r - 1];
+                ranked_score[r] = ranked_score[r - 1];
+            }
+            if (r >= 0) {
+                ranked[r] = k;
+                ranked_score[r] = score_to_compare;
+            }
+        }
+
         // instead of returning we append a neighbor report list...
         if (own_score < score_to_compare && score_to_compare > max_score) {
             if(neighbor_report == NULL)
@@ -420,9 +496,16 @@ int better_ap_available(uint8_t bssid_addr[], uint8_t client_addr[], char* neigh
                 continue;
             }
 
-            strcpy(neighbor_report,destap.neighbor_report);
+            nr_store_get_hex(destap.bssid_addr, -1, neighbor_report, NEIGHBOR_REPORT_LEN);
+            memcpy(chosen_addr, destap.bssid_addr, ETH_ALEN);
 
             max_score = score_to_compare;
+            if (target_addr != NULL) {
+                memcpy(target_addr, destap.bssid_addr, ETH_ALEN);
+            }
+            if (score_gap != NULL) {
+                *score_gap = score_to_compare - own_score;
+            }
 
             //return 1;
         }
@@ -448,127 +531,589 @@ int better_ap_available(uint8_t bssid_addr[], uint8_t client_addr[], char* neigh
                         continue;
                     }
 
-                    strcpy(neighbor_report,destap.neighbor_report);
+                    nr_store_get_hex(destap.bssid_addr, -1, neighbor_report, NEIGHBOR_REPORT_LEN);
+                    memcpy(chosen_addr, destap.bssid_addr, ETH_ALEN);
+                    if (target_addr != NULL) {
+                        memcpy(target_addr, destap.bssid_addr, ETH_ALEN);
+                    }
+                    if (score_gap != NULL) {
+                        *score_gap = 0;
+                    }
                     }
                 }
             }
         }
+
+    // give the client alternatives, so it doesn't fall back to a full scan if it can't reach the chosen ap
+    if (kick == 1 && neighbor_report != NULL && dawn_metric.bss_tm_candidates > 1) {
+        build_neighbor_report_list(neighbor_report, chosen_addr, ranked, num_ranked);
+    }
     return kick;
 }
 
-int kick_client(struct client_s client_entry, char* neighbor_report) {
+int kick_client(struct client_s client_entry, char* neighbor_report, uint8_t *target_addr, int *score_gap) {
     return !mac_in_maclist(client_entry.client_addr) &&
-           better_ap_available(client_entry.bssid_addr, client_entry.client_addr, neighbor_report, 1);
+           better_ap_target(client_entry.bssid_addr, client_entry.client_addr, neighbor_report, 1,
+                            target_addr, score_gap);
 }
 
-void kick_clients(uint8_t bssid[], uint32_t id) {
-    pthread_mutex_lock(&client_array_mutex);
-    pthread_mutex_lock(&probe_array_mutex);
-    printf("-------- KICKING CLIENTS!!!---------\n");
-    char mac_buf_ap[20];
-    sprintf(mac_buf_ap, MACSTR, MAC2STR(bssid));
-    printf("EVAL %s\n", mac_buf_ap);
+struct kick_job_s {
+    uint8_t bssid_addr[ETH_ALEN];
+    uint32_t id;
+    // last evaluated client, the client array is sorted by client within a bssid
+    uint8_t cursor[ETH_ALEN];
+    int started;
+};
 
-    // Seach for BSSID
+static struct kick_job_s kick_jobs[KICK_MAX_JOBS];
+static int kick_job_last = -1;
+static int kick_job_next = 0;
+
+static void kick_jobs_cb(struct uloop_timeout *t);
+
+static void kick_evaluate_client(int j, uint8_t bssid[], uint32_t id);
+
+// replaced by the tests
+static void (*kick_evaluate)(int j, uint8_t bssid[], uint32_t id) = kick_evaluate_client;
+
+static struct uloop_timeout kick_job_timeout = {
+        .cb = kick_jobs_cb
+};
+
+// clients that should be kicked, sorted by score gap (biggest first)
+struct kick_candidate_s {
+    uint8_t bssid_addr[ETH_ALEN];
+    uint8_t client_addr[ETH_ALEN];
+    uint8_t target_addr[ETH_ALEN];
+    uint32_t id;
+    int score_gap;
+    time_t time;
+    // from the load balancing planner, the rx rate is checked when it is kicked
+    int planned;
+    char neighbor_report[NEIGHBOR_REPORT_LIST_LEN];
+};
+
+static struct kick_candidate_s kick_candidates[KICK_MAX_CANDIDATES];
+static int kick_candidate_last = -1;
+
+static time_t kick_hist[KICK_HIST_LEN];
+static uint32_t kick_total;
+static uint32_t kick_expired;
+static uint32_t kick_capped;
+static uint32_t kick_failed;
+
+static void kick_plan_cb(struct uloop_timeout *t);
+
+static struct uloop_timeout kick_plan_timeout = {
+        .cb = kick_plan_cb
+};
+
+// roaming history of a client, survives the refreshes of the client table
+struct roam_state_s {
+    uint8_t client_addr[ETH_ALEN];
+    // ap the client is on and the one it was on before
+    uint8_t bssid_addr[ETH_ALEN];
+    uint8_t prev_bssid_addr[ETH_ALEN];
+    time_t last_roam;
+    time_t last_kick;
+    uint8_t kick_target_addr[ETH_ALEN];
+    time_t last_seen;
+};
+
+// sorted by client address
+static struct roam_state_s roam_states[ROAM_TABLE_LEN];
+static int roam_state_last = -1;
+
+static uint32_t roam_count;
+static uint32_t roam_pingpong;
+static uint32_t roam_cooldown_avoided;
+static uint32_t roam_pingpong_avoided;
+
+// has to be called with client_array_mutex locked (like all roam_state functions)
+static struct roam_state_s *roam_state_get(uint8_t *client_addr, int create) {
+    int low = 0, high = roam_state_last;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = memcmp(roam_states[mid].client_addr, client_addr, ETH_ALEN);
+
+        if (cmp == 0) {
+            return &roam_states[mid];
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    // table is full, forget the client that was not seen for the longest time
+    if (roam_state_last == ROAM_TABLE_LEN - 1) {
+        int oldest = 0;
+        for (int i = 1; i <= roam_state_last; i++) {
+            if (roam_states[i].last_seen < roam_states[oldest].last_seen) {
+                oldest = i;
+            }
+        }
+        for (int i = oldest; i < roam_state_last; i++) {
+            roam_states[i] = roam_states[i + 1];
+        }
+        roam_state_last--;
+        if (oldest < low) {
+            low--;
+        }
+    }
+
+    for (int i = roam_state_last; i >= low; i--) {
+        roam_states[i + 1] = roam_states[i];
+    }
+    roam_state_last++;
+    memset(&roam_states[low], 0, sizeof(struct roam_state_s));
+    memcpy(roam_states[low].client_addr, client_addr, ETH_ALEN);
+    return &roam_states[low];
+}
+
+// while the old ap still lists the client its updates and the ones of the new ap come in turns,
+// only a new association is a roam
+static void roam_state_seen(uint8_t *client_addr, uint8_t *bssid_addr, int associated) {
+    struct roam_state_s *state = roam_state_get(client_addr, 1);
+    time_t now = time(0);
+
+    if (state->last_seen == 0) {
+        memcpy(state->bssid_addr, bssid_addr, ETH_ALEN);
+    } else if (associated && !mac_is_equal(state->bssid_addr, bssid_addr)) {
+        // back on the ap it just left
+        if (mac_is_equal(state->prev_bssid_addr, bssid_addr) && now - state->last_roam < dawn_metric.roam_cooldown) {
+            roam_pingpong++;
+        }
+        memcpy(state->prev_bssid_addr, state->bssid_addr, ETH_ALEN);
+        memcpy(state->bssid_addr, bssid_addr, ETH_ALEN);
+        state->last_roam = now;
+        roam_count++;
+    }
+    state->last_seen = now;
+}
+
+static int roam_kick_allowed(uint8_t *client_addr, uint8_t *target_addr, int score_gap) {
+    struct roam_state_s *state = roam_state_get(client_addr, 0);
+    time_t now = time(0);
+
+    if (state == NULL) {
+        return 1;
+    }
+
+    // a client that just moved (by itself or kicked) gets time to settle
+    if (now - state->last_roam < dawn_metric.roam_cooldown || now - state->last_kick < dawn_metric.roam_cooldown) {
+        roam_cooldown_avoided++;
+        return 0;
+    }
+
+    // sending it back where it came from needs a clearly better score
+    if (mac_is_equal(state->prev_bssid_addr, target_addr) && score_gap < dawn_metric.roam_hysteresis) {
+        roam_pingpong_avoided++;
+        return 0;
+    }
+    return 1;
+}
+
+static void roam_state_kicked(uint8_t *client_addr, uint8_t *target_addr) {
+    struct roam_state_s *state = roam_state_get(client_addr, 1);
+
+    state->last_kick = time(0);
+    memcpy(state->kick_target_addr, target_addr, ETH_ALEN);
+}
+
+static void kick_plan_remove(uint8_t client_addr[]) {
     int i;
-    for (i = 0; i <= client_entry_last; i++) {
-        if (mac_is_equal(client_array[i].bssid_addr, bssid)) {
+
+    for (i = 0; i <= kick_candidate_last; i++) {
+        if (mac_is_equal(kick_candidates[i].client_addr, client_addr)) {
             break;
         }
     }
+    if (i > kick_candidate_last) {
+        return;
+    }
+    for (; i < kick_candidate_last; i++) {
+        kick_candidates[i] = kick_candidates[i + 1];
+    }
+    kick_candidate_last--;
+}
 
-    // Go threw clients
-    int j;
-    for (j = i; j <= client_entry_last; j++) {
-        if (!mac_is_equal(client_array[j].bssid_addr, bssid)) {
+static void kick_plan_add(uint8_t *bssid_addr, uint8_t *client_addr, uint32_t id, uint8_t *target_addr,
+                          int score_gap, char *neighbor_report, int planned) {
+    int i;
+
+    kick_plan_remove(client_addr);
+
+    for (i = 0; i <= kick_candidate_last; i++) {
+        if (score_gap > kick_candidates[i].score_gap) {
             break;
         }
+    }
+
+    // backlog is full, the candidates with the smallest gain wait for the next evaluation
+    if (i >= KICK_MAX_CANDIDATES) {
+        return;
+    }
+    if (kick_candidate_last == KICK_MAX_CANDIDATES - 1) {
+        kick_candidate_last--;
+    }
+    for (int j = kick_candidate_last; j >= i; j--) {
+        kick_candidates[j + 1] = kick_candidates[j];
+    }
+    kick_candidate_last++;
 
-        // update rssi
-        int rssi = get_rssi_iwinfo(client_array[j].client_addr);
-        int exp_thr = get_expected_throughput_iwinfo(client_array[j].client_addr);
-        double exp_thr_tmp = iee80211_calculate_expected_throughput_mbit(exp_thr);
-        printf("Expected throughput %f Mbit/sec\n", exp_thr_tmp);
+    memcpy(kick_candidates[i].bssid_addr, bssid_addr, ETH_ALEN);
+    memcpy(kick_candidates[i].client_addr, client_addr, ETH_ALEN);
+    memcpy(kick_candidates[i].target_addr, target_addr, ETH_ALEN);
+    kick_candidates[i].id = id;
+    kick_candidates[i].score_gap = score_gap;
+    kick_candidates[i].time = time(0);
+    kick_candidates[i].planned = planned;
+    strcpy(kick_candidates[i].neighbor_report, neighbor_report);
+}
 
-        if (rssi != INT_MIN) {
-            pthread_mutex_unlock(&probe_array_mutex);
-            if (!probe_array_update_rssi(client_array[j].bssid_addr, client_array[j].client_addr, rssi, true)) {
-                printf("Failed to update rssi!\n");
-            } else {
-                printf("Updated rssi: %d\n", rssi);
-            }
-            pthread_mutex_lock(&probe_array_mutex);
+static void kick_plan_move(struct lb_move_s *move) {
+    uint32_t id = 0;
+
+    // the controller kicks via the agents, the other nodes only the clients of their own aps
+    if (network_config.role != DAWN_ROLE_CONTROLLER && ubus_get_hostapd_id(move->bssid_addr, &id)) {
+        return;
+    }
+    kick_plan_add(move->bssid_addr, move->client_addr, id, move->target_addr, move->gain, move->neighbor_report, 1);
+}
+
+static void kick_plan_cb(struct uloop_timeout *t) {
+    uint8_t targets[KICK_MAX_CANDIDATES][ETH_ALEN];
+    int target_kicks[KICK_MAX_CANDIDATES];
+    int num_targets = 0;
+    int kicked = 0;
+    int budget = dawn_metric.kick_budget > 0 ? dawn_metric.kick_budget : 1;
+    time_t now = time(0);
+    int j = 0;
+
+    pthread_mutex_lock(&client_array_mutex);
 
+    for (int i = 0; i <= kick_candidate_last; i++) {
+        struct kick_candidate_s *c = &kick_candidates[i];
+        int k;
+
+        // client roamed or left meanwhile, or the decision is too old
+        if (now - c->time > 2 * timeout_config.update_client || !is_connected(c->bssid_addr, c->client_addr)) {
+            kick_expired++;
+            continue;
         }
-        char neighbor_report[NEIGHBOR_REPORT_LEN] = "";
-        int do_kick = kick_client(client_array[j], neighbor_report);
-        printf("Chosen AP %s\n",neighbor_report);
 
-        // better ap available
-        if (do_kick > 0) {
+        // no ping pong between two aps with similar scores
+        if (!roam_kick_allowed(c->client_addr, c->target_addr, c->score_gap)) {
+            continue;
+        }
 
-            // kick after algorithm decided to kick several times
-            // + rssi is changing a lot
-            // + chan util is changing a lot
-            // + ping pong behavior of clients will be reduced
-            client_array[j].kick_count++;
-            printf("Comparing kick count! kickcount: %d to min_kick_count: %d!\n", client_array[j].kick_count,
-                   dawn_metric.min_kick_count);
-            if (client_array[j].kick_count < dawn_metric.min_kick_count) {
-                continue;
+        for (k = 0; k < num_targets; k++) {
+            if (mac_is_equal(targets[k], c->target_addr)) {
+                break;
             }
+        }
+        if (k == num_targets) {
+            memcpy(targets[k], c->target_addr, ETH_ALEN);
+            target_kicks[k] = 0;
+            num_targets++;
+        }
 
-            printf("Better AP available. Kicking client:\n");
-            print_client_entry(client_array[j]);
-            printf("Check if client is active receiving!\n");
-
-            float rx_rate, tx_rate;
-            if (get_bandwidth_iwinfo(client_array[j].client_addr, &rx_rate, &tx_rate)) {
-                // only use rx_rate for indicating if transmission is going on
-                // <= 6MBits <- probably no transmission
-                // tx_rate has always some weird value so don't use ist
-                if (rx_rate > dawn_metric.bandwidth_threshold) {
-                    printf("Client is probably in active transmisison. Don't kick! RxRate is: %f\n", rx_rate);
-                    continue;
-                }
+        // spread the kicks, so the clients don't all land on the same ap
+        if (kicked >= budget || (dawn_metric.kick_per_target > 0 && target_kicks[k] >= dawn_metric.kick_per_target)) {
+            if (kicked < budget) {
+                kick_capped++;
             }
-            printf("Client is probably NOT in active transmisison. KICK! RxRate is: %f\n", rx_rate);
+            kick_candidates[j++] = *c;
+            continue;
+        }
 
+        float rx_rate, tx_rate;
+        if (c->planned && network_config.role != DAWN_ROLE_CONTROLLER &&
+            get_bandwidth_iwinfo(c->client_addr, &rx_rate, &tx_rate) && rx_rate > dawn_metric.bandwidth_threshold) {
+            printf("Client is probably in active transmisison. Don't kick! RxRate is: %f\n", rx_rate);
+            kick_candidates[j++] = *c;
+            continue;
+        }
 
-            // here we should send a messsage to set the probe.count for all aps to the min that there is no delay between switching
-            // the hearing map is full...
-            send_set_probe(client_array[j].client_addr);
+        printf("Kick planner: kicking client " MACSTR " (gap %d)\n", MAC2STR(c->client_addr), c->score_gap);
 
-            // don't deauth station? <- deauth is better!
-            // maybe we can use handovers...
-            //del_client_interface(id, client_array[j].client_addr, NO_MORE_STAS, 1, 1000);
-            wnm_disassoc_imminent(id, client_array[j].client_addr, neighbor_report, 12);
-            client_array_delete(client_array[j]);
+        // here we should send a messsage to set the probe.count for all aps to the min that there is no delay between switching
+        // the hearing map is full...
+        send_set_probe(c->client_addr, c->bssid_addr);
 
-            // don't delete clients in a row. use update function again...
-            // -> chan_util update, ...
-            add_client_update_timer(timeout_config.update_client * 1000 / 4);
-            break;
+        // don't deauth station? <- deauth is better!
+        // maybe we can use handovers...
+        //del_client_interface(id, client_array[j].client_addr, NO_MORE_STAS, 1, 1000);
+        int ret;
+        if (network_config.role == DAWN_ROLE_CONTROLLER) {
+            // the agent checks the rx rate itself
+            ret = send_kick_via_network(c->bssid_addr, c->client_addr, c->neighbor_report, 0);
+        } else {
+            ret = wnm_disassoc_imminent(c->id, c->client_addr, c->neighbor_report, 12);
+        }
+        if (ret < 0) {
+            kick_failed++;
+            kick_candidates[j++] = *c;
+            continue;
+        }
 
-            // no entry in probe array for own bssid
-        } else if (do_kick == -1) {
-            printf("No Information about client. Force reconnect:\n");
-            print_client_entry(client_array[j]);
-            del_client_interface(id, client_array[j].client_addr, 0, 1, 0);
+        client client_entry;
+        memcpy(client_entry.bssid_addr, c->bssid_addr, ETH_ALEN);
+        memcpy(client_entry.client_addr, c->client_addr, ETH_ALEN);
+        client_array_delete(client_entry);
+        roam_state_kicked(c->client_addr, c->target_addr);
+        history_add_kick(c->bssid_addr);
+
+        target_kicks[k]++;
+        kicked++;
+        kick_hist[kick_total % KICK_HIST_LEN] = now;
+        kick_total++;
+    }
+    kick_candidate_last = j - 1;
+
+    pthread_mutex_unlock(&client_array_mutex);
+
+    // don't delete clients in a row. use update function again...
+    // -> chan_util update, ...
+    if (kicked) {
+        add_client_update_timer(timeout_config.update_client * 1000 / 4);
+    }
 
-            // ap is best
+    // the backlog gets the next budget after a pause
+    if (kick_candidate_last >= 0) {
+        uloop_timeout_set(&kick_plan_timeout, timeout_config.update_client * 1000 / 4);
+    }
+}
+
+int build_kick_plan(struct blob_buf *b) {
+    void *list, *entry, *roaming;
+    time_t now = time(0);
+    uint32_t last_min = 0;
+
+    for (uint32_t i = 0; i < KICK_HIST_LEN && i < kick_total; i++) {
+        if (now - kick_hist[i] < 60) {
+            last_min++;
+        }
+    }
+
+    blob_buf_init(b, 0);
+    blobmsg_add_u32(b, "budget", dawn_metric.kick_budget);
+    blobmsg_add_u32(b, "per_target", dawn_metric.kick_per_target);
+    blobmsg_add_u32(b, "backlog", kick_candidate_last + 1);
+    blobmsg_add_u32(b, "kicks", kick_total);
+    blobmsg_add_u32(b, "kicks_last_min", last_min);
+    blobmsg_add_u32(b, "expired", kick_expired);
+    blobmsg_add_u32(b, "capped", kick_capped);
+    blobmsg_add_u32(b, "failed", kick_failed);
+
+    roaming = blobmsg_open_table(b, "roaming");
+    blobmsg_add_u32(b, "clients", roam_state_last + 1);
+    blobmsg_add_u32(b, "roams", roam_count);
+    blobmsg_add_u32(b, "pingpong", roam_pingpong);
+    blobmsg_add_u32(b, "cooldown_avoided", roam_cooldown_avoided);
+    blobmsg_add_u32(b, "pingpong_avoided", roam_pingpong_avoided);
+    blobmsg_close_table(b, roaming);
+
+    list = blobmsg_open_array(b, "candidates");
+    for (int i = 0; i <= kick_candidate_last; i++) {
+        entry = blobmsg_open_table(b, NULL);
+        blobmsg_add_macaddr(b, "client", kick_candidates[i].client_addr);
+        blobmsg_add_macaddr(b, "bssid", kick_candidates[i].bssid_addr);
+        blobmsg_add_macaddr(b, "target", kick_candidates[i].target_addr);
+        blobmsg_add_u32(b, "score_gap", kick_candidates[i].score_gap);
+        blobmsg_add_u32(b, "age", now - kick_candidates[i].time);
+        blobmsg_close_table(b, entry);
+    }
+    blobmsg_close_array(b, list);
+    return 0;
+}
+
+// has to be called with client_array_mutex and probe_array_mutex locked
+static void kick_evaluate_client(int j, uint8_t bssid[], uint32_t id) {
+    // update rssi
+    int rssi = get_rssi_iwinfo(client_array[j].client_addr);
+    int exp_thr = get_expected_throughput_iwinfo(client_array[j].client_addr);
+    double exp_thr_tmp = iee80211_calculate_expected_throughput_mbit(exp_thr);
+    printf("Expected throughput %f Mbit/sec\n", exp_thr_tmp);
+
+    if (rssi != INT_MIN) {
+        pthread_mutex_unlock(&probe_array_mutex);
+        if (!probe_array_update_rssi(client_array[j].bssid_addr, client_array[j].client_addr, rssi, true)) {
+            printf("Failed to update rssi!\n");
         } else {
-            printf("AP is best. Client will stay:\n");
-            print_client_entry(client_array[j]);
-            // set kick counter to 0 again
-            client_array[j].kick_count = 0;
+            printf("Updated rssi: %d\n", rssi);
+        }
+        pthread_mutex_lock(&probe_array_mutex);
+
+    }
+    char neighbor_report[NEIGHBOR_REPORT_LIST_LEN] = "";
+    uint8_t target_addr[ETH_ALEN] = {0};
+    int score_gap = 0;
+    int do_kick = kick_client(client_array[j], neighbor_report, target_addr, &score_gap);
+    printf("Chosen AP %s\n",neighbor_report);
+
+    // better ap available
+    if (do_kick > 0) {
+
+        // kick after algorithm decided to kick several times
+        // + rssi is changing a lot
+        // + chan util is changing a lot
+        // + ping pong behavior of clients will be reduced
+        client_array[j].kick_count++;
+        printf("Comparing kick count! kickcount: %d to min_kick_count: %d!\n", client_array[j].kick_count,
+               dawn_metric.min_kick_count);
+        if (client_array[j].kick_count < dawn_metric.min_kick_count) {
+            return;
+        }
+
+        printf("Better AP available. Kicking client:\n");
+        print_client_entry(client_array[j]);
+        printf("Check if client is active receiving!\n");
+
+        float rx_rate, tx_rate;
+        if (get_bandwidth_iwinfo(client_array[j].client_addr, &rx_rate, &tx_rate)) {
+            // only use rx_rate for indicating if transmission is going on
+            // <= 6MBits <- probably no transmission
+            // tx_rate has always some weird value so don't use ist
+            if (rx_rate > dawn_metric.bandwidth_threshold) {
+                printf("Client is probably in active transmisison. Don't kick! RxRate is: %f\n", rx_rate);
+                kick_plan_remove(client_array[j].client_addr);
+                return;
+            }
+        }
+        printf("Client is probably NOT in active transmisison. KICK! RxRate is: %f\n", rx_rate);
+
+        // the planner decides which of the candidates are kicked in this cycle
+        if (!dawn_metric.lb_planner) {
+            kick_plan_add(client_array[j].bssid_addr, client_array[j].client_addr, id, target_addr, score_gap,
+                          neighbor_report, 0);
+        }
+
+        // no entry in probe array for own bssid
+    } else if (do_kick == -1) {
+        printf("No Information about client. Force reconnect:\n");
+        print_client_entry(client_array[j]);
+        if (network_config.role == DAWN_ROLE_CONTROLLER) {
+            send_kick_via_network(bssid, client_array[j].client_addr, NULL, 1);
+        } else {
+            del_client_interface(id, client_array[j].client_addr, 0, 1, 0);
+        }
+        history_add_kick(bssid);
+
+        // ap is best
+    } else {
+        printf("AP is best. Client will stay:\n");
+        print_client_entry(client_array[j]);
+        // set kick counter to 0 again
+        client_array[j].kick_count = 0;
+        kick_plan_remove(client_array[j].client_addr);
+    }
+}
+
+// returns 1 if all clients of the bssid were evaluated
+static int kick_clients_step(struct kick_job_s *job) {
+    int i, n = 0;
+    int done = 1;
+
+    pthread_mutex_lock(&client_array_mutex);
+    pthread_mutex_lock(&probe_array_mutex);
+
+    // the table may have changed since the last slice, search the cursor again
+    for (i = 0; i <= client_entry_last; i++) {
+        if (mac_is_equal(client_array[i].bssid_addr, job->bssid_addr) &&
+            (!job->started || mac_is_greater(client_array[i].client_addr, job->cursor))) {
+            break;
         }
     }
 
-    printf("---------------------------\n");
+    for (; i <= client_entry_last && mac_is_equal(client_array[i].bssid_addr, job->bssid_addr); i++) {
+        if (n == KICK_SLICE_CLIENTS) {
+            done = 0;
+            break;
+        }
+        memcpy(job->cursor, client_array[i].client_addr, ETH_ALEN);
+        job->started = 1;
+        n++;
+
+        kick_evaluate(i, job->bssid_addr, job->id);
+    }
 
     pthread_mutex_unlock(&probe_array_mutex);
     pthread_mutex_unlock(&client_array_mutex);
+    return done;
+}
+
+static void kick_jobs_cb(struct uloop_timeout *t) {
+    if (kick_job_last < 0) {
+        return;
+    }
+
+    // round robin, so one big ap doesn't delay the others
+    if (kick_job_next > kick_job_last) {
+        kick_job_next = 0;
+    }
+
+    if (kick_clients_step(&kick_jobs[kick_job_next])) {
+        char mac_buf_ap[20];
+        sprintf(mac_buf_ap, MACSTR, MAC2STR(kick_jobs[kick_job_next].bssid_addr));
+        printf("Kick evaluation of %s done\n", mac_buf_ap);
+
+        kick_jobs[kick_job_next] = kick_jobs[kick_job_last];
+        kick_job_last--;
+    } else {
+        kick_job_next++;
+    }
+
+    // let uloop handle the pending events before the next slice
+    if (kick_job_last >= 0) {
+        uloop_timeout_set(&kick_job_timeout, 0);
+    } else {
+        // all aps evaluated, the load balancing planner assigns the clients of the whole site
+        if (dawn_metric.lb_planner) {
+            lb_plan(kick_plan_move);
+        }
+        // kick the best candidates (a waiting run keeps its pause)
+        if (kick_candidate_last >= 0 && !kick_plan_timeout.pending) {
+            uloop_timeout_set(&kick_plan_timeout, 0);
+        }
+    }
+}
+
+void kick_clients_set_evaluator(void (*evaluate)(int j, uint8_t bssid[], uint32_t id)) {
+    kick_evaluate = evaluate ? evaluate : kick_evaluate_client;
+}
+
+void kick_clients(uint8_t bssid[], uint32_t id) {
+    char mac_buf_ap[20];
+    sprintf(mac_buf_ap, MACSTR, MAC2STR(bssid));
+
+    for (int i = 0; i <= kick_job_last; i++) {
+        if (mac_is_equal(kick_jobs[i].bssid_addr, bssid)) {
+            kick_jobs[i].id = id;
+            return;
+        }
+    }
+
+    if (kick_job_last >= KICK_MAX_JOBS - 1) {
+        fprintf(stderr, "Too many kick jobs, skipping %s\n", mac_buf_ap);
+        return;
+    }
+
+    printf("-------- KICKING CLIENTS!!!---------\n");
+    printf("EVAL %s\n", mac_buf_ap);
+
+    kick_job_last++;
+    memset(&kick_jobs[kick_job_last], 0, sizeof(struct kick_job_s));
+    memcpy(kick_jobs[kick_job_last].bssid_addr, bssid, ETH_ALEN);
+    kick_jobs[kick_job_last].id = id;
+    uloop_timeout_set(&kick_job_timeout, 0);
 }
 
 int is_connected_somehwere(uint8_t client_addr[]) {
@@ -623,13 +1168,18 @@ int client_array_go_next_help(char sort_order[], int i, client entry,
     return 0;
 }
 
+// compare the first i keys in order, the first key that differs decides
 int client_array_go_next(char sort_order[], int i, client entry,
                          client next_entry) {
-    int conditions = 1;
     for (int j = 0; j < i; j++) {
-        i &= !(client_array_go_next(sort_order, j, entry, next_entry));
+        if (client_array_go_next_help(sort_order, j, entry, next_entry)) {
+            return 1;
+        }
+        if (client_array_go_next_help(sort_order, j, next_entry, entry)) {
+            return 0;
+        }
     }
-    return conditions && client_array_go_next_help(sort_order, i, entry, next_entry);
+    return 0;
 }
 
 void client_array_insert(client entry) {
@@ -661,7 +1211,7 @@ client client_array_delete(client entry) {
 
     int i;
     int found_in_array = 0;
-    client tmp;
+    client tmp = {.bssid_addr = {0, 0, 0, 0, 0, 0}};
 
     if (client_entry_last == -1) {
         return tmp;
@@ -856,11 +1406,15 @@ probe_entry insert_to_array(probe_entry entry, int inc_counter, int save_80211k,
 
     entry.time = time(0);
     entry.counter = 0;
+    entry.sent_time = 0;
     probe_entry tmp = probe_array_delete(entry);
 
     if (mac_is_equal(entry.bssid_addr, tmp.bssid_addr)
         && mac_is_equal(entry.client_addr, tmp.client_addr)) {
         entry.counter = tmp.counter;
+        entry.sent_time = tmp.sent_time;
+        entry.sent_signal = tmp.sent_signal;
+        entry.sent_rcpi = tmp.sent_rcpi;
 
         if(save_80211k)
         {
@@ -883,6 +1437,167 @@ probe_entry insert_to_array(probe_entry entry, int inc_counter, int save_80211k,
     return entry;
 }
 
+int probe_array_merge(probe_entry entry) {
+    pthread_mutex_lock(&probe_array_mutex);
+
+    for (int i = 0; i <= probe_entry_last; i++) {
+        if (mac_is_equal(entry.bssid_addr, probe_array[i].bssid_addr) &&
+            mac_is_equal(entry.client_addr, probe_array[i].client_addr)) {
+            if (probe_array[i].time >= entry.time) {
+                pthread_mutex_unlock(&probe_array_mutex);
+                return 0;
+            }
+            if (probe_array[i].counter > entry.counter) {
+                entry.counter = probe_array[i].counter;
+            }
+            entry.sent_time = probe_array[i].sent_time;
+            entry.sent_signal = probe_array[i].sent_signal;
+            entry.sent_rcpi = probe_array[i].sent_rcpi;
+            break;
+        }
+    }
+    probe_array_delete(entry);
+    probe_array_insert(entry);
+
+    pthread_mutex_unlock(&probe_array_mutex);
+    return 1;
+}
+
+struct probe_forward_stats_s {
+    uint32_t sent;
+    uint32_t suppressed;
+    uint32_t sent_new;
+    uint32_t sent_signal;
+    uint32_t sent_rcpi;
+    uint32_t sent_refresh;
+};
+
+static struct probe_forward_stats_s probe_forward_stats;
+
+int probe_array_beacon_report(probe_entry *entry) {
+    int i;
+
+    pthread_mutex_lock(&probe_array_mutex);
+
+    for (i = 0; i <= probe_entry_last; i++) {
+        if (mac_is_equal(entry->bssid_addr, probe_array[i].bssid_addr) &&
+            mac_is_equal(entry->client_addr, probe_array[i].client_addr)) {
+            probe_array[i].rcpi = entry->rcpi;
+            probe_array[i].rsni = entry->rsni;
+            // the report is newer than the last probe, the score uses the signal
+            probe_array[i].signal = rcpi_to_rssi(entry->rcpi);
+            probe_array[i].time = time(0);
+            *entry = probe_array[i];
+            pthread_mutex_unlock(&probe_array_mutex);
+            return 0;
+        }
+    }
+
+    // the capabilities belong to the client, take them from its probes to the other aps
+    for (i = 0; i <= probe_entry_last; i++) {
+        if (mac_is_equal(entry->client_addr, probe_array[i].client_addr)) {
+            entry->ht_capabilities = probe_array[i].ht_capabilities;
+            entry->vht_capabilities = probe_array[i].vht_capabilities;
+            entry->max_supp_datarate = probe_array[i].max_supp_datarate;
+            entry->min_supp_datarate = probe_array[i].min_supp_datarate;
+            break;
+        }
+    }
+
+    entry->signal = rcpi_to_rssi(entry->rcpi);
+    entry->time = time(0);
+    entry->counter = dawn_metric.min_probe_count;
+    probe_array_insert(*entry);
+
+    pthread_mutex_unlock(&probe_array_mutex);
+    return 1;
+}
+
+int probe_array_forward(probe_entry entry) {
+    int i;
+    time_t now = time(0);
+    uint32_t *reason = NULL;
+
+    pthread_mutex_lock(&probe_array_mutex);
+
+    for (i = 0; i <= probe_entry_last; i++) {
+        if (mac_is_equal(entry.bssid_addr, probe_array[i].bssid_addr) &&
+            mac_is_equal(entry.client_addr, probe_array[i].client_addr)) {
+            break;
+        }
+    }
+
+    if (i > probe_entry_last) {
+        pthread_mutex_unlock(&probe_array_mutex);
+        probe_forward_stats.sent++;
+        return 1;
+    }
+
+    probe_entry *sent = &probe_array[i];
+
+    if (dawn_metric.probe_refresh == 0 || sent->sent_time == 0) {
+        reason = &probe_forward_stats.sent_new;
+    } else if (abs((int) entry.signal - (int) sent->sent_signal) > dawn_metric.probe_signal_delta) {
+        reason = &probe_forward_stats.sent_signal;
+    } else if (entry.rcpi != -1 &&
+               (sent->sent_rcpi == -1 || abs((int) entry.rcpi - (int) sent->sent_rcpi) > dawn_metric.probe_rcpi_delta)) {
+        reason = &probe_forward_stats.sent_rcpi;
+    } else if (now - sent->sent_time >= dawn_metric.probe_refresh) {
+        reason = &probe_forward_stats.sent_refresh;
+    }
+
+    if (reason != NULL) {
+        sent->sent_time = now;
+        sent->sent_signal = entry.signal;
+        sent->sent_rcpi = entry.rcpi;
+    }
+    pthread_mutex_unlock(&probe_array_mutex);
+
+    if (reason == NULL) {
+        probe_forward_stats.suppressed++;
+        return 0;
+    }
+    (*reason)++;
+    probe_forward_stats.sent++;
+    return 1;
+}
+
+int build_probe_stats(struct blob_buf *b) {
+    void *reasons;
+
+    blob_buf_init(b, 0);
+    blobmsg_add_u32(b, "sent", probe_forward_stats.sent);
+    blobmsg_add_u32(b, "suppressed", probe_forward_stats.suppressed);
+    reasons = blobmsg_open_table(b, "sent_reason");
+    blobmsg_add_u32(b, "new", probe_forward_stats.sent_new);
+    blobmsg_add_u32(b, "signal", probe_forward_stats.sent_signal);
+    blobmsg_add_u32(b, "rcpi", probe_forward_stats.sent_rcpi);
+    blobmsg_add_u32(b, "refresh", probe_forward_stats.sent_refresh);
+    blobmsg_close_table(b, reasons);
+    return 0;
+}
+
+int ap_array_merge(ap entry) {
+    pthread_mutex_lock(&ap_array_mutex);
+
+    for (int i = 0; i <= ap_entry_last; i++) {
+        if (mac_is_equal(entry.bssid_addr, ap_array[i].bssid_addr)) {
+            if (ap_array[i].time >= entry.time) {
+                pthread_mutex_unlock(&ap_array_mutex);
+                return 0;
+            }
+            break;
+        }
+    }
+    ap_array_delete(entry);
+    ap_array_insert(entry);
+
+    pthread_mutex_unlock(&ap_array_mutex);
+
+    history_sample_ap(entry.bssid_addr, entry.channel_utilization, entry.station_count);
+    return 1;
+}
+
 ap insert_to_ap_array(ap entry) {
     pthread_mutex_lock(&ap_array_mutex);
 
@@ -891,38 +1606,102 @@ ap insert_to_ap_array(ap entry) {
     ap_array_insert(entry);
     pthread_mutex_unlock(&ap_array_mutex);
 
+    history_sample_ap(entry.bssid_addr, entry.channel_utilization, entry.station_count);
+
     return entry;
 }
 
 
-int ap_get_nr(struct blob_buf *b_local, uint8_t own_bssid_addr[]) {
+static int ap_array_find(uint8_t bssid_addr[]) {
+    for (int i = 0; i <= ap_entry_last; i++) {
+        if (mac_is_equal(bssid_addr, ap_array[i].bssid_addr)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int ap_get_nr(struct blob_buf *b_local, uint8_t own_bssid_addr[], uint32_t *hash) {
+    int heard[ARRAY_AP_LEN] = {0};
+    int order[ARRAY_AP_LEN];
+    int own, own_heard = 0, num = 0;
 
+    pthread_mutex_lock(&probe_array_mutex);
     pthread_mutex_lock(&ap_array_mutex);
-    int i;
 
-    void* nbs = blobmsg_open_array(b_local, "list");
+    own = ap_array_find(own_bssid_addr);
 
-    for (i = 0; i <= ap_entry_last; i++) {
-        if (mac_is_equal(own_bssid_addr, ap_array[i].bssid_addr)) {
-            continue; //TODO: Skip own entry?!
+    // for the clients that hear the own ap, count the other aps they hear (the probe array is sorted by client)
+    for (int i = 0, end; own >= 0 && i <= probe_entry_last; i = end) {
+        int hears_own = 0;
+
+        for (end = i; end <= probe_entry_last && mac_is_equal(probe_array[i].client_addr, probe_array[end].client_addr); end++) {
+            hears_own |= mac_is_equal(probe_array[end].bssid_addr, own_bssid_addr);
+        }
+        if (!hears_own) {
+            continue;
+        }
+        own_heard++;
+        for (int j = i; j < end; j++) {
+            int a = ap_array_find(probe_array[j].bssid_addr);
+            if (a >= 0 && a != own) {
+                heard[a]++;
+            }
         }
+    }
 
+    for (int i = 0; i <= ap_entry_last; i++) {
+        if (i == own || nr_store_get(ap_array[i].bssid_addr, NULL)) {
+            continue;
+        }
+        if (own >= 0 && strcmp((char *) ap_array[i].ssid, (char *) ap_array[own].ssid) != 0) {
+            continue;
+        }
+        // without clients there is nothing to go by, all aps of the ssid are neighbors
+        if (own_heard > 0 && (heard[i] == 0 || heard[i] * 100 < dawn_metric.nr_min_heard * own_heard)) {
+            continue;
+        }
+
+        // most co-heard first, then by bssid so the list doesn't change without reason
+        int j = num++;
+        for (; j > 0 && (heard[order[j - 1]] < heard[i] ||
+                         (heard[order[j - 1]] == heard[i] &&
+                          memcmp(ap_array[order[j - 1]].bssid_addr, ap_array[i].bssid_addr, ETH_ALEN) > 0)); j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+    if (num > dawn_metric.nr_max_neighbors) {
+        num = dawn_metric.nr_max_neighbors;
+    }
+
+    void* nbs = blobmsg_open_array(b_local, "list");
+    *hash = HASH_INIT;
+
+    for (int k = 0; k < num; k++) {
+        ap *entry = &ap_array[order[k]];
         void* nr_entry = blobmsg_open_array(b_local, NULL);
 
         char mac_buf[20];
-        sprintf(mac_buf, MACSTRLOWER, MAC2STR(ap_array[i].bssid_addr));
+        sprintf(mac_buf, MACSTRLOWER, MAC2STR(entry->bssid_addr));
         blobmsg_add_string(b_local, NULL, mac_buf);
 
-        blobmsg_add_string(b_local, NULL, (char *) ap_array[i].ssid);
-        blobmsg_add_string(b_local, NULL, ap_array[i].neighbor_report);
+        blobmsg_add_string(b_local, NULL, (char *) entry->ssid);
+        char *nr = blobmsg_alloc_string_buffer(b_local, NULL, NEIGHBOR_REPORT_LEN);
+        nr_store_get_hex(entry->bssid_addr, -1, nr, NEIGHBOR_REPORT_LEN);
+        blobmsg_add_string_buffer(b_local);
         blobmsg_close_array(b_local, nr_entry);
 
+        uint32_t nr_hash = nr_store_hash(entry->bssid_addr);
+        *hash = hash_update(*hash, entry->ssid, strnlen((char *) entry->ssid, SSID_MAX_LEN));
+        *hash = hash_update(*hash, &nr_hash, sizeof(nr_hash));
     }
     blobmsg_close_array(b_local, nbs);
 
     pthread_mutex_unlock(&ap_array_mutex);
+    pthread_mutex_unlock(&probe_array_mutex);
 
-    return 0;
+    return num;
 }
 
 int ap_get_collision_count(int col_domain) {
@@ -1041,6 +1820,7 @@ void remove_old_probe_entries(time_t current_time, long long int threshold) {
 void remove_old_ap_entries(time_t current_time, long long int threshold) {
     for (int i = 0; i <= ap_entry_last; i++) {
         if (ap_array[i].time < current_time - threshold) {
+            nr_store_remove(ap_array[i].bssid_addr);
             ap_array_delete(ap_array[i]);
         }
     }
@@ -1117,16 +1897,98 @@ void insert_client_to_array(client entry) {
     entry.kick_count = 0;
 
     client client_tmp = client_array_delete(entry);
+    int listed = mac_is_equal(entry.bssid_addr, client_tmp.bssid_addr) &&
+                 mac_is_equal(entry.client_addr, client_tmp.client_addr);
 
-    if (mac_is_equal(entry.bssid_addr, client_tmp.bssid_addr)) {
+    if (listed) {
         entry.kick_count = client_tmp.kick_count;
     }
 
     client_array_insert(entry);
+    roam_state_seen(entry.client_addr, entry.bssid_addr, !listed);
 
     pthread_mutex_unlock(&client_array_mutex);
 }
 
+void client_array_touch(uint8_t bssid_addr[], uint8_t client_addr[]) {
+    pthread_mutex_lock(&client_array_mutex);
+
+    for (int i = 0; i <= client_entry_last; i++) {
+        if (mac_is_equal(client_array[i].bssid_addr, bssid_addr) &&
+            mac_is_equal(client_array[i].client_addr, client_addr)) {
+            client_array[i].time = time(0);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&client_array_mutex);
+}
+
+static int addr_in_list(uint8_t addr[], uint8_t list[][ETH_ALEN], int len) {
+    for (int i = 0; i < len; i++) {
+        if (mac_is_equal(addr, list[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void client_array_keep(uint8_t bssid_addr[], uint8_t clients[][ETH_ALEN], int num_clients) {
+    int j = 0;
+
+    pthread_mutex_lock(&client_array_mutex);
+    for (int i = 0; i <= client_entry_last; i++) {
+        if (mac_is_equal(client_array[i].bssid_addr, bssid_addr) &&
+            !addr_in_list(client_array[i].client_addr, clients, num_clients)) {
+            continue;
+        }
+        client_array[j++] = client_array[i];
+    }
+    client_entry_last = j - 1;
+    pthread_mutex_unlock(&client_array_mutex);
+}
+
+// the tables are not indexed by bssid, one compacting pass per table instead of a delete (and shift) per entry
+void remove_bssid_entries(uint8_t bssids[][ETH_ALEN], int num_bssids) {
+    int j;
+
+    if (num_bssids <= 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&probe_array_mutex);
+    j = 0;
+    for (int i = 0; i <= probe_entry_last; i++) {
+        if (!addr_in_list(probe_array[i].bssid_addr, bssids, num_bssids)) {
+            probe_array[j++] = probe_array[i];
+        }
+    }
+    probe_entry_last = j - 1;
+    pthread_mutex_unlock(&probe_array_mutex);
+
+    pthread_mutex_lock(&client_array_mutex);
+    j = 0;
+    for (int i = 0; i <= client_entry_last; i++) {
+        if (!addr_in_list(client_array[i].bssid_addr, bssids, num_bssids)) {
+            client_array[j++] = client_array[i];
+        }
+    }
+    client_entry_last = j - 1;
+    pthread_mutex_unlock(&client_array_mutex);
+
+    pthread_mutex_lock(&ap_array_mutex);
+    j = 0;
+    for (int i = 0; i <= ap_entry_last; i++) {
+        if (!addr_in_list(ap_array[i].bssid_addr, bssids, num_bssids)) {
+            ap_array[j++] = ap_array[i];
+        } else {
+            nr_store_remove(ap_array[i].bssid_addr);
+        }
+    }
+    ap_entry_last = j - 1;
+    pthread_mutex_unlock(&ap_array_mutex);
+}
+
 void insert_macs_from_file() {
     FILE *fp;
     char *line = NULL;
@@ -1406,12 +2268,14 @@ void print_client_array() {
 
 void print_ap_entry(ap entry) {
     char mac_buf_ap[20];
+    char neighbor_report[NEIGHBOR_REPORT_LEN];
 
     sprintf(mac_buf_ap, MACSTR, MAC2STR(entry.bssid_addr));
+    nr_store_get_hex(entry.bssid_addr, -1, neighbor_report, NEIGHBOR_REPORT_LEN);
     printf("ssid: %s, bssid_addr: %s, freq: %d, ht: %d, vht: %d, chan_utilz: %d, col_d: %d, bandwidth: %d, col_count: %d neighbor_report: %s\n",
            entry.ssid, mac_buf_ap, entry.freq, entry.ht_support, entry.vht_support,
            entry.channel_utilization, entry.collision_domain, entry.bandwidth,
-           ap_get_collision_count(entry.collision_domain), entry.neighbor_report
+           ap_get_collision_count(entry.collision_domain), neighbor_report
     );
 }
 
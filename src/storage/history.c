@@ -0,0 +1,206 @@
+#include <libubox/blobmsg.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "history.h"
+#include "datastorage.h"
+#include "ubus.h"
+#include "utils.h"
+
+struct history_slot_s {
+    uint16_t channel_utilization;
+    uint16_t station_count;
+    uint16_t kicks;
+    uint16_t denies;
+};
+
+struct history_s {
+    uint8_t bssid_addr[ETH_ALEN];
+    // number of the newest slot since the epoch, its index is slot % HISTORY_LEN
+    uint32_t slot;
+    time_t time;
+    struct history_slot_s slots[HISTORY_LEN];
+};
+
+static struct history_s history_array[HISTORY_MAX_APS];
+static int history_entry_last = -1;
+
+// taken after all other array mutexes
+static pthread_mutex_t history_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void history_clear_slot(struct history_slot_s *slot);
+
+static void history_advance(struct history_s *h, uint32_t slot);
+
+static struct history_s *history_get(uint8_t *bssid_addr, time_t now);
+
+static int history_is_local(uint8_t *bssid_addr);
+
+static void history_clear_slot(struct history_slot_s *slot) {
+    slot->channel_utilization = HISTORY_NONE;
+    slot->station_count = HISTORY_NONE;
+    slot->kicks = 0;
+    slot->denies = 0;
+}
+
+// clear the slots that passed since the last update
+static void history_advance(struct history_s *h, uint32_t slot) {
+    uint32_t n;
+
+    if (slot <= h->slot) {
+        return;
+    }
+    n = slot - h->slot < HISTORY_LEN ? slot - h->slot : HISTORY_LEN;
+    for (uint32_t i = 1; i <= n; i++) {
+        history_clear_slot(&h->slots[(h->slot + i) % HISTORY_LEN]);
+    }
+    h->slot = slot;
+}
+
+static struct history_s *history_get(uint8_t *bssid_addr, time_t now) {
+    struct history_s *h = NULL;
+
+    for (int i = 0; i <= history_entry_last; i++) {
+        if (mac_is_equal(history_array[i].bssid_addr, bssid_addr)) {
+            h = &history_array[i];
+            break;
+        }
+    }
+
+    if (h == NULL) {
+        if (history_entry_last < HISTORY_MAX_APS - 1) {
+            h = &history_array[++history_entry_last];
+        } else {
+            h = &history_array[0];
+            for (int i = 1; i <= history_entry_last; i++) {
+                if (history_array[i].time < h->time) {
+                    h = &history_array[i];
+                }
+            }
+        }
+        memcpy(h->bssid_addr, bssid_addr, ETH_ALEN);
+        h->slot = now / HISTORY_RESOLUTION;
+        for (int i = 0; i < HISTORY_LEN; i++) {
+            history_clear_slot(&h->slots[i]);
+        }
+    }
+
+    history_advance(h, now / HISTORY_RESOLUTION);
+    h->time = now;
+    return h;
+}
+
+// the aps of the other nodes would replace the history of the own ones all the time
+static int history_is_local(uint8_t *bssid_addr) {
+    uint32_t id;
+
+    return ubus_get_hostapd_id(bssid_addr, &id) == 0;
+}
+
+void history_sample_ap(uint8_t *bssid_addr, uint32_t channel_utilization, uint32_t station_count) {
+    struct history_slot_s *slot;
+    struct history_s *h;
+
+    if (!history_is_local(bssid_addr)) {
+        return;
+    }
+
+    // HISTORY_NONE is no value
+    if (channel_utilization >= HISTORY_NONE) {
+        channel_utilization = HISTORY_NONE - 1;
+    }
+    if (station_count >= HISTORY_NONE) {
+        station_count = HISTORY_NONE - 1;
+    }
+
+    pthread_mutex_lock(&history_mutex);
+    h = history_get(bssid_addr, time(0));
+    slot = &h->slots[h->slot % HISTORY_LEN];
+    if (slot->channel_utilization == HISTORY_NONE || channel_utilization > slot->channel_utilization) {
+        slot->channel_utilization = channel_utilization;
+    }
+    if (slot->station_count == HISTORY_NONE || station_count > slot->station_count) {
+        slot->station_count = station_count;
+    }
+    pthread_mutex_unlock(&history_mutex);
+}
+
+void history_add_kick(uint8_t *bssid_addr) {
+    struct history_s *h;
+
+    // the controller kicks the clients of the aps of its agents
+    if (!history_is_local(bssid_addr)) {
+        return;
+    }
+
+    pthread_mutex_lock(&history_mutex);
+    h = history_get(bssid_addr, time(0));
+    if (h->slots[h->slot % HISTORY_LEN].kicks < HISTORY_NONE - 1) {
+        h->slots[h->slot % HISTORY_LEN].kicks++;
+    }
+    pthread_mutex_unlock(&history_mutex);
+}
+
+void history_add_deny(uint8_t *bssid_addr) {
+    struct history_s *h;
+
+    if (!history_is_local(bssid_addr)) {
+        return;
+    }
+
+    pthread_mutex_lock(&history_mutex);
+    h = history_get(bssid_addr, time(0));
+    if (h->slots[h->slot % HISTORY_LEN].denies < HISTORY_NONE - 1) {
+        h->slots[h->slot % HISTORY_LEN].denies++;
+    }
+    pthread_mutex_unlock(&history_mutex);
+}
+
+int build_history_overview(struct blob_buf *b, uint8_t *bssid_addr, int len) {
+    static const char *names[] = {"channel_utilization", "station_count", "kicks", "denies"};
+    uint32_t now = time(0) / HISTORY_RESOLUTION;
+    void *aps, *ap, *list;
+    char ap_mac_buf[20];
+
+    if (len <= 0 || len > HISTORY_LEN) {
+        len = HISTORY_LEN;
+    }
+
+    blob_buf_init(b, 0);
+    blobmsg_add_u32(b, "resolution", HISTORY_RESOLUTION);
+    blobmsg_add_u32(b, "length", len);
+    // start of the first slot, the last one is the current
+    blobmsg_add_u32(b, "start", (now - len + 1) * HISTORY_RESOLUTION);
+
+    pthread_mutex_lock(&history_mutex);
+    aps = blobmsg_open_table(b, "aps");
+    for (int i = 0; i <= history_entry_last; i++) {
+        struct history_s *h = &history_array[i];
+
+        if (bssid_addr != NULL && !mac_is_equal(h->bssid_addr, bssid_addr)) {
+            continue;
+        }
+        // all arrays end with the current slot
+        history_advance(h, now);
+
+        sprintf(ap_mac_buf, MACSTR, MAC2STR(h->bssid_addr));
+        ap = blobmsg_open_table(b, ap_mac_buf);
+        for (int v = 0; v < 4; v++) {
+            list = blobmsg_open_array(b, names[v]);
+            for (uint32_t s = h->slot - len + 1; s != h->slot + 1; s++) {
+                struct history_slot_s *slot = &h->slots[s % HISTORY_LEN];
+                uint16_t val = v == 0 ? slot->channel_utilization : v == 1 ? slot->station_count :
+                               v == 2 ? slot->kicks : slot->denies;
+
+                blobmsg_add_u32(b, NULL, val == HISTORY_NONE ? (uint32_t) -1 : val);
+            }
+            blobmsg_close_array(b, list);
+        }
+        blobmsg_close_table(b, ap);
+    }
+    blobmsg_close_table(b, aps);
+    pthread_mutex_unlock(&history_mutex);
+    return 0;
+}
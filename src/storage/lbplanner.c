@@ -0,0 +1,430 @@
+#include <libubox/blobmsg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "lbplanner.h"
+#include "datastorage.h"
+#include "nrstore.h"
+
+struct lb_stats_s {
+    uint32_t runs;
+    uint32_t duration_ms;
+    uint32_t duration_max_ms;
+    uint32_t aps;
+    uint32_t clients;
+    uint32_t edges;
+    uint32_t moves;
+    uint32_t balance_moves;
+    uint32_t held_moves;
+};
+
+// copy of a client entry, the planning runs without the array locks
+struct lb_client_s {
+    uint8_t bssid_addr[ETH_ALEN];
+    uint8_t client_addr[ETH_ALEN];
+};
+
+// move of a client that was planned in the last runs, sorted by client
+struct lb_streak_s {
+    uint8_t client_addr[ETH_ALEN];
+    uint8_t target_addr[ETH_ALEN];
+    int count;
+};
+
+static struct lb_stats_s lb_stats;
+
+static struct lb_streak_s *lb_streaks;
+static int lb_num_streaks;
+
+static int lb_edge_cmp(const void *a, const void *b);
+
+static int lb_ap_cmp(const void *a, const void *b);
+
+static int lb_client_cmp(const void *a, const void *b);
+
+static int lb_find_ap(struct ap_s **index, int len, uint8_t *bssid_addr);
+
+static int lb_find_client(struct lb_client_s **index, int len, uint8_t *client_addr);
+
+static int lb_find_streak(uint8_t *client_addr);
+
+static int lb_edge_cmp(const void *a, const void *b) {
+    const struct lb_edge_s *ea = a, *eb = b;
+
+    if (ea->gain != eb->gain) {
+        return eb->gain - ea->gain;
+    }
+    // same gain: prefer the better target, then keep it deterministic so all nodes plan the same
+    if (ea->score != eb->score) {
+        return eb->score - ea->score;
+    }
+    return ea->client != eb->client ? ea->client - eb->client : ea->ap - eb->ap;
+}
+
+static int lb_ap_cmp(const void *a, const void *b) {
+    return memcmp((*(struct ap_s **) a)->bssid_addr, (*(struct ap_s **) b)->bssid_addr, ETH_ALEN);
+}
+
+static int lb_client_cmp(const void *a, const void *b) {
+    return memcmp((*(struct lb_client_s **) a)->client_addr, (*(struct lb_client_s **) b)->client_addr, ETH_ALEN);
+}
+
+// binary search in an index sorted by address, returns the position in the index
+static int lb_find_ap(struct ap_s **index, int len, uint8_t *bssid_addr) {
+    int low = 0, high = len - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = memcmp(index[mid]->bssid_addr, bssid_addr, ETH_ALEN);
+
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+static int lb_find_client(struct lb_client_s **index, int len, uint8_t *client_addr) {
+    int low = 0, high = len - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = memcmp(index[mid]->client_addr, client_addr, ETH_ALEN);
+
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+static int lb_find_streak(uint8_t *client_addr) {
+    int low = 0, high = lb_num_streaks - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = memcmp(lb_streaks[mid].client_addr, client_addr, ETH_ALEN);
+
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return -1;
+}
+
+int lb_solve(struct lb_problem_s *p) {
+    int moves = 0;
+
+    for (int c = 0; c < p->num_clients; c++) {
+        p->new_ap[c] = p->cur_ap[c];
+        p->new_gain[c] = 0;
+    }
+
+    qsort(p->edges, p->num_edges, sizeof(struct lb_edge_s), lb_edge_cmp);
+
+    // better aps first, as long as they have room
+    for (int i = 0; i < p->num_edges; i++) {
+        struct lb_edge_s *e = &p->edges[i];
+
+        if (e->gain < p->min_gain) {
+            break;
+        }
+        if (p->new_ap[e->client] != p->cur_ap[e->client] || p->load[e->ap] >= p->capacity[e->ap]) {
+            continue;
+        }
+        p->load[p->cur_ap[e->client]]--;
+        p->load[e->ap]++;
+        p->new_ap[e->client] = e->ap;
+        p->new_gain[e->client] = e->gain;
+        moves++;
+    }
+
+    // then relieve the aps that are still over their capacity, with the smallest loss first
+    for (int i = 0; i < p->num_edges; i++) {
+        struct lb_edge_s *e = &p->edges[i];
+        int cur = p->cur_ap[e->client];
+
+        if (p->new_ap[e->client] != cur || p->load[cur] <= p->capacity[cur] ||
+            p->load[e->ap] >= p->capacity[e->ap] || e->score < 0) {
+            continue;
+        }
+        p->load[cur]--;
+        p->load[e->ap]++;
+        p->new_ap[e->client] = e->ap;
+        p->new_gain[e->client] = e->gain;
+        moves++;
+    }
+    return moves;
+}
+
+int lb_plan(void (*cb)(struct lb_move_s *move)) {
+    struct timespec start, end;
+    struct lb_problem_s p;
+    int num_aps, num_all_clients, num_probes, num_clients = 0, num_groups = 0, num_streaks = 0, ret = -1;
+    struct ap_s *aps = NULL;
+    struct lb_client_s *clients = NULL;
+    probe_entry *probes = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    memset(&p, 0, sizeof(p));
+
+    // plan on a copy, the other events are not blocked while the plan is computed
+    pthread_mutex_lock(&client_array_mutex);
+    pthread_mutex_lock(&probe_array_mutex);
+    pthread_mutex_lock(&ap_array_mutex);
+
+    num_aps = ap_entry_last + 1;
+    num_all_clients = client_entry_last + 1;
+    num_probes = probe_entry_last + 1;
+
+    // + 1, malloc(0) may return NULL
+    aps = malloc((num_aps + 1) * sizeof(struct ap_s));
+    clients = malloc((num_all_clients + 1) * sizeof(struct lb_client_s));
+    probes = malloc((num_probes + 1) * sizeof(probe_entry));
+    if (aps && clients && probes) {
+        memcpy(aps, ap_array, num_aps * sizeof(struct ap_s));
+        for (int i = 0; i < num_all_clients; i++) {
+            memcpy(clients[i].bssid_addr, client_array[i].bssid_addr, ETH_ALEN);
+            memcpy(clients[i].client_addr, client_array[i].client_addr, ETH_ALEN);
+        }
+        memcpy(probes, probe_array, num_probes * sizeof(probe_entry));
+    }
+
+    pthread_mutex_unlock(&ap_array_mutex);
+    pthread_mutex_unlock(&probe_array_mutex);
+    pthread_mutex_unlock(&client_array_mutex);
+
+    struct ap_s **ap_index = malloc((num_aps + 1) * sizeof(struct ap_s *));
+    int *ap_group = malloc((num_aps + 1) * sizeof(int));
+    int *group_clients = calloc(num_aps + 1, sizeof(int));
+    int *group_aps = calloc(num_aps + 1, sizeof(int));
+    struct lb_client_s **client_index = malloc((num_all_clients + 1) * sizeof(struct lb_client_s *));
+    int *own_score = malloc((num_all_clients + 1) * sizeof(int));
+    struct lb_streak_s *streaks = malloc((num_all_clients + 1) * sizeof(struct lb_streak_s));
+    struct lb_move_s *moves = malloc((num_all_clients + 1) * sizeof(struct lb_move_s));
+
+    p.capacity = malloc((num_aps + 1) * sizeof(int));
+    p.load = calloc(num_aps + 1, sizeof(int));
+    p.cur_ap = malloc((num_all_clients + 1) * sizeof(int));
+    p.new_ap = malloc((num_all_clients + 1) * sizeof(int));
+    p.new_gain = malloc((num_all_clients + 1) * sizeof(int));
+    p.edges = malloc((num_probes + 1) * sizeof(struct lb_edge_s));
+    p.min_gain = dawn_metric.lb_min_gain;
+
+    if (!aps || !clients || !probes || !ap_index || !ap_group || !group_clients || !group_aps || !client_index ||
+        !own_score || !streaks || !moves || !p.capacity || !p.load || !p.cur_ap || !p.new_ap || !p.new_gain ||
+        !p.edges) {
+        fprintf(stderr, "Load balancing: out of memory\n");
+        goto out;
+    }
+
+    // the ap array is not sorted by bssid, the index is
+    for (int i = 0; i < num_aps; i++) {
+        ap_index[i] = &aps[i];
+    }
+    qsort(ap_index, num_aps, sizeof(struct ap_s *), lb_ap_cmp);
+    p.num_aps = num_aps;
+
+    // clients only move between aps of the same ssid
+    for (int i = 0; i < num_aps; i++) {
+        ap_group[i] = -1;
+        for (int j = 0; j < i; j++) {
+            if (strcmp((char *) aps[i].ssid, (char *) aps[j].ssid) == 0) {
+                ap_group[i] = ap_group[j];
+                break;
+            }
+        }
+        if (ap_group[i] == -1) {
+            ap_group[i] = num_groups++;
+        }
+        group_aps[ap_group[i]]++;
+    }
+
+    for (int i = 0; i < num_all_clients; i++) {
+        if (lb_find_ap(ap_index, num_aps, clients[i].bssid_addr) >= 0) {
+            client_index[num_clients++] = &clients[i];
+        }
+    }
+    qsort(client_index, num_clients, sizeof(struct lb_client_s *), lb_client_cmp);
+
+    // a client that is listed for several aps (stale entry) is planned once
+    int n = 0;
+    for (int i = 0; i < num_clients; i++) {
+        if (n > 0 && mac_is_equal(client_index[n - 1]->client_addr, client_index[i]->client_addr)) {
+            continue;
+        }
+        client_index[n] = client_index[i];
+        p.cur_ap[n] = ap_index[lb_find_ap(ap_index, num_aps, client_index[i]->bssid_addr)] - aps;
+        own_score[n] = -1;
+        p.load[p.cur_ap[n]]++;
+        group_clients[ap_group[p.cur_ap[n]]]++;
+        n++;
+    }
+    num_clients = n;
+    p.num_clients = num_clients;
+
+    for (int i = 0; i < num_aps; i++) {
+        int g = ap_group[i];
+
+        if (dawn_metric.lb_capacity > 0) {
+            p.capacity[i] = dawn_metric.lb_capacity;
+        } else {
+            p.capacity[i] = (group_clients[g] + group_aps[g] - 1) / group_aps[g] + dawn_metric.max_station_diff;
+        }
+        // a busy channel gets no additional clients
+        if (aps[i].channel_utilization > dawn_metric.max_chan_util_val && p.capacity[i] > p.load[i]) {
+            p.capacity[i] = p.load[i];
+        }
+    }
+
+    // the hearing map gives the possible moves
+    for (int i = 0; i < num_probes; i++) {
+        int c = lb_find_client(client_index, num_clients, probes[i].client_addr);
+        int a = lb_find_ap(ap_index, num_aps, probes[i].bssid_addr);
+
+        if (c < 0 || a < 0) {
+            continue;
+        }
+        a = ap_index[a] - aps;
+        if (ap_group[a] != ap_group[p.cur_ap[c]]) {
+            continue;
+        }
+
+        int score = eval_probe_score(&probes[i], &aps[a]);
+        if (a == p.cur_ap[c]) {
+            own_score[c] = score;
+            continue;
+        }
+        p.edges[p.num_edges].client = c;
+        p.edges[p.num_edges].ap = a;
+        p.edges[p.num_edges].score = score;
+        p.num_edges++;
+    }
+
+    // without a probe for the current ap there is nothing to compare with
+    n = 0;
+    for (int i = 0; i < p.num_edges; i++) {
+        if (own_score[p.edges[i].client] == -1) {
+            continue;
+        }
+        p.edges[i].gain = p.edges[i].score - own_score[p.edges[i].client];
+        p.edges[n++] = p.edges[i];
+    }
+    p.num_edges = n;
+
+    ret = lb_solve(&p);
+
+    // like the kicks of the per ap evaluation, a move has to be planned min_kick_count times in a row
+    int num_moves = 0;
+    lb_stats.balance_moves = 0;
+    lb_stats.held_moves = 0;
+    for (int c = 0; c < num_clients; c++) {
+        struct lb_streak_s *streak = &streaks[num_streaks];
+        int old;
+
+        if (p.new_ap[c] == p.cur_ap[c]) {
+            continue;
+        }
+        memcpy(streak->client_addr, client_index[c]->client_addr, ETH_ALEN);
+        memcpy(streak->target_addr, aps[p.new_ap[c]].bssid_addr, ETH_ALEN);
+        old = lb_find_streak(streak->client_addr);
+        streak->count = old >= 0 && mac_is_equal(lb_streaks[old].target_addr, streak->target_addr) ?
+                        lb_streaks[old].count + 1 : 1;
+        num_streaks++;
+        if (streak->count < dawn_metric.min_kick_count) {
+            lb_stats.held_moves++;
+            continue;
+        }
+
+        moves[num_moves].bssid_addr = aps[p.cur_ap[c]].bssid_addr;
+        moves[num_moves].client_addr = client_index[c]->client_addr;
+        moves[num_moves].target_addr = aps[p.new_ap[c]].bssid_addr;
+        moves[num_moves].gain = p.new_gain[c];
+        if (moves[num_moves].gain < p.min_gain) {
+            lb_stats.balance_moves++;
+        }
+        num_moves++;
+    }
+
+    // the streaks of the clients that were not planned to move end
+    free(lb_streaks);
+    lb_streaks = streaks;
+    lb_num_streaks = num_streaks;
+    streaks = NULL;
+
+    // the kick candidates are guarded by the client array mutex
+    pthread_mutex_lock(&client_array_mutex);
+    for (int i = 0; i < num_moves; i++) {
+        char neighbor_report[NEIGHBOR_REPORT_LEN];
+
+        nr_store_get_hex(moves[i].target_addr, -1, neighbor_report, NEIGHBOR_REPORT_LEN);
+        moves[i].neighbor_report = neighbor_report;
+        cb(&moves[i]);
+    }
+    pthread_mutex_unlock(&client_array_mutex);
+
+    lb_stats.aps = num_aps;
+    lb_stats.clients = num_clients;
+    lb_stats.edges = p.num_edges;
+    lb_stats.moves = ret;
+
+out:
+    free(aps);
+    free(clients);
+    free(probes);
+    free(streaks);
+    free(moves);
+    free(ap_index);
+    free(ap_group);
+    free(group_clients);
+    free(group_aps);
+    free(client_index);
+    free(own_score);
+    free(p.capacity);
+    free(p.load);
+    free(p.cur_ap);
+    free(p.new_ap);
+    free(p.new_gain);
+    free(p.edges);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    lb_stats.runs++;
+    lb_stats.duration_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    if (lb_stats.duration_ms > lb_stats.duration_max_ms) {
+        lb_stats.duration_max_ms = lb_stats.duration_ms;
+    }
+    return ret;
+}
+
+int build_lb_overview(struct blob_buf *b) {
+    blob_buf_init(b, 0);
+    blobmsg_add_u8(b, "enabled", dawn_metric.lb_planner);
+    blobmsg_add_u32(b, "runs", lb_stats.runs);
+    blobmsg_add_u32(b, "duration_ms", lb_stats.duration_ms);
+    blobmsg_add_u32(b, "duration_max_ms", lb_stats.duration_max_ms);
+    blobmsg_add_u32(b, "aps", lb_stats.aps);
+    blobmsg_add_u32(b, "clients", lb_stats.clients);
+    blobmsg_add_u32(b, "edges", lb_stats.edges);
+    blobmsg_add_u32(b, "moves", lb_stats.moves);
+    blobmsg_add_u32(b, "balance_moves", lb_stats.balance_moves);
+    blobmsg_add_u32(b, "held_moves", lb_stats.held_moves);
+    return 0;
+}
@@ -0,0 +1,192 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nrstore.h"
+#include "utils.h"
+
+// sorted by bssid
+static struct nr_element_s nr_store[NR_STORE_LEN];
+static int nr_store_last = -1;
+
+// taken after all other array mutexes
+static pthread_mutex_t nr_store_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int nr_store_find(uint8_t *bssid_addr, int *pos);
+
+static int nr_parse(const char *hex, struct nr_element_s *nr);
+
+static int nr_to_hex(const struct nr_element_s *nr, int preference, char *buf, int len);
+
+static uint32_t nr_hash(const struct nr_element_s *nr);
+
+static int nr_equal(const struct nr_element_s *a, const struct nr_element_s *b);
+
+// binary search, pos is where the ap is or would be inserted
+static int nr_store_find(uint8_t *bssid_addr, int *pos) {
+    int low = 0, high = nr_store_last;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        int cmp = memcmp(nr_store[mid].bssid_addr, bssid_addr, ETH_ALEN);
+
+        if (cmp == 0) {
+            *pos = mid;
+            return 1;
+        }
+        if (cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    *pos = low;
+    return 0;
+}
+
+static int nr_parse(const char *hex, struct nr_element_s *nr) {
+    uint8_t raw[NR_MAX_LEN];
+    int len = strlen(hex);
+
+    if (len % 2 || len / 2 < NR_FIXED_LEN || len / 2 > (int) sizeof(raw)) {
+        return -1;
+    }
+    for (int i = 0; i < len / 2; i++) {
+        int a = hex_to_bin(hex[2 * i]);
+        int b = hex_to_bin(hex[2 * i + 1]);
+
+        if (a < 0 || b < 0) {
+            return -1;
+        }
+        raw[i] = (a << 4) | b;
+    }
+
+    memset(nr, 0, sizeof(struct nr_element_s));
+    memcpy(nr->bssid_addr, raw, ETH_ALEN);
+    // little endian like all 802.11 fields
+    nr->bssid_info = raw[6] | raw[7] << 8 | raw[8] << 16 | (uint32_t) raw[9] << 24;
+    nr->op_class = raw[10];
+    nr->channel = raw[11];
+    nr->phy_type = raw[12];
+    nr->subelem_len = len / 2 - NR_FIXED_LEN;
+    memcpy(nr->subelems, raw + NR_FIXED_LEN, nr->subelem_len);
+    return 0;
+}
+
+static int nr_to_hex(const struct nr_element_s *nr, int preference, char *buf, int len) {
+    int n;
+
+    n = snprintf(buf, len, "%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x", MAC2STR(nr->bssid_addr),
+                 nr->bssid_info & 0xff, (nr->bssid_info >> 8) & 0xff, (nr->bssid_info >> 16) & 0xff,
+                 (nr->bssid_info >> 24) & 0xff, nr->op_class, nr->channel, nr->phy_type);
+
+    for (int i = 0; i < nr->subelem_len && n < len; i++) {
+        n += snprintf(buf + n, len - n, "%02x", nr->subelems[i]);
+    }
+    if (preference >= 0 && n < len) {
+        n += snprintf(buf + n, len - n, "%02x%02x%02x", NR_SUBELEM_CANDIDATE_PREF, 1, preference);
+    }
+
+    if (n >= len) {
+        buf[0] = '\0';
+        return -1;
+    }
+    return n;
+}
+
+static uint32_t nr_hash(const struct nr_element_s *nr) {
+    uint32_t hash = HASH_INIT;
+
+    hash = hash_update(hash, nr->bssid_addr, ETH_ALEN);
+    hash = hash_update(hash, &nr->bssid_info, sizeof(nr->bssid_info));
+    hash = hash_update(hash, &nr->op_class, 1);
+    hash = hash_update(hash, &nr->channel, 1);
+    hash = hash_update(hash, &nr->phy_type, 1);
+    return hash_update(hash, nr->subelems, nr->subelem_len);
+}
+
+static int nr_equal(const struct nr_element_s *a, const struct nr_element_s *b) {
+    return memcmp(a->bssid_addr, b->bssid_addr, ETH_ALEN) == 0 && a->bssid_info == b->bssid_info &&
+           a->op_class == b->op_class && a->channel == b->channel && a->phy_type == b->phy_type &&
+           a->subelem_len == b->subelem_len && memcmp(a->subelems, b->subelems, a->subelem_len) == 0;
+}
+
+int nr_store_set(uint8_t *bssid_addr, const char *hex) {
+    struct nr_element_s nr;
+    int pos, ret = 1;
+
+    if (hex[0] == '\0') {
+        pthread_mutex_lock(&nr_store_mutex);
+        if (!nr_store_find(bssid_addr, &pos)) {
+            ret = 0;
+        } else {
+            memmove(&nr_store[pos], &nr_store[pos + 1], (nr_store_last - pos) * sizeof(struct nr_element_s));
+            nr_store_last--;
+        }
+        pthread_mutex_unlock(&nr_store_mutex);
+        return ret;
+    }
+
+    if (nr_parse(hex, &nr)) {
+        fprintf(stderr, "Invalid neighbor report for " MACSTR ": %s\n", MAC2STR(bssid_addr), hex);
+        return -1;
+    }
+    // stored under the ap it was received for, the element carries the same bssid
+    memcpy(nr.bssid_addr, bssid_addr, ETH_ALEN);
+
+    pthread_mutex_lock(&nr_store_mutex);
+    if (nr_store_find(bssid_addr, &pos)) {
+        ret = !nr_equal(&nr_store[pos], &nr);
+    } else if (nr_store_last == NR_STORE_LEN - 1) {
+        fprintf(stderr, "Neighbor report store is full\n");
+        ret = -1;
+    } else {
+        memmove(&nr_store[pos + 1], &nr_store[pos], (nr_store_last - pos + 1) * sizeof(struct nr_element_s));
+        nr_store_last++;
+    }
+    if (ret == 1) {
+        nr_store[pos] = nr;
+    }
+    pthread_mutex_unlock(&nr_store_mutex);
+    return ret;
+}
+
+int nr_store_get(uint8_t *bssid_addr, struct nr_element_s *nr) {
+    int pos, found;
+
+    pthread_mutex_lock(&nr_store_mutex);
+    found = nr_store_find(bssid_addr, &pos);
+    if (found && nr != NULL) {
+        *nr = nr_store[pos];
+    }
+    pthread_mutex_unlock(&nr_store_mutex);
+    return found ? 0 : -1;
+}
+
+int nr_store_get_hex(uint8_t *bssid_addr, int preference, char *buf, int len) {
+    int pos, ret = -1;
+
+    buf[0] = '\0';
+    pthread_mutex_lock(&nr_store_mutex);
+    if (nr_store_find(bssid_addr, &pos)) {
+        ret = nr_to_hex(&nr_store[pos], preference, buf, len);
+    }
+    pthread_mutex_unlock(&nr_store_mutex);
+    return ret;
+}
+
+uint32_t nr_store_hash(uint8_t *bssid_addr) {
+    uint32_t hash = 0;
+    int pos;
+
+    pthread_mutex_lock(&nr_store_mutex);
+    if (nr_store_find(bssid_addr, &pos)) {
+        hash = nr_hash(&nr_store[pos]);
+    }
+    pthread_mutex_unlock(&nr_store_mutex);
+    return hash;
+}
+
+void nr_store_remove(uint8_t *bssid_addr) {
+    nr_store_set(bssid_addr, "");
+}
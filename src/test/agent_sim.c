@@ -0,0 +1,312 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+Simulates many agents with their aps against a controller on this host.
+Every agent opens a tcp connection to the controller, announces the clients of its aps and sends
+the probes of the clients, each client is heard by its own ap and the next one.
+The messages carry the envelope of a node (node id, seq, hops) and every agent sends a heartbeat each second,
+so the controller tracks one peer per agent.
+The test passes when every ap got a decision and every agent was echoed in a heartbeat of the controller
+before the timeout.
+
+The controller needs role 2, network_option 2 and use_symm_enc 0.
+
+    dawn_agent_sim [host] [port] [aps] [clients per ap] [agents] [timeout (s)]
+*/
+
+#define SIM_MAX_APS 4096
+#define SIM_BUF_LEN (64 * 1024)
+
+struct sim_agent_s {
+    int fd;
+    uint32_t node;
+    uint32_t seq;
+    uint32_t hb_seq;
+    int echoed;
+    char buf[SIM_BUF_LEN];
+    int len;
+};
+
+static int num_aps = 300;
+static int clients_per_ap = 5;
+// one agent per ap, like a site of single radio aps
+static int num_agents = -1;
+
+static uint8_t ap_decided[SIM_MAX_APS];
+static uint32_t decisions;
+static uint32_t kicks;
+static int agents_echoed;
+
+static void sim_bssid(int ap, char *buf) {
+    sprintf(buf, "02:00:00:00:%02X:%02X", (ap >> 8) & 0xff, ap & 0xff);
+}
+
+static void sim_client(int ap, int c, char *buf) {
+    sprintf(buf, "02:10:%02X:%02X:00:%02X", (ap >> 8) & 0xff, ap & 0xff, c & 0xff);
+}
+
+// the data is a json string in the envelope, quotes are escaped
+static int sim_send(struct sim_agent_s *agent, const char *method, const char *data) {
+    static char payload[SIM_BUF_LEN];
+    struct timespec now;
+    int len = snprintf(payload, sizeof(payload), "{\"method\":\"%s\",\"data\":\"", method);
+
+    // room for the escape and the rest of the envelope
+    for (const char *p = data; *p && len < (int) sizeof(payload) - 128; p++) {
+        if (*p == '"') {
+            payload[len++] = '\\';
+        }
+        payload[len++] = *p;
+    }
+    // an agent only talks to the controller, so every message is one to all its peers
+    clock_gettime(CLOCK_REALTIME, &now);
+    agent->seq++;
+    len += snprintf(payload + len, sizeof(payload) - len,
+                    "\",\"node\":%u,\"seq\":%u,\"all_seq\":%u,\"hops\":0,\"ts\":%u,\"ts_ms\":%u}", agent->node,
+                    agent->seq, agent->seq, (uint32_t) now.tv_sec, (uint32_t) (now.tv_nsec / 1000000));
+
+    uint32_t header = htonl(len);
+    if (write(agent->fd, &header, sizeof(header)) != sizeof(header) || write(agent->fd, payload, len) != len) {
+        perror("write");
+        return -1;
+    }
+    return 0;
+}
+
+static int sim_send_clients(struct sim_agent_s *agent, int ap) {
+    char data[SIM_BUF_LEN], bssid[20], client[20];
+    int len;
+
+    sim_bssid(ap, bssid);
+    len = sprintf(data, "{\"bssid\":\"%s\",\"ssid\":\"dawn-sim\",\"freq\":%d,\"ht_supported\":1,\"vht_supported\":0,"
+                        "\"channel_utilization\":%d,\"num_sta\":%d,\"clients\":{",
+                  bssid, ap % 2 ? 2412 : 5180, (ap * 37) % 200, clients_per_ap);
+    for (int c = 0; c < clients_per_ap; c++) {
+        sim_client(ap, c, client);
+        len += sprintf(data + len, "%s\"%s\":{\"auth\":1,\"assoc\":1,\"authorized\":1,\"ht\":1,\"vht\":0,\"aid\":%d}",
+                       c ? "," : "", client, c + 1);
+    }
+    sprintf(data + len, "}}");
+    return sim_send(agent, "clients", data);
+}
+
+static int sim_send_probe(struct sim_agent_s *agent, int ap, int client_ap, int c, int signal) {
+    char data[512], bssid[20], client[20];
+
+    sim_bssid(ap, bssid);
+    sim_client(client_ap, c, client);
+    sprintf(data, "{\"bssid\":\"%s\",\"address\":\"%s\",\"target\":\"%s\",\"signal\":%d,\"freq\":%d,"
+                  "\"rcpi\":-1,\"rsni\":-1,\"ssid\":\"dawn-sim\",\"ht_capabilities\":{}}",
+            bssid, client, bssid, signal, ap % 2 ? 2412 : 5180);
+    return sim_send(agent, "probe", data);
+}
+
+// agent a has the aps a, a + num_agents, ...
+static int sim_send_heartbeat(struct sim_agent_s *agent, int a) {
+    char data[SIM_BUF_LEN], bssid[20];
+    int len;
+
+    agent->hb_seq++;
+    len = sprintf(data, "{\"hb_seq\":%u,\"bssids\":[", agent->hb_seq);
+    for (int ap = a; ap < num_aps && len < (int) sizeof(data) - 32; ap += num_agents) {
+        sim_bssid(ap, bssid);
+        len += sprintf(data + len, "%s\"%s\"", ap == a ? "" : ",", bssid);
+    }
+    sprintf(data + len, "]}");
+    return sim_send(agent, "heartbeat", data);
+}
+
+// count the decisions and kicks of the controller and look for the agent in the echo of its heartbeats,
+// returns -1 if the connection is gone
+static int sim_read(struct sim_agent_s *agent) {
+    int n = read(agent->fd, agent->buf + agent->len, SIM_BUF_LEN - agent->len - 1);
+
+    if (n <= 0) {
+        return n == 0 || errno != EAGAIN ? -1 : 0;
+    }
+    agent->len += n;
+
+    while (agent->len >= 4) {
+        uint32_t frame_len;
+
+        memcpy(&frame_len, agent->buf, 4);
+        frame_len = ntohl(frame_len);
+        if (frame_len > SIM_BUF_LEN - 5) {
+            fprintf(stderr, "Invalid frame length %u\n", frame_len);
+            return -1;
+        }
+        if (agent->len < (int) frame_len + 4) {
+            break;
+        }
+
+        char *frame = agent->buf + 4;
+        char next = frame[frame_len];
+        frame[frame_len] = '\0';
+        if (strstr(frame, "\"method\":\"decision\"") || strstr(frame, "\"method\": \"decision\"")) {
+            char *p = strstr(frame, "bssid\\\"");
+            unsigned int hi, lo;
+
+            decisions++;
+            // bssid\": \"02:00:00:00:HH:LL
+            if (p && (p = strstr(p, "02:00:00:00:")) && sscanf(p + 12, "%2X:%2X", &hi, &lo) == 2 &&
+                (int) (hi << 8 | lo) < num_aps) {
+                ap_decided[hi << 8 | lo] = 1;
+            }
+        } else if (strstr(frame, "\"method\":\"kick\"") || strstr(frame, "\"method\": \"kick\"")) {
+            kicks++;
+        } else if (!agent->echoed &&
+                   (strstr(frame, "\"method\":\"heartbeat\"") || strstr(frame, "\"method\": \"heartbeat\""))) {
+            char node_buf[16];
+
+            // echo\": { \"NNNNNNNN\": { \"seq\": ...
+            sprintf(node_buf, "\\\"%08x\\\"", agent->node);
+            if (strstr(frame, node_buf)) {
+                agent->echoed = 1;
+                agents_echoed++;
+            }
+        }
+        frame[frame_len] = next;
+
+        memmove(agent->buf, agent->buf + 4 + frame_len, agent->len - 4 - frame_len);
+        agent->len -= 4 + frame_len;
+    }
+    return 0;
+}
+
+static long sim_ms_since(struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+int main(int argc, char **argv) {
+    const char *host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 1026;
+    int timeout = 30;
+    struct sim_agent_s *agents;
+    struct sockaddr_in addr;
+    struct timespec start;
+    int decided = 0;
+
+    if (argc > 3)
+        num_aps = atoi(argv[3]);
+    if (argc > 4)
+        clients_per_ap = atoi(argv[4]);
+    if (argc > 5)
+        num_agents = atoi(argv[5]);
+    if (argc > 6)
+        timeout = atoi(argv[6]);
+    if (num_agents < 0)
+        num_agents = num_aps;
+
+    if (num_aps < 2 || num_aps > SIM_MAX_APS || clients_per_ap < 1 || clients_per_ap > 255 ||
+        num_agents < 1 || num_agents > num_aps) {
+        fprintf(stderr, "Invalid arguments\n");
+        return 2;
+    }
+
+    agents = calloc(num_agents, sizeof(struct sim_agent_s));
+    if (agents == NULL) {
+        return 2;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid address %s\n", host);
+        return 2;
+    }
+
+    for (int a = 0; a < num_agents; a++) {
+        // the node ids of dawn are 31 bit
+        agents[a].node = 0x5a000000 + a;
+        agents[a].fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (agents[a].fd < 0 || connect(agents[a].fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            perror("connect");
+            return 2;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int a = 0; a < num_agents; a++) {
+        if (sim_send_heartbeat(&agents[a], a)) {
+            return 2;
+        }
+    }
+    // ap i belongs to agent i % num_agents, the controller learns the owner from the connection
+    for (int ap = 0; ap < num_aps; ap++) {
+        if (sim_send_clients(&agents[ap % num_agents], ap)) {
+            return 2;
+        }
+    }
+    for (int ap = 0; ap < num_aps; ap++) {
+        int next = (ap + 1) % num_aps;
+
+        for (int c = 0; c < clients_per_ap; c++) {
+            // the next ap hears the client better every other time, so there is something to decide
+            if (sim_send_probe(&agents[ap % num_agents], ap, ap, c, -60) ||
+                sim_send_probe(&agents[next % num_agents], next, ap, c, c % 2 ? -50 : -75)) {
+                return 2;
+            }
+        }
+    }
+    printf("Sent %d aps with %d clients in %ld ms\n", num_aps, num_aps * clients_per_ap, sim_ms_since(&start));
+
+    struct pollfd *fds = calloc(num_agents, sizeof(struct pollfd));
+    if (fds == NULL) {
+        return 2;
+    }
+    for (int a = 0; a < num_agents; a++) {
+        fds[a].fd = agents[a].fd;
+        fds[a].events = POLLIN;
+    }
+
+    long last_heartbeat = 0;
+    while ((decided < num_aps || agents_echoed < num_agents) && sim_ms_since(&start) < timeout * 1000L) {
+        if (sim_ms_since(&start) - last_heartbeat >= 1000) {
+            last_heartbeat = sim_ms_since(&start);
+            for (int a = 0; a < num_agents; a++) {
+                if (sim_send_heartbeat(&agents[a], a)) {
+                    return 2;
+                }
+            }
+        }
+        if (poll(fds, num_agents, 100) < 0) {
+            perror("poll");
+            return 2;
+        }
+        for (int a = 0; a < num_agents; a++) {
+            if ((fds[a].revents & (POLLIN | POLLHUP)) && sim_read(&agents[a]) < 0) {
+                fprintf(stderr, "Controller closed the connection of agent %d\n", a);
+                return 1;
+            }
+        }
+        decided = 0;
+        for (int ap = 0; ap < num_aps; ap++) {
+            decided += ap_decided[ap];
+        }
+    }
+
+    printf("%d of %d aps got decisions after %ld ms (%u decisions, %u kicks)\n", decided, num_aps,
+           sim_ms_since(&start), decisions, kicks);
+    printf("%d of %d agents were echoed by the controller\n", agents_echoed, num_agents);
+
+    for (int a = 0; a < num_agents; a++) {
+        close(agents[a].fd);
+    }
+    free(fds);
+    free(agents);
+    return decided == num_aps && agents_echoed == num_agents ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "datastorage.h"
+#include "lbplanner.h"
+
+/*
+Measures the load balancing planner on generated tables.
+Every client is connected to one ap and hears it and the next aps of its ssid with a random signal,
+the aps of the first half get more clients, so there is something to balance.
+The tables are sized with PROBE_ARRAY_LEN, ARRAY_CLIENT_LEN and ARRAY_AP_LEN, see DAWN_BENCH in CMakeLists.txt.
+
+    dawn_bench_lbplanner [aps] [clients] [aps heard per client] [runs]
+*/
+
+static uint32_t bench_seed = 1;
+static int bench_moves;
+
+// deterministic, so runs can be compared
+static uint32_t bench_rand() {
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return (bench_seed >> 16) & 0x7fff;
+}
+
+static void bench_addr(uint8_t *addr, uint8_t prefix, int n) {
+    addr[0] = 0x02;
+    addr[1] = prefix;
+    addr[2] = 0;
+    addr[3] = (n >> 16) & 0xff;
+    addr[4] = (n >> 8) & 0xff;
+    addr[5] = n & 0xff;
+}
+
+static void bench_move(struct lb_move_s *move) {
+    bench_moves++;
+}
+
+static long bench_us_since(struct timespec *start) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+int main(int argc, char **argv) {
+    int num_aps = argc > 1 ? atoi(argv[1]) : ARRAY_AP_LEN;
+    int num_clients = argc > 2 ? atoi(argv[2]) : ARRAY_CLIENT_LEN;
+    int heard = argc > 3 ? atoi(argv[3]) : 3;
+    int runs = argc > 4 ? atoi(argv[4]) : 10;
+    long total_us = 0, max_us = 0;
+
+    if (num_aps < 1 || num_aps > ARRAY_AP_LEN || num_clients < 1 || num_clients > ARRAY_CLIENT_LEN ||
+        heard < 1 || heard > num_aps || (long) num_clients * heard > PROBE_ARRAY_LEN || runs < 1) {
+        fprintf(stderr, "Invalid arguments, the tables hold %d aps, %d clients and %d probes\n", ARRAY_AP_LEN,
+                ARRAY_CLIENT_LEN, PROBE_ARRAY_LEN);
+        return 2;
+    }
+
+    dawn_metric.rssi = 10;
+    dawn_metric.rssi_val = -60;
+    dawn_metric.low_rssi = -15;
+    dawn_metric.low_rssi_val = -80;
+    dawn_metric.max_chan_util_val = 255;
+    dawn_metric.max_station_diff = 1;
+    dawn_metric.lb_planner = 1;
+    dawn_metric.lb_min_gain = 1;
+    dawn_metric.min_kick_count = 1;
+
+    for (int a = 0; a < num_aps; a++) {
+        memset(&ap_array[a], 0, sizeof(ap));
+        bench_addr(ap_array[a].bssid_addr, 0, a);
+        strcpy((char *) ap_array[a].ssid, "bench");
+        ap_array[a].channel_utilization = bench_rand() % 200;
+        ap_array[a].time = time(0);
+    }
+    ap_entry_last = num_aps - 1;
+
+    client_entry_last = -1;
+    probe_entry_last = -1;
+    for (int c = 0; c < num_clients; c++) {
+        // the first half of the aps gets two thirds of the clients
+        int own = bench_rand() % 3 ? bench_rand() % ((num_aps + 1) / 2) : bench_rand() % num_aps;
+        client *entry = &client_array[++client_entry_last];
+
+        memset(entry, 0, sizeof(client));
+        bench_addr(entry->bssid_addr, 0, own);
+        bench_addr(entry->client_addr, 1, c);
+        entry->time = time(0);
+
+        for (int k = 0; k < heard; k++) {
+            probe_entry *probe = &probe_array[++probe_entry_last];
+
+            memset(probe, 0, sizeof(probe_entry));
+            bench_addr(probe->bssid_addr, 0, (own + k) % num_aps);
+            bench_addr(probe->client_addr, 1, c);
+            probe->signal = -50 - (int) (bench_rand() % 40);
+            probe->time = time(0);
+        }
+    }
+
+    for (int r = 0; r < runs; r++) {
+        struct timespec start;
+        long us;
+
+        bench_moves = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        lb_plan(bench_move);
+        us = bench_us_since(&start);
+        total_us += us;
+        if (us > max_us) {
+            max_us = us;
+        }
+    }
+
+    printf("%d aps, %d clients, %d probes: %d moves, %ld us per run (max %ld us) over %d runs\n", num_aps,
+           num_clients, probe_entry_last + 1, bench_moves, total_us / runs, max_us, runs);
+    return 0;
+}
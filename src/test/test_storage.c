@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <libubox/uloop.h>
+
+#include "datastorage.h"
+
+/*
+Checks the order of the client array and the kick evaluation in slices, which continues after the last
+evaluated client of an ap and relies on the array being sorted by bssid and by client within a bssid.
+
+    dawn_test_storage
+*/
+
+#define TEST_APS 5
+#define TEST_CLIENTS 40
+
+static int failed;
+
+static void test_check(int cond, const char *what, int i) {
+    if (!cond) {
+        printf("FAIL: %s (entry %d)\n", what, i);
+        failed++;
+    }
+}
+
+static void test_insert_client(int ap, int c) {
+    client entry;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.bssid_addr[0] = 0x02;
+    entry.bssid_addr[5] = ap;
+    entry.client_addr[0] = 0x02;
+    entry.client_addr[1] = 0x10;
+    entry.client_addr[4] = c & 0xff;
+    entry.client_addr[5] = (c * 37) & 0xff;
+    entry.time = time(0);
+    client_array_insert(entry);
+}
+
+// the clients are inserted in an order that is neither sorted by bssid nor by client
+static void test_client_order() {
+    int n = 0;
+
+    for (int i = 0; i < TEST_APS * TEST_CLIENTS; i++) {
+        int k = (i * 7919) % (TEST_APS * TEST_CLIENTS);
+
+        test_insert_client(k % TEST_APS, k / TEST_APS);
+        n++;
+    }
+    test_check(client_entry_last == n - 1, "all clients inserted", client_entry_last);
+
+    for (int i = 1; i <= client_entry_last; i++) {
+        int bssid_cmp = memcmp(client_array[i - 1].bssid_addr, client_array[i].bssid_addr, ETH_ALEN);
+
+        test_check(bssid_cmp <= 0, "sorted by bssid", i);
+        if (bssid_cmp == 0) {
+            test_check(memcmp(client_array[i - 1].client_addr, client_array[i].client_addr, ETH_ALEN) < 0,
+                       "sorted by client within a bssid", i);
+        }
+    }
+}
+
+static int test_visits[TEST_APS][TEST_CLIENTS];
+static int test_first_visit[TEST_APS];
+static int test_last_visit[TEST_APS];
+static int test_num_visits;
+
+// stands in for the evaluation of a client, the client number is in the fifth byte of its address
+static void test_evaluate(int j, uint8_t bssid[], uint32_t id) {
+    int ap = bssid[5];
+    int c = client_array[j].client_addr[4];
+
+    test_check(mac_is_equal(client_array[j].bssid_addr, bssid), "client of the evaluated ap", j);
+    test_check(id == (uint32_t) ap + 1, "ubus id of the job", j);
+    if (ap >= TEST_APS || c >= TEST_CLIENTS) {
+        return;
+    }
+    if (test_first_visit[ap] == 0) {
+        test_first_visit[ap] = test_num_visits + 1;
+    }
+    test_visits[ap][c]++;
+    test_last_visit[ap] = ++test_num_visits;
+}
+
+static void test_end_cb(struct uloop_timeout *t) {
+    uloop_end();
+}
+
+// runs the kick jobs of all aps in the uloop, every client is evaluated once and the jobs take turns
+static void test_kick_slices() {
+    struct uloop_timeout end = {.cb = test_end_cb};
+
+    kick_clients_set_evaluator(test_evaluate);
+    uloop_init();
+    for (int ap = 0; ap < TEST_APS; ap++) {
+        uint8_t bssid_addr[ETH_ALEN] = {0x02, 0, 0, 0, 0, ap};
+
+        kick_clients(bssid_addr, ap + 1);
+    }
+    uloop_timeout_set(&end, 500);
+    uloop_run();
+    uloop_done();
+    kick_clients_set_evaluator(NULL);
+
+    for (int ap = 0; ap < TEST_APS; ap++) {
+        for (int c = 0; c < TEST_CLIENTS; c++) {
+            test_check(test_visits[ap][c] == 1, "every client of the ap evaluated once", ap * TEST_CLIENTS + c);
+        }
+        // a slice is smaller than the clients of an ap, so the next ap starts before this one is done
+        if (ap > 0) {
+            test_check(test_first_visit[ap] < test_last_visit[ap - 1], "jobs of the aps interleaved", ap);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    test_client_order();
+    test_kick_slices();
+
+    if (failed) {
+        printf("%d checks failed\n", failed);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -270,47 +270,44 @@ int get_ssid(const char *ifname, char* ssid) {
     return 0;
 }
 
-int get_channel_utilization(const char *ifname, uint64_t *last_channel_time, uint64_t *last_channel_time_busy) {
+int get_channel_survey(const char *ifname, int *freq, uint64_t *active_time, uint64_t *busy_time) {
 
     int len;
     const struct iwinfo_ops *iw;
     char buf[IWINFO_BUFSIZE];
     struct iwinfo_survey_entry *e;
-    int ret = 0;
+    int ret = -1;
 
     iw = iwinfo_backend(ifname);
 
-    int freq;
-    if (iw->frequency(ifname, &freq))
+    if (iw == NULL || iw->frequency(ifname, freq))
     {
-        return 0;
+        iwinfo_finish();
+        return -1;
     }
 
     if (iw->survey(ifname, buf, &len))
     {
         fprintf(stderr, "Survey not possible!\n\n");
-        return 0;
+        iwinfo_finish();
+        return -1;
     }
     else if (len <= 0)
     {
         fprintf(stderr, "No survey results\n\n");
-        return 0;
+        iwinfo_finish();
+        return -1;
     }
 
-    for (int i = 0, x = 1; i < len; i += sizeof(struct iwinfo_survey_entry), x++)
+    for (int i = 0; i < len; i += sizeof(struct iwinfo_survey_entry))
     {
         e = (struct iwinfo_survey_entry *) &buf[i];
 
-        if(e->mhz == freq)
+        if(e->mhz == *freq)
         {
-            uint64_t dividend = e->busy_time - *last_channel_time_busy;
-            uint64_t divisor =  e->active_time - *last_channel_time;
-            *last_channel_time = e->active_time;
-            *last_channel_time_busy = e->busy_time;
-
-            if(divisor)
-                ret = (int)(dividend * 255 / divisor);
-
+            *active_time = e->active_time;
+            *busy_time = e->busy_time;
+            ret = 0;
             break;
         }
     }
@@ -319,6 +316,18 @@ int get_channel_utilization(const char *ifname, uint64_t *last_channel_time, uin
     return ret;
 }
 
+int get_phy_name(const char *ifname, char *phy) {
+    const struct iwinfo_ops *iw;
+    int ret = -1;
+
+    iw = iwinfo_backend(ifname);
+    if (iw != NULL && iw->phyname != NULL) {
+        ret = iw->phyname(ifname, phy) ? -1 : 0;
+    }
+    iwinfo_finish();
+    return ret;
+}
+
 int support_ht(const char *ifname) {
     const struct iwinfo_ops *iw;
 
@@ -3,6 +3,8 @@
 #include <datastorage.h>
 
 #include "dawn_uci.h"
+#include "overload.h"
+#include "tcpsocket.h"
 
 
 static struct uci_context *uci_ctx;
@@ -34,6 +36,33 @@ struct time_config_s uci_get_time_config() {
             ret.denied_req_threshold = uci_lookup_option_int(uci_ctx, s, "denied_req_threshold");
             ret.update_chan_util = uci_lookup_option_int(uci_ctx, s, "update_chan_util");
             ret.update_beacon_reports = uci_lookup_option_int(uci_ctx, s, "update_beacon_reports");
+            ret.heartbeat = uci_lookup_option_int(uci_ctx, s, "heartbeat");
+            ret.peer_timeout = uci_lookup_option_int(uci_ctx, s, "peer_timeout");
+            // heartbeats are optional, old configs don't have these options.
+            // the network config is read first, only tcp and hybrid get heartbeats by default
+            if (ret.heartbeat < 0)
+                ret.heartbeat = network_config.network_option == 2 || network_config.network_option == 3 ? 5 : 0;
+            if (ret.peer_timeout <= 0)
+                ret.peer_timeout = 3 * ret.heartbeat;
+            ret.overload_lag = uci_lookup_option_int(uci_ctx, s, "overload_lag");
+            ret.overload_queue = uci_lookup_option_int(uci_ctx, s, "overload_queue");
+            ret.overload_hold = uci_lookup_option_int(uci_ctx, s, "overload_hold");
+            if (ret.overload_lag < 0)
+                ret.overload_lag = 500;
+            // compared with the queue of the fullest connection, every mode must be reached before
+            // its queue is full and frames are dropped
+            if (ret.overload_queue < 0)
+                ret.overload_queue = 64;
+            if (ret.overload_queue * (__OVERLOAD_MAX - 1) > TCP_QUEUE_MAX_BYTES / 1024) {
+                fprintf(stderr, "overload_queue %d KB is too big for the tcp queues, using %d KB\n",
+                        (int) ret.overload_queue, TCP_QUEUE_MAX_BYTES / 1024 / (__OVERLOAD_MAX - 1));
+                ret.overload_queue = TCP_QUEUE_MAX_BYTES / 1024 / (__OVERLOAD_MAX - 1);
+            }
+            if (ret.overload_hold < 0)
+                ret.overload_hold = 10;
+            ret.beacon_req_gap = uci_lookup_option_int(uci_ctx, s, "beacon_req_gap");
+            if (ret.beacon_req_gap < 0)
+                ret.beacon_req_gap = 100;
             return ret;
         }
     }
@@ -82,6 +111,54 @@ struct probe_metric_s uci_get_dawn_metric() {
             ret.duration = uci_lookup_option_int(uci_ctx, s, "duration");
             ret.mode = uci_lookup_option_int(uci_ctx, s, "mode");
             ret.scan_channel = uci_lookup_option_int(uci_ctx, s, "scan_channel");
+            ret.probe_signal_delta = uci_lookup_option_int(uci_ctx, s, "probe_signal_delta");
+            ret.probe_rcpi_delta = uci_lookup_option_int(uci_ctx, s, "probe_rcpi_delta");
+            ret.probe_refresh = uci_lookup_option_int(uci_ctx, s, "probe_refresh");
+            // probe suppression is optional, old configs don't have these options
+            if (ret.probe_signal_delta < 0)
+                ret.probe_signal_delta = 3;
+            if (ret.probe_rcpi_delta < 0)
+                ret.probe_rcpi_delta = 6;
+            if (ret.probe_refresh < 0)
+                ret.probe_refresh = 10;
+            ret.ratelimit_rate = uci_lookup_option_int(uci_ctx, s, "ratelimit_rate");
+            ret.ratelimit_burst = uci_lookup_option_int(uci_ctx, s, "ratelimit_burst");
+            if (ret.ratelimit_rate < 0)
+                ret.ratelimit_rate = 10;
+            if (ret.ratelimit_burst <= 0)
+                ret.ratelimit_burst = 30;
+            ret.kick_budget = uci_lookup_option_int(uci_ctx, s, "kick_budget");
+            ret.kick_per_target = uci_lookup_option_int(uci_ctx, s, "kick_per_target");
+            if (ret.kick_budget <= 0)
+                ret.kick_budget = 4;
+            if (ret.kick_per_target < 0)
+                ret.kick_per_target = 2;
+            ret.lb_planner = uci_lookup_option_int(uci_ctx, s, "lb_planner");
+            ret.lb_capacity = uci_lookup_option_int(uci_ctx, s, "lb_capacity");
+            ret.lb_min_gain = uci_lookup_option_int(uci_ctx, s, "lb_min_gain");
+            if (ret.lb_planner < 0)
+                ret.lb_planner = 0;
+            if (ret.lb_capacity < 0)
+                ret.lb_capacity = 0;
+            if (ret.lb_min_gain <= 0)
+                ret.lb_min_gain = 1;
+            ret.roam_cooldown = uci_lookup_option_int(uci_ctx, s, "roam_cooldown");
+            ret.roam_hysteresis = uci_lookup_option_int(uci_ctx, s, "roam_hysteresis");
+            if (ret.roam_cooldown < 0)
+                ret.roam_cooldown = 120;
+            if (ret.roam_hysteresis < 0)
+                ret.roam_hysteresis = 10;
+            ret.bss_tm_candidates = uci_lookup_option_int(uci_ctx, s, "bss_tm_candidates");
+            if (ret.bss_tm_candidates <= 0)
+                ret.bss_tm_candidates = 3;
+            if (ret.bss_tm_candidates > BSS_TM_MAX_CANDIDATES)
+                ret.bss_tm_candidates = BSS_TM_MAX_CANDIDATES;
+            ret.nr_max_neighbors = uci_lookup_option_int(uci_ctx, s, "nr_max_neighbors");
+            ret.nr_min_heard = uci_lookup_option_int(uci_ctx, s, "nr_min_heard");
+            if (ret.nr_max_neighbors <= 0)
+                ret.nr_max_neighbors = 6;
+            if (ret.nr_min_heard < 0)
+                ret.nr_min_heard = 10;
             return ret;
         }
     }
@@ -108,6 +185,34 @@ struct network_config_s uci_get_dawn_network() {
             ret.use_symm_enc = uci_lookup_option_int(uci_ctx, s, "use_symm_enc");
             ret.collision_domain = uci_lookup_option_int(uci_ctx, s, "collision_domain");
             ret.bandwidth = uci_lookup_option_int(uci_ctx, s, "bandwidth");
+            ret.gossip_fanout = uci_lookup_option_int(uci_ctx, s, "gossip_fanout");
+            ret.gossip_ttl = uci_lookup_option_int(uci_ctx, s, "gossip_ttl");
+            ret.gossip_peers = uci_lookup_option_int(uci_ctx, s, "gossip_peers");
+            // gossip is optional, old configs don't have these options
+            if (ret.gossip_fanout < 0)
+                ret.gossip_fanout = 0;
+            if (ret.gossip_ttl <= 0)
+                ret.gossip_ttl = 8;
+            if (ret.gossip_peers <= 0)
+                ret.gossip_peers = 6;
+            ret.role = uci_lookup_option_int(uci_ctx, s, "role");
+            if (ret.role < 0)
+                ret.role = DAWN_ROLE_PEER;
+            ret.controller_ip = uci_lookup_option_string(uci_ctx, s, "controller_ip");
+            // agents and the controller talk over tcp connections, an agent needs to know the controller
+            if (ret.role != DAWN_ROLE_PEER && ret.network_option != 2 && ret.network_option != 3) {
+                fprintf(stderr, "role %d needs network_option 2 or 3, using role %d\n", ret.role, DAWN_ROLE_PEER);
+                ret.role = DAWN_ROLE_PEER;
+            } else if (ret.role == DAWN_ROLE_AGENT && ret.controller_ip == NULL) {
+                fprintf(stderr, "role %d needs a controller_ip, using role %d\n", ret.role, DAWN_ROLE_PEER);
+                ret.role = DAWN_ROLE_PEER;
+            } else if (ret.role > DAWN_ROLE_CONTROLLER) {
+                fprintf(stderr, "Unknown role %d, using role %d\n", ret.role, DAWN_ROLE_PEER);
+                ret.role = DAWN_ROLE_PEER;
+            }
+            ret.msg_max_age = uci_lookup_option_int(uci_ctx, s, "msg_max_age");
+            if (ret.msg_max_age < 0)
+                ret.msg_max_age = 0;
             return ret;
         }
     }
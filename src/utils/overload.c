@@ -0,0 +1,122 @@
+#include <libubox/blobmsg.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "overload.h"
+#include "datastorage.h"
+
+struct overload_transition_s {
+    time_t time;
+    enum overload_mode from;
+    enum overload_mode to;
+    uint32_t lag_ms;
+    int queue_bytes;
+};
+
+static enum overload_mode overload_mode = OVERLOAD_NONE;
+// last time the load demanded the current mode (or more)
+static time_t overload_demand_time;
+
+static uint32_t overload_lag_ms;
+static uint32_t overload_lag_max_ms;
+static int overload_queue_bytes;
+
+static uint32_t overload_entered[__OVERLOAD_MAX];
+static struct overload_transition_s overload_hist[OVERLOAD_HIST_LEN];
+static uint32_t overload_transitions;
+
+static const char *overload_mode_names[__OVERLOAD_MAX] = {
+        [OVERLOAD_NONE] = "none",
+        [OVERLOAD_SKIP_SCORING] = "skip_scoring",
+        [OVERLOAD_DROP_PEER] = "drop_peer",
+        [OVERLOAD_DEFER_KICKS] = "defer_kicks",
+};
+
+static void overload_set_mode(enum overload_mode mode);
+
+static void overload_set_mode(enum overload_mode mode) {
+    struct overload_transition_s *t = &overload_hist[overload_transitions % OVERLOAD_HIST_LEN];
+
+    printf("Overload mode %s -> %s (lag %u ms, queued %d bytes)\n", overload_mode_names[overload_mode],
+           overload_mode_names[mode], overload_lag_ms, overload_queue_bytes);
+
+    t->time = time(0);
+    t->from = overload_mode;
+    t->to = mode;
+    t->lag_ms = overload_lag_ms;
+    t->queue_bytes = overload_queue_bytes;
+    overload_transitions++;
+    overload_entered[mode]++;
+    overload_mode = mode;
+}
+
+enum overload_mode overload_get_mode() {
+    return overload_mode;
+}
+
+void overload_sample(uint32_t lag_ms, int queue_bytes) {
+    int level = 0;
+
+    overload_lag_ms = lag_ms;
+    overload_queue_bytes = queue_bytes;
+    if (lag_ms > overload_lag_max_ms) {
+        overload_lag_max_ms = lag_ms;
+    }
+
+    if (timeout_config.overload_lag > 0) {
+        level = lag_ms / timeout_config.overload_lag;
+    }
+    if (timeout_config.overload_queue > 0 && queue_bytes / (timeout_config.overload_queue * 1024) > level) {
+        level = queue_bytes / (timeout_config.overload_queue * 1024);
+    }
+    if (level >= __OVERLOAD_MAX) {
+        level = __OVERLOAD_MAX - 1;
+    }
+
+    if (level >= overload_mode) {
+        overload_demand_time = time(0);
+        if (level > overload_mode) {
+            overload_set_mode(level);
+        }
+        return;
+    }
+
+    // step down one mode at a time, so a short calm phase doesn't drop all protection
+    if (time(0) - overload_demand_time >= timeout_config.overload_hold) {
+        overload_demand_time = time(0);
+        overload_set_mode(overload_mode - 1);
+    }
+}
+
+int build_overload_overview(struct blob_buf *b) {
+    void *table, *list, *entry;
+    uint32_t first;
+
+    blob_buf_init(b, 0);
+    blobmsg_add_string(b, "mode", overload_mode_names[overload_mode]);
+    blobmsg_add_u32(b, "lag_ms", overload_lag_ms);
+    blobmsg_add_u32(b, "lag_max_ms", overload_lag_max_ms);
+    blobmsg_add_u32(b, "queued_bytes", overload_queue_bytes);
+
+    table = blobmsg_open_table(b, "entered");
+    for (int i = 0; i < __OVERLOAD_MAX; i++) {
+        blobmsg_add_u32(b, overload_mode_names[i], overload_entered[i]);
+    }
+    blobmsg_close_table(b, table);
+
+    first = overload_transitions > OVERLOAD_HIST_LEN ? overload_transitions - OVERLOAD_HIST_LEN : 0;
+    list = blobmsg_open_array(b, "transitions");
+    for (uint32_t i = first; i < overload_transitions; i++) {
+        struct overload_transition_s *t = &overload_hist[i % OVERLOAD_HIST_LEN];
+
+        entry = blobmsg_open_table(b, NULL);
+        blobmsg_add_u32(b, "age", time(0) - t->time);
+        blobmsg_add_string(b, "from", overload_mode_names[t->from]);
+        blobmsg_add_string(b, "to", overload_mode_names[t->to]);
+        blobmsg_add_u32(b, "lag_ms", t->lag_ms);
+        blobmsg_add_u32(b, "queued_bytes", t->queue_bytes);
+        blobmsg_close_table(b, entry);
+    }
+    blobmsg_close_array(b, list);
+    return 0;
+}
@@ -0,0 +1,262 @@
+#include <libubox/blobmsg.h>
+#include <string.h>
+#include <time.h>
+
+#include "ratelimit.h"
+#include "ubus.h"
+#include "utils.h"
+
+// tokens are counted in thousandths, so slow rates refill smoothly
+#define RATELIMIT_TOKEN 1000
+
+struct ratelimit_verdict_s {
+    uint8_t bssid_addr[ETH_ALEN];
+    int status;
+    int valid;
+};
+
+struct ratelimit_client_s {
+    uint8_t client_addr[ETH_ALEN];
+    // a probe storm must not use up the tokens of the authentication and association
+    uint32_t tokens[RATELIMIT_NUM_EVENTS];
+    uint64_t refill_ms[RATELIMIT_NUM_EVENTS];
+    uint64_t active_ms;
+
+    uint32_t events[RATELIMIT_NUM_EVENTS];
+    uint32_t limited[RATELIMIT_NUM_EVENTS];
+    struct ratelimit_verdict_s verdicts[RATELIMIT_NUM_EVENTS];
+
+    // newest probe of the limited client, processed with the next flush
+    int pending;
+    uint32_t pending_count;
+    probe_entry pending_probe;
+};
+
+struct ratelimit_top_s {
+    uint8_t client_addr[ETH_ALEN];
+    uint32_t count;
+    // the count may be overestimated by this much (inherited from the replaced client)
+    uint32_t error;
+};
+
+static struct ratelimit_client_s ratelimit_table[RATELIMIT_TABLE_LEN];
+static int ratelimit_last = -1;
+
+static struct ratelimit_top_s ratelimit_top[RATELIMIT_TOP_LEN];
+static int ratelimit_top_last = -1;
+static time_t ratelimit_decay_time;
+
+static uint32_t ratelimit_total_limited[RATELIMIT_NUM_EVENTS];
+static uint32_t ratelimit_total_aggregated;
+
+static const char *ratelimit_event_names[RATELIMIT_NUM_EVENTS] = {
+        [RATELIMIT_PROBE] = "probe",
+        [RATELIMIT_AUTH] = "auth",
+        [RATELIMIT_ASSOC] = "assoc",
+};
+
+static uint64_t ratelimit_now_ms();
+
+static struct ratelimit_client_s *ratelimit_get(uint8_t *client_addr, int create);
+
+static void ratelimit_top_add(uint8_t *client_addr);
+
+static uint64_t ratelimit_now_ms() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static struct ratelimit_client_s *ratelimit_get(uint8_t *client_addr, int create) {
+    int oldest = 0;
+
+    for (int i = 0; i <= ratelimit_last; i++) {
+        if (mac_is_equal(ratelimit_table[i].client_addr, client_addr)) {
+            return &ratelimit_table[i];
+        }
+        if (ratelimit_table[i].active_ms < ratelimit_table[oldest].active_ms) {
+            oldest = i;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    // table is full, replace the client that was quiet for the longest time
+    int idx = ratelimit_last < RATELIMIT_TABLE_LEN - 1 ? ++ratelimit_last : oldest;
+    memset(&ratelimit_table[idx], 0, sizeof(struct ratelimit_client_s));
+    memcpy(ratelimit_table[idx].client_addr, client_addr, ETH_ALEN);
+    for (int i = 0; i < RATELIMIT_NUM_EVENTS; i++) {
+        ratelimit_table[idx].tokens[i] = dawn_metric.ratelimit_burst * RATELIMIT_TOKEN;
+        ratelimit_table[idx].refill_ms[i] = ratelimit_now_ms();
+    }
+    return &ratelimit_table[idx];
+}
+
+static void ratelimit_top_add(uint8_t *client_addr) {
+    int min = 0;
+
+    for (int i = 0; i <= ratelimit_top_last; i++) {
+        if (mac_is_equal(ratelimit_top[i].client_addr, client_addr)) {
+            ratelimit_top[i].count++;
+            return;
+        }
+        if (ratelimit_top[i].count < ratelimit_top[min].count) {
+            min = i;
+        }
+    }
+
+    if (ratelimit_top_last < RATELIMIT_TOP_LEN - 1) {
+        ratelimit_top_last++;
+        memcpy(ratelimit_top[ratelimit_top_last].client_addr, client_addr, ETH_ALEN);
+        ratelimit_top[ratelimit_top_last].count = 1;
+        ratelimit_top[ratelimit_top_last].error = 0;
+        return;
+    }
+
+    // space saving: the new client takes over the smallest counter
+    memcpy(ratelimit_top[min].client_addr, client_addr, ETH_ALEN);
+    ratelimit_top[min].error = ratelimit_top[min].count;
+    ratelimit_top[min].count++;
+}
+
+int ratelimit_event(uint8_t *client_addr, enum ratelimit_event event) {
+    if (dawn_metric.ratelimit_rate <= 0) {
+        return 1;
+    }
+
+    struct ratelimit_client_s *client = ratelimit_get(client_addr, 1);
+    uint64_t now = ratelimit_now_ms();
+    uint64_t tokens = client->tokens[event] + (now - client->refill_ms[event]) * dawn_metric.ratelimit_rate;
+    uint64_t max = (uint64_t) dawn_metric.ratelimit_burst * RATELIMIT_TOKEN;
+
+    client->refill_ms[event] = now;
+    client->active_ms = now;
+    client->tokens[event] = tokens > max ? max : tokens;
+    client->events[event]++;
+
+    if (client->tokens[event] >= RATELIMIT_TOKEN) {
+        client->tokens[event] -= RATELIMIT_TOKEN;
+        return 1;
+    }
+
+    client->limited[event]++;
+    ratelimit_total_limited[event]++;
+    ratelimit_top_add(client_addr);
+    return 0;
+}
+
+void ratelimit_set_verdict(uint8_t *client_addr, uint8_t *bssid_addr, enum ratelimit_event event, int status) {
+    struct ratelimit_client_s *client = ratelimit_get(client_addr, 0);
+
+    if (client == NULL) {
+        return;
+    }
+    memcpy(client->verdicts[event].bssid_addr, bssid_addr, ETH_ALEN);
+    client->verdicts[event].status = status;
+    client->verdicts[event].valid = 1;
+}
+
+int ratelimit_get_verdict(uint8_t *client_addr, uint8_t *bssid_addr, enum ratelimit_event event, int fallback) {
+    struct ratelimit_client_s *client = ratelimit_get(client_addr, 0);
+
+    if (client == NULL || !client->verdicts[event].valid ||
+        !mac_is_equal(client->verdicts[event].bssid_addr, bssid_addr)) {
+        return fallback;
+    }
+    return client->verdicts[event].status;
+}
+
+void ratelimit_defer_probe(probe_entry entry) {
+    struct ratelimit_client_s *client = ratelimit_get(entry.client_addr, 0);
+
+    if (client == NULL) {
+        return;
+    }
+
+    // a probe for another ap is not aggregated, the pending one is for the ap the client is hammering
+    if (client->pending && !mac_is_equal(client->pending_probe.bssid_addr, entry.bssid_addr)) {
+        return;
+    }
+    client->pending_probe = entry;
+    client->pending_count++;
+    client->pending = 1;
+}
+
+void ratelimit_flush(void (*cb)(probe_entry entry, uint32_t count)) {
+    for (int i = 0; i <= ratelimit_last; i++) {
+        if (!ratelimit_table[i].pending) {
+            continue;
+        }
+        ratelimit_table[i].pending = 0;
+        ratelimit_total_aggregated += ratelimit_table[i].pending_count;
+        cb(ratelimit_table[i].pending_probe, ratelimit_table[i].pending_count);
+        ratelimit_table[i].pending_count = 0;
+    }
+
+    if (time(0) - ratelimit_decay_time < RATELIMIT_DECAY_PERIOD) {
+        return;
+    }
+    ratelimit_decay_time = time(0);
+
+    // halve the counts and drop the clients that went quiet
+    int j = 0;
+    for (int i = 0; i <= ratelimit_top_last; i++) {
+        ratelimit_top[i].count /= 2;
+        ratelimit_top[i].error /= 2;
+        if (ratelimit_top[i].count > 0) {
+            ratelimit_top[j++] = ratelimit_top[i];
+        }
+    }
+    ratelimit_top_last = j - 1;
+}
+
+int build_ratelimit_overview(struct blob_buf *b) {
+    void *table, *list, *entry;
+    int order[RATELIMIT_TOP_LEN];
+
+    blob_buf_init(b, 0);
+    blobmsg_add_u32(b, "rate", dawn_metric.ratelimit_rate);
+    blobmsg_add_u32(b, "burst", dawn_metric.ratelimit_burst);
+    blobmsg_add_u32(b, "clients", ratelimit_last + 1);
+    blobmsg_add_u32(b, "aggregated_probes", ratelimit_total_aggregated);
+
+    table = blobmsg_open_table(b, "limited");
+    for (int i = 0; i < RATELIMIT_NUM_EVENTS; i++) {
+        blobmsg_add_u32(b, ratelimit_event_names[i], ratelimit_total_limited[i]);
+    }
+    blobmsg_close_table(b, table);
+
+    // sort the heavy hitters by count, the sketch is small
+    for (int i = 0; i <= ratelimit_top_last; i++) {
+        int j = i;
+        while (j > 0 && ratelimit_top[order[j - 1]].count < ratelimit_top[i].count) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    list = blobmsg_open_array(b, "top");
+    for (int i = 0; i <= ratelimit_top_last; i++) {
+        struct ratelimit_top_s *top = &ratelimit_top[order[i]];
+        struct ratelimit_client_s *client = ratelimit_get(top->client_addr, 0);
+
+        entry = blobmsg_open_table(b, NULL);
+        blobmsg_add_macaddr(b, "client", top->client_addr);
+        blobmsg_add_u32(b, "count", top->count);
+        blobmsg_add_u32(b, "error", top->error);
+        if (client != NULL) {
+            table = blobmsg_open_table(b, "events");
+            for (int k = 0; k < RATELIMIT_NUM_EVENTS; k++) {
+                blobmsg_add_u32(b, ratelimit_event_names[k], client->events[k]);
+            }
+            blobmsg_close_table(b, table);
+        }
+        blobmsg_close_table(b, entry);
+    }
+    blobmsg_close_array(b, list);
+    return 0;
+}
@@ -22,6 +22,15 @@
 #include "dawn_iwinfo.h"
 #include "datastorage.h"
 #include "tcpsocket.h"
+#include "gossip.h"
+#include "controller.h"
+#include "peer.h"
+#include "crypto.h"
+#include "ratelimit.h"
+#include "overload.h"
+#include "lbplanner.h"
+#include "nrstore.h"
+#include "history.h"
 
 static struct ubus_context *ctx = NULL;
 
@@ -34,8 +43,30 @@ static struct blob_buf b_domain;
 static struct blob_buf b_notify;
 static struct blob_buf b_clients;
 static struct blob_buf b_umdns;
+
+// discovery runs asynchronously: update, then browse
+static struct ubus_request umdns_update_req;
+static struct ubus_request umdns_browse_req;
+static uint32_t umdns_id;
+// request in flight, NULL if none
+static struct ubus_request *umdns_active_req;
+static time_t umdns_request_time;
 static struct blob_buf b_beacon;
 static struct blob_buf b_nr;
+static struct blob_buf b_control;
+static struct blob_buf b_clients_delta;
+static struct blob_buf b_sync;
+static struct blob_buf b_sync_entry;
+
+// BSS transition requests that were not answered yet
+#define WNM_MAX_PENDING 16
+
+// Radios whose channel survey is sampled, the vaps of a radio share it.
+#define CHAN_SURVEY_MAX_RADIOS 8
+// The average utilization is kept in 1/CHAN_UTIL_FRAC steps, so small changes aren't rounded away.
+#define CHAN_UTIL_FRAC 256
+static struct ubus_request wnm_reqs[WNM_MAX_PENDING];
+static int wnm_reqs_used[WNM_MAX_PENDING];
 
 void update_clients(struct uloop_timeout *t);
 
@@ -47,6 +78,14 @@ void run_server_update(struct uloop_timeout *t);
 
 void update_beacon_reports(struct uloop_timeout *t);
 
+void update_heartbeat(struct uloop_timeout *t);
+
+void update_sync(struct uloop_timeout *t);
+
+void update_ratelimit(struct uloop_timeout *t);
+
+void update_overload(struct uloop_timeout *t);
+
 struct uloop_timeout client_timer = {
         .cb = update_clients
 };
@@ -68,9 +107,102 @@ struct uloop_timeout beacon_reports_timer = {
         .cb = update_beacon_reports
 };
 
+static void beacon_req_cb(struct uloop_timeout *t);
+
+static struct uloop_timeout beacon_req_timer = {
+        .cb = beacon_req_cb
+};
+
+// beacon requests of the current period, sent one by one
+struct beacon_req_s {
+    uint8_t bssid_addr[ETH_ALEN];
+    uint8_t client_addr[ETH_ALEN];
+    uint32_t id;
+};
+
+static struct beacon_req_s beacon_reqs[ARRAY_CLIENT_LEN];
+static int beacon_req_len;
+static int beacon_req_next;
+static uint32_t beacon_req_gap_ms;
+
+struct beacon_stats_s {
+    uint32_t requests;
+    uint32_t skipped;
+    uint32_t reports;
+    uint32_t new_entries;
+    uint32_t dropped;
+};
+
+static struct beacon_stats_s beacon_stats;
+
+struct uloop_timeout heartbeat_timer = {
+        .cb = update_heartbeat
+};
+
+struct uloop_timeout sync_timer = {
+        .cb = update_sync
+};
+
+struct uloop_timeout ratelimit_timer = {
+        .cb = update_ratelimit
+};
+
+struct uloop_timeout overload_timer = {
+        .cb = update_overload
+};
+
+// when the overload timer should have fired
+static struct timespec overload_due;
+
 #define MAX_HOSTAPD_SOCKETS 10
 #define MAX_INTERFACE_NAME 64
 
+// A full clients table is sent at least every n updates, deltas in between.
+#define CLIENTS_FULL_INTERVAL 10
+
+// State snapshots for joining nodes are sent in chunks of this many entries.
+#define SYNC_CHUNK_LEN 32
+#define SYNC_CHUNK_INTERVAL 20
+// Chunks are only queued while the peer has less than this pending.
+#define SYNC_QUEUE_LIMIT (TCP_QUEUE_MAX_BYTES / 4)
+#define SYNC_MAX_JOBS 4
+// A node asks for a snapshot during this many seconds after its start.
+#define SYNC_JOIN_PERIOD 120
+// Seconds to wait for a snapshot before asking the next peer.
+#define SYNC_TIMEOUT 30
+
+struct sync_job_s {
+    uint32_t con_id;
+    time_t max_age;
+    int ap_pos;
+    int probe_pos;
+};
+
+static struct sync_job_s sync_jobs[SYNC_MAX_JOBS];
+
+// state of the own snapshot request
+static time_t sync_start_time;
+static uint32_t sync_con_id;
+static time_t sync_request_time;
+static int sync_done;
+static int sync_num_aps;
+static int sync_num_probes;
+
+struct client_digest_s {
+    uint8_t client_addr[ETH_ALEN];
+    uint32_t hash;
+};
+
+// last clients update received for an ap of another node
+struct clients_seq_s {
+    uint8_t bssid_addr[ETH_ALEN];
+    uint32_t seq;
+    time_t resync_time;
+};
+
+static struct clients_seq_s clients_seq_array[ARRAY_AP_LEN];
+static int clients_seq_last = -1;
+
 LIST_HEAD(hostapd_sock_list);
 
 struct hostapd_sock_entry {
@@ -82,35 +214,71 @@ struct hostapd_sock_entry {
     char ssid[SSID_MAX_LEN];
     uint8_t ht_support;
     uint8_t vht_support;
-    uint64_t last_channel_time;
-    uint64_t last_channel_time_busy;
-    int chan_util_samples_sum;
-    int chan_util_num_sample_periods;
+    uint32_t freq;
+    // radio of the interface, the channel utilization is measured per radio
+    char phy_name[MAX_INTERFACE_NAME];
     int chan_util_average;
 
-    // add neighbor report string
-    /*
-    [Elemen ID|1][LENGTH|1][BSSID|6][BSSID INFORMATION|4][Operating Class|1][Channel Number|1][PHY Type|1][Operational Subelements]
-    */
-    char neighbor_report[NEIGHBOR_REPORT_LEN];
+
+    // state of the last clients update that was sent, the next one only carries the changes
+    uint32_t clients_seq;
+    int clients_since_full;
+    int clients_full_requested;
+    int num_client_digests;
+    struct client_digest_s *client_digests;
+    // the neighbor report is only sent along when it changed
+    uint32_t sent_nr_hash;
+
+    // neighbor list that was set in hostapd
+    uint32_t nr_hash;
+    int nr_count;
+    uint32_t nr_pushes;
+    uint32_t nr_skipped;
 
     struct ubus_subscriber subscriber;
     struct ubus_event_handler wait_handler;
     bool subscribed;
 };
 
+// survey counters of a radio, sampled once per update for all of its vaps
+struct chan_survey_s {
+    char phy_name[MAX_INTERFACE_NAME];
+    int freq;
+    uint64_t last_active_time;
+    uint64_t last_busy_time;
+    // in 1/CHAN_UTIL_FRAC
+    int64_t average;
+    uint32_t samples;
+    int sampled;
+};
+
+static struct chan_survey_s chan_surveys[CHAN_SURVEY_MAX_RADIOS];
+static int num_chan_surveys;
+
 struct hostapd_sock_entry* hostapd_sock_arr[MAX_HOSTAPD_SOCKETS];
 int hostapd_sock_last = -1;
 
 enum {
     NETWORK_METHOD,
     NETWORK_DATA,
+    NETWORK_NODE,
+    NETWORK_SEQ,
+    NETWORK_ALL_SEQ,
+    NETWORK_HOPS,
+    NETWORK_TS,
+    NETWORK_TS_MS,
     __NETWORK_MAX,
 };
 
 static const struct blobmsg_policy network_policy[__NETWORK_MAX] = {
         [NETWORK_METHOD] = {.name = "method", .type = BLOBMSG_TYPE_STRING},
         [NETWORK_DATA] = {.name = "data", .type = BLOBMSG_TYPE_STRING},
+        [NETWORK_NODE] = {.name = "node", .type = BLOBMSG_TYPE_INT32},
+        [NETWORK_SEQ] = {.name = "seq", .type = BLOBMSG_TYPE_INT32},
+        [NETWORK_ALL_SEQ] = {.name = "all_seq", .type = BLOBMSG_TYPE_INT32},
+        [NETWORK_HOPS] = {.name = "hops", .type = BLOBMSG_TYPE_INT32},
+        [NETWORK_TS] = {.name = "ts", .type = BLOBMSG_TYPE_INT32},
+        [NETWORK_TS_MS] = {.name = "ts_ms", .type = BLOBMSG_TYPE_INT32},
 };
 
 enum {
@@ -209,6 +377,9 @@ enum {
     CLIENT_TABLE_WEIGHT,
     CLIENT_TABLE_NEIGHBOR,
     CLIENT_TABLE_RRM,
+    CLIENT_TABLE_SEQ,
+    CLIENT_TABLE_REMOVED,
+    CLIENT_TABLE_UNCHANGED,
     __CLIENT_TABLE_MAX,
 };
 
@@ -226,6 +397,9 @@ static const struct blobmsg_policy client_table_policy[__CLIENT_TABLE_MAX] = {
         [CLIENT_TABLE_WEIGHT] = {.name = "ap_weight", .type = BLOBMSG_TYPE_INT32},
         [CLIENT_TABLE_NEIGHBOR] = {.name = "neighbor_report", .type = BLOBMSG_TYPE_STRING},
         [CLIENT_TABLE_RRM] = {.name = "rrm", .type = BLOBMSG_TYPE_ARRAY},
+        [CLIENT_TABLE_SEQ] = {.name = "clients_seq", .type = BLOBMSG_TYPE_INT32},
+        [CLIENT_TABLE_REMOVED] = {.name = "removed", .type = BLOBMSG_TYPE_ARRAY},
+        [CLIENT_TABLE_UNCHANGED] = {.name = "unchanged", .type = BLOBMSG_TYPE_ARRAY},
 };
 
 enum {
@@ -259,6 +433,94 @@ static const struct blobmsg_policy client_policy[__CLIENT_MAX] = {
         [CLIENT_AID] = {.name = "aid", .type = BLOBMSG_TYPE_INT32},
 };
 
+enum {
+    CONTROL_BSSID_ADDR,
+    CONTROL_CLIENT_ADDR,
+    CONTROL_ALLOW,
+    CONTROL_NEIGHBOR,
+    CONTROL_DEAUTH,
+    __CONTROL_MAX,
+};
+
+static const struct blobmsg_policy control_policy[__CONTROL_MAX] = {
+        [CONTROL_BSSID_ADDR] = {.name = "bssid", .type = BLOBMSG_TYPE_STRING},
+        [CONTROL_CLIENT_ADDR] = {.name = "address", .type = BLOBMSG_TYPE_STRING},
+        [CONTROL_ALLOW] = {.name = "allow", .type = BLOBMSG_TYPE_INT32},
+        [CONTROL_NEIGHBOR] = {.name = "neighbor_report", .type = BLOBMSG_TYPE_STRING},
+        [CONTROL_DEAUTH] = {.name = "deauth", .type = BLOBMSG_TYPE_INT8},
+};
+
+enum {
+    NETWORK_MSG_SSID,
+    __NETWORK_MSG_MAX,
+};
+
+static const struct blobmsg_policy network_msg_policy[__NETWORK_MSG_MAX] = {
+        [NETWORK_MSG_SSID] = {.name = "ssid", .type = BLOBMSG_TYPE_STRING},
+};
+
+enum {
+    INTEREST_SSIDS,
+    INTEREST_PORT,
+    __INTEREST_MAX,
+};
+
+static const struct blobmsg_policy interest_policy[__INTEREST_MAX] = {
+        [INTEREST_SSIDS] = {.name = "ssids", .type = BLOBMSG_TYPE_TABLE},
+        [INTEREST_PORT] = {.name = "port", .type = BLOBMSG_TYPE_INT32},
+};
+
+enum {
+    HEARTBEAT_SEQ,
+    HEARTBEAT_BSSIDS,
+    HEARTBEAT_ECHO,
+    __HEARTBEAT_MAX,
+};
+
+static const struct blobmsg_policy heartbeat_policy[__HEARTBEAT_MAX] = {
+        [HEARTBEAT_SEQ] = {.name = "hb_seq", .type = BLOBMSG_TYPE_INT32},
+        [HEARTBEAT_BSSIDS] = {.name = "bssids", .type = BLOBMSG_TYPE_ARRAY},
+        [HEARTBEAT_ECHO] = {.name = "echo", .type = BLOBMSG_TYPE_TABLE},
+};
+
+enum {
+    HEARTBEAT_ECHO_SEQ,
+    HEARTBEAT_ECHO_HELD,
+    __HEARTBEAT_ECHO_MAX,
+};
+
+static const struct blobmsg_policy heartbeat_echo_policy[__HEARTBEAT_ECHO_MAX] = {
+        [HEARTBEAT_ECHO_SEQ] = {.name = "seq", .type = BLOBMSG_TYPE_INT32},
+        [HEARTBEAT_ECHO_HELD] = {.name = "held", .type = BLOBMSG_TYPE_INT32},
+};
+
+enum {
+    SYNC_MAX_AGE,
+    SYNC_APS,
+    SYNC_PROBES,
+    SYNC_LAST,
+    __SYNC_MAX,
+};
+
+static const struct blobmsg_policy sync_policy[__SYNC_MAX] = {
+        [SYNC_MAX_AGE] = {.name = "max_age", .type = BLOBMSG_TYPE_INT32},
+        [SYNC_APS] = {.name = "aps", .type = BLOBMSG_TYPE_ARRAY},
+        [SYNC_PROBES] = {.name = "probes", .type = BLOBMSG_TYPE_ARRAY},
+        [SYNC_LAST] = {.name = "last", .type = BLOBMSG_TYPE_INT8},
+};
+
+// probes of a snapshot use the probe message format plus these
+enum {
+    SYNC_ENTRY_AGE,
+    SYNC_ENTRY_COUNTER,
+    __SYNC_ENTRY_MAX,
+};
+
+static const struct blobmsg_policy sync_entry_policy[__SYNC_ENTRY_MAX] = {
+        [SYNC_ENTRY_AGE] = {.name = "age", .type = BLOBMSG_TYPE_INT32},
+        [SYNC_ENTRY_COUNTER] = {.name = "counter", .type = BLOBMSG_TYPE_INT32},
+};
+
 enum {
     DAWN_UMDNS_TABLE,
     __DAWN_UMDNS_TABLE_MAX,
@@ -312,8 +574,104 @@ static int get_network(struct ubus_context *ctx, struct ubus_object *obj,
                        struct ubus_request_data *req, const char *method,
                        struct blob_attr *msg);
 
+static int get_tcp_peers(struct ubus_context *ctx, struct ubus_object *obj,
+                         struct ubus_request_data *req, const char *method,
+                         struct blob_attr *msg);
+
+static int get_gossip(struct ubus_context *ctx, struct ubus_object *obj,
+                      struct ubus_request_data *req, const char *method,
+                      struct blob_attr *msg);
+
+static int get_probe_stats(struct ubus_context *ctx, struct ubus_object *obj,
+                           struct ubus_request_data *req, const char *method,
+                           struct blob_attr *msg);
+
+static int get_rate_limit(struct ubus_context *ctx, struct ubus_object *obj,
+                          struct ubus_request_data *req, const char *method,
+                          struct blob_attr *msg);
+
+static int get_overload(struct ubus_context *ctx, struct ubus_object *obj,
+                        struct ubus_request_data *req, const char *method,
+                        struct blob_attr *msg);
+
+static int get_kick_plan(struct ubus_context *ctx, struct ubus_object *obj,
+                         struct ubus_request_data *req, const char *method,
+                         struct blob_attr *msg);
+
+static int get_lb_plan(struct ubus_context *ctx, struct ubus_object *obj,
+                       struct ubus_request_data *req, const char *method,
+                       struct blob_attr *msg);
+
+static int get_beacon_reports(struct ubus_context *ctx, struct ubus_object *obj,
+                              struct ubus_request_data *req, const char *method,
+                              struct blob_attr *msg);
+
+static int get_neighbor_reports(struct ubus_context *ctx, struct ubus_object *obj,
+                                struct ubus_request_data *req, const char *method,
+                                struct blob_attr *msg);
+
+static int get_history(struct ubus_context *ctx, struct ubus_object *obj,
+                       struct ubus_request_data *req, const char *method,
+                       struct blob_attr *msg);
+
+static int build_beacon_overview(struct blob_buf *b);
+
 static int handle_set_probe(struct blob_attr *msg);
 
+static void relay_network_msg(struct blob_attr **tb, struct blob_attr *data);
+
+static void controller_push_decisions(uint8_t *client_addr);
+
+static void controller_owner_from_clients(struct blob_attr *msg);
+
+static int handle_decision(struct blob_attr *msg);
+
+static int handle_kick(struct blob_attr *msg);
+
+static int send_blob_attr_via_network_to(uint32_t con_id, struct blob_attr *msg, char *method);
+
+static int handle_interest(struct blob_attr **tb, struct blob_attr *msg);
+
+static enum tcp_prio network_msg_prio(const char *method);
+
+static int handle_heartbeat(struct blob_attr **tb, struct blob_attr *msg);
+
+static int handle_sync_request(struct blob_attr **tb, struct blob_attr *msg);
+
+static int handle_sync(struct blob_attr *msg);
+
+static int send_sync_chunk(struct sync_job_s *job);
+
+static int network_msg_relayed(const char *method);
+
+static int network_msg_datagram(const char *method, const char *str);
+
+static void send_heartbeat();
+
+static const char *network_msg_ssid(struct blob_attr *msg);
+
+static int serves_ssid(const char *ssid);
+
+static int bssid_to_ssid(uint8_t *bssid_addr, char *ssid);
+
+static int get_peers(struct ubus_context *ctx, struct ubus_object *obj,
+                     struct ubus_request_data *req, const char *method,
+                     struct blob_attr *msg);
+
+static void send_clients_via_network(struct hostapd_sock_entry *entry, struct blob_buf *buf);
+
+static int handle_clients_seq(struct blob_attr *msg, int delta);
+
+static int handle_clients_resync(struct blob_attr *msg);
+
+static int parse_to_clients_delta(struct blob_attr *msg, int do_kick);
+
+static int parse_to_clients_table(struct blob_attr *msg, int do_kick, uint32_t id, int full);
+
+static int clients_addrs(struct blob_attr *list, int is_table, uint8_t (*addrs)[ETH_ALEN], int n, int max);
+
+static int clients_count(struct blob_attr *list);
+
 static int parse_add_mac_to_file(struct blob_attr *msg);
 
 static void ubus_add_oject();
@@ -354,6 +712,16 @@ static int decide_function(probe_entry *prob_req, int req_type) {
         return 1;
     }
 
+    // the controller knows all aps, use its decision if there is one
+    if (network_config.role == DAWN_ROLE_AGENT) {
+        uint8_t flag = req_type == REQ_TYPE_PROBE ? DECISION_ALLOW_PROBE :
+                       req_type == REQ_TYPE_AUTH ? DECISION_ALLOW_AUTH : DECISION_ALLOW_ASSOC;
+        int allow = decision_cache_get(prob_req->bssid_addr, prob_req->client_addr, flag);
+        if (allow >= 0) {
+            return allow;
+        }
+    }
+
     if (prob_req->counter < dawn_metric.min_probe_count) {
         return 0;
     }
@@ -501,39 +869,58 @@ int parse_to_beacon_rep(struct blob_attr *msg, probe_entry *beacon_rep) {
     if (hwaddr_aton(blobmsg_data(tb[BEACON_REP_ADDR]), beacon_rep->client_addr))
         return UBUS_STATUS_INVALID_ARGUMENT;
 
-    int rcpi = 0;
-    int rsni = 0;
-    rcpi = blobmsg_get_u16(tb[BEACON_REP_RCPI]);
-    rsni = blobmsg_get_u16(tb[BEACON_REP_RSNI]);
+    if (!tb[BEACON_REP_RCPI] || !tb[BEACON_REP_RSNI])
+        return -1;
 
+    // 255: the client couldn't measure it
+    if (blobmsg_get_u16(tb[BEACON_REP_RCPI]) == 255)
+        return -1;
 
-    // HACKY WORKAROUND!
-    printf("Try update RCPI and RSNI for beacon report!\n");
-    if(!probe_array_update_rcpi_rsni(beacon_rep->bssid_addr, beacon_rep->client_addr, rcpi, rsni, true))
-    {
-        printf("Beacon: No Probe Entry Existing!\n");
-        beacon_rep->counter = dawn_metric.min_probe_count;
-        hwaddr_aton(blobmsg_data(tb[PROB_BSSID_ADDR]), beacon_rep->target_addr);
-        beacon_rep->signal = 0;
-        beacon_rep->freq = ap_entry_rep.freq;
-        beacon_rep->rcpi = rcpi;
-        beacon_rep->rsni = rsni;
-
-        beacon_rep->ht_capabilities = false; // that is very problematic!!!
-        beacon_rep->vht_capabilities = false; // that is very problematic!!!
-        printf("Inserting to array!\n");
-        insert_to_array(*beacon_rep, false, false, true);
-        ubus_send_probe_via_network(*beacon_rep);
-    }
+    memcpy(beacon_rep->target_addr, beacon_rep->bssid_addr, ETH_ALEN);
+    beacon_rep->freq = ap_entry_rep.freq;
+    beacon_rep->rcpi = blobmsg_get_u16(tb[BEACON_REP_RCPI]);
+    beacon_rep->rsni = blobmsg_get_u16(tb[BEACON_REP_RSNI]);
+    beacon_rep->ht_capabilities = false;
+    beacon_rep->vht_capabilities = false;
+    beacon_rep->max_supp_datarate = 0;
+    beacon_rep->min_supp_datarate = 0;
+    beacon_rep->deny_counter = 0;
+    beacon_rep->sent_time = 0;
     return 0;
 }
 
-static int handle_auth_req(struct blob_attr *msg) {
+static int eval_auth_req(auth_entry auth_req);
 
-    print_probe_array();
+static int eval_assoc_req(auth_entry auth_req);
+
+static int handle_auth_req(struct blob_attr *msg) {
     auth_entry auth_req;
+    int status;
+
     parse_to_auth_req(msg, &auth_req);
 
+    // a client that floods us gets the answer of its last authentication, without one it is not steered
+    if (!ratelimit_event(auth_req.client_addr, RATELIMIT_AUTH)) {
+        return ratelimit_get_verdict(auth_req.client_addr, auth_req.bssid_addr, RATELIMIT_AUTH,
+                                     WLAN_STATUS_SUCCESS);
+    }
+
+    status = eval_auth_req(auth_req);
+    ratelimit_set_verdict(auth_req.client_addr, auth_req.bssid_addr, RATELIMIT_AUTH, status);
+    if (status != WLAN_STATUS_SUCCESS) {
+        history_add_deny(auth_req.bssid_addr);
+    }
+    return status;
+}
+
+static int eval_auth_req(auth_entry auth_req) {
+
+    // overloaded: answering late is worse than not steering
+    if (overload_get_mode() >= OVERLOAD_SKIP_SCORING) {
+        return WLAN_STATUS_SUCCESS;
+    }
+
+    print_probe_array();
     printf("Auth entry: ");
     print_auth_entry(auth_req);
 
@@ -570,10 +957,31 @@ static int handle_auth_req(struct blob_attr *msg) {
 }
 
 static int handle_assoc_req(struct blob_attr *msg) {
-
-    print_probe_array();
     auth_entry auth_req;
+    int status;
+
     parse_to_assoc_req(msg, &auth_req);
+
+    if (!ratelimit_event(auth_req.client_addr, RATELIMIT_ASSOC)) {
+        return ratelimit_get_verdict(auth_req.client_addr, auth_req.bssid_addr, RATELIMIT_ASSOC,
+                                     WLAN_STATUS_SUCCESS);
+    }
+
+    status = eval_assoc_req(auth_req);
+    ratelimit_set_verdict(auth_req.client_addr, auth_req.bssid_addr, RATELIMIT_ASSOC, status);
+    if (status != WLAN_STATUS_SUCCESS) {
+        history_add_deny(auth_req.bssid_addr);
+    }
+    return status;
+}
+
+static int eval_assoc_req(auth_entry auth_req) {
+
+    if (overload_get_mode() >= OVERLOAD_SKIP_SCORING) {
+        return WLAN_STATUS_SUCCESS;
+    }
+
+    print_probe_array();
     printf("Association entry: ");
     print_auth_entry(auth_req);
 
@@ -607,30 +1015,85 @@ static int handle_assoc_req(struct blob_attr *msg) {
     return WLAN_STATUS_SUCCESS;
 }
 
+static void handle_deferred_probe(probe_entry entry, uint32_t count) {
+    probe_entry tmp_prob_req;
+
+    // stands for all probes of the client since the last flush
+    tmp_prob_req = insert_to_array(entry, 1, true, false);
+    // same as handle_probe_req, an overloaded node keeps its probes
+    if (overload_get_mode() < OVERLOAD_DROP_PEER && probe_array_forward(tmp_prob_req)) {
+        ubus_send_probe_via_network(tmp_prob_req);
+    }
+}
+
+void update_overload(struct uloop_timeout *t) {
+    struct timespec now;
+    int64_t lag_ms;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    lag_ms = (int64_t) (now.tv_sec - overload_due.tv_sec) * 1000 + (now.tv_nsec - overload_due.tv_nsec) / 1000000;
+    overload_sample(lag_ms > 0 ? lag_ms : 0, tcp_queued_bytes_max());
+
+    overload_due = now;
+    overload_due.tv_nsec += OVERLOAD_SAMPLE_INTERVAL * 1000000L;
+    if (overload_due.tv_nsec >= 1000000000L) {
+        overload_due.tv_sec++;
+        overload_due.tv_nsec -= 1000000000L;
+    }
+    uloop_timeout_set(&overload_timer, OVERLOAD_SAMPLE_INTERVAL);
+}
+
+void update_ratelimit(struct uloop_timeout *t) {
+    ratelimit_flush(handle_deferred_probe);
+    uloop_timeout_set(&ratelimit_timer, RATELIMIT_FLUSH_INTERVAL);
+}
+
 static int handle_probe_req(struct blob_attr *msg) {
     probe_entry prob_req;
     probe_entry tmp_prob_req;
+    int status;
 
     if (parse_to_probe_req(msg, &prob_req) == 0) {
+        // probe storm: keep only the newest probe and answer like the last time
+        if (!ratelimit_event(prob_req.client_addr, RATELIMIT_PROBE)) {
+            ratelimit_defer_probe(prob_req);
+            return ratelimit_get_verdict(prob_req.client_addr, prob_req.bssid_addr, RATELIMIT_PROBE,
+                                         WLAN_STATUS_SUCCESS);
+        }
         tmp_prob_req = insert_to_array(prob_req, 1, true, false);
-        ubus_send_probe_via_network(tmp_prob_req);
-        //send_blob_attr_via_network(msg, "probe");
+        // clients probe on every channel, the other nodes only need changes
+        if (overload_get_mode() < OVERLOAD_DROP_PEER && probe_array_forward(tmp_prob_req)) {
+            ubus_send_probe_via_network(tmp_prob_req);
+        }
     }
 
-    if (!decide_function(&tmp_prob_req, REQ_TYPE_PROBE)) {
-        return WLAN_STATUS_AP_UNABLE_TO_HANDLE_NEW_STA; // no reason needed...
+    if (overload_get_mode() >= OVERLOAD_SKIP_SCORING) {
+        status = WLAN_STATUS_SUCCESS;
+    } else if (!decide_function(&tmp_prob_req, REQ_TYPE_PROBE)) {
+        status = WLAN_STATUS_AP_UNABLE_TO_HANDLE_NEW_STA; // no reason needed...
+    } else {
+        status = WLAN_STATUS_SUCCESS;
     }
-    return WLAN_STATUS_SUCCESS;
+    ratelimit_set_verdict(tmp_prob_req.client_addr, tmp_prob_req.bssid_addr, RATELIMIT_PROBE, status);
+    return status;
 }
 
 static int handle_beacon_rep(struct blob_attr *msg) {
     probe_entry beacon_rep;
 
-    if (parse_to_beacon_rep(msg, &beacon_rep) == 0) {
-        printf("Inserting beacon Report!\n");
-        // insert_to_array(beacon_rep, 1);
-        printf("Sending via network!\n");
-        // send_blob_attr_via_network(msg, "beacon-report");
+    if (parse_to_beacon_rep(msg, &beacon_rep) != 0) {
+        beacon_stats.dropped++;
+        return 0;
+    }
+
+    beacon_stats.reports++;
+    if (probe_array_beacon_report(&beacon_rep)) {
+        beacon_stats.new_entries++;
+    }
+
+    // the other nodes get it as probe, with the rcpi and rsni
+    if (overload_get_mode() < OVERLOAD_DROP_PEER && probe_array_forward(beacon_rep)) {
+        ubus_send_probe_via_network(beacon_rep);
     }
     return 0;
 }
@@ -686,6 +1149,21 @@ int handle_network_msg(char *msg) {
 
     printf("Network Method new: %s : %s\n", method, msg);
 
+    // own, duplicate and outdated messages are dropped before the data is decoded
+    enum gossip_action action = GOSSIP_DELIVER;
+    if (tb[NETWORK_NODE] && tb[NETWORK_SEQ]) {
+        action = gossip_handle_envelope(blobmsg_get_u32(tb[NETWORK_NODE]),
+                                        blobmsg_get_u32(tb[NETWORK_SEQ]),
+                                        tb[NETWORK_ALL_SEQ] ? blobmsg_get_u32(tb[NETWORK_ALL_SEQ]) : -1,
+                                        tb[NETWORK_HOPS] ? blobmsg_get_u32(tb[NETWORK_HOPS]) : 0,
+                                        tb[NETWORK_TS] ? blobmsg_get_u32(tb[NETWORK_TS]) : 0,
+                                        tb[NETWORK_TS_MS] ? blobmsg_get_u32(tb[NETWORK_TS_MS]) : 0,
+                                        network_msg_prio(method) == TCP_PRIO_DROPPABLE);
+        if (action == GOSSIP_DROP) {
+            return 0;
+        }
+    }
+
     blob_buf_init(&data_buf, 0);
     blobmsg_add_json_from_string(&data_buf, data);
 
@@ -701,21 +1179,72 @@ int handle_network_msg(char *msg) {
         return -1;
     }
 
+    if (action == GOSSIP_RELAY && network_msg_relayed(method)) {
+        relay_network_msg(tb, data_buf.head);
+    }
+
+    // overloaded: probe updates are repeated anyway, the relayed copy is enough for the other nodes
+    if (overload_get_mode() >= OVERLOAD_DROP_PEER &&
+        (strcmp(method, "probe") == 0 || strcmp(method, "setprobe") == 0)) {
+        return 0;
+    }
+
     // add inactive death...
 
+    // updates about ssids that are not served here are useless
+    if (!serves_ssid(network_msg_ssid(data_buf.head))) {
+        return 0;
+    }
+
     if (strncmp(method, "probe", 5) == 0) {
         probe_entry entry;
         if (parse_to_probe_req(data_buf.head, &entry) == 0) {
             insert_to_array(entry, 0, false, false); // use 802.11k values
+            if (network_config.role == DAWN_ROLE_CONTROLLER) {
+                controller_set_owner(entry.bssid_addr, tcp_rx_con_id());
+                controller_push_decisions(entry.client_addr);
+            }
+        }
+    } else if (strcmp(method, "clients-resync") == 0) {
+        handle_clients_resync(data_buf.head);
+    } else if (strcmp(method, "clients-delta") == 0) {
+        if (handle_clients_seq(data_buf.head, 1) == 0) {
+            if (network_config.role == DAWN_ROLE_CONTROLLER) {
+                controller_owner_from_clients(data_buf.head);
+            }
+            parse_to_clients_delta(data_buf.head, network_config.role == DAWN_ROLE_CONTROLLER);
         }
     } else if (strncmp(method, "clients", 5) == 0) {
-        parse_to_clients(data_buf.head, 0, 0);
+        handle_clients_seq(data_buf.head, 0);
+        if (network_config.role == DAWN_ROLE_CONTROLLER) {
+            controller_owner_from_clients(data_buf.head);
+        }
+        // the controller evaluates the clients of its agents
+        parse_to_clients(data_buf.head, network_config.role == DAWN_ROLE_CONTROLLER, 0);
+    } else if (strncmp(method, "decision", 8) == 0) {
+        handle_decision(data_buf.head);
+    } else if (strncmp(method, "kick", 4) == 0) {
+        handle_kick(data_buf.head);
+    } else if (strncmp(method, "interest", 8) == 0) {
+        handle_interest(tb, data_buf.head);
+    } else if (strcmp(method, "heartbeat") == 0) {
+        handle_heartbeat(tb, data_buf.head);
+    } else if (strcmp(method, "sync-request") == 0) {
+        handle_sync_request(tb, data_buf.head);
+    } else if (strcmp(method, "sync") == 0) {
+        handle_sync(data_buf.head);
     } else if (strncmp(method, "deauth", 5) == 0) {
         printf("METHOD DEAUTH\n");
         handle_deauth_req(data_buf.head);
     } else if (strncmp(method, "setprobe", 5) == 0) {
         printf("HANDLING SET PROBE!\n");
         handle_set_probe(data_buf.head);
+        if (network_config.role == DAWN_ROLE_CONTROLLER) {
+            hostapd_notify_entry notify_req;
+            if (parse_to_hostapd_notify(data_buf.head, &notify_req) == 0) {
+                controller_push_decisions(notify_req.client_addr);
+            }
+        }
     } else if (strncmp(method, "addmac", 5) == 0) {
         parse_add_mac_to_file(data_buf.head);
     } else if (strncmp(method, "macfile", 5) == 0) {
@@ -724,13 +1253,7 @@ int handle_network_msg(char *msg) {
         printf("HANDLING UCI!\n");
         handle_uci_config(data_buf.head);
     } else if (strncmp(method, "beacon-report", 12) == 0) {
-        // TODO: Check beacon report stuff
-
-        //printf("HANDLING BEACON REPORT NETWORK!\n");
-        //printf("The Method for beacon-report is: %s\n", method);
-        // ignore beacon reports send via network!, use probe functions for it
-        //probe_entry entry; // for now just stay at probe entry stuff...
-        //parse_to_beacon_rep(data_buf.head, &entry, true);
+        // beacon reports are sent as probes, nothing sends this anymore
     } else
     {
         printf("No method fonud for: %s\n", method);
@@ -740,61 +1263,808 @@ int handle_network_msg(char *msg) {
 }
 
 
-int send_blob_attr_via_network(struct blob_attr *msg, char *method) {
+// messages that only carry a state snapshot may be dropped or replaced by a newer one
+static enum tcp_prio network_msg_prio(const char *method) {
+    // a lost clients-delta is repaired by a clients-resync
+    if (strcmp(method, "probe") == 0 || strcmp(method, "clients") == 0 || strcmp(method, "setprobe") == 0 ||
+        strcmp(method, "decision") == 0 || strcmp(method, "interest") == 0 || strcmp(method, "clients-delta") == 0 ||
+        strcmp(method, "heartbeat") == 0) {
+        return TCP_PRIO_DROPPABLE;
+    }
+    return TCP_PRIO_RELIABLE;
+}
 
-    if (!msg) {
-        return -1;
+// in hybrid mode frequent updates that are soon outdated anyway go via multicast, the rest via tcp
+static int network_msg_datagram(const char *method, const char *str) {
+    if (strcmp(method, "probe") != 0 && strcmp(method, "clients") != 0 && strcmp(method, "clients-delta") != 0 &&
+        strcmp(method, "setprobe") != 0) {
+        return 0;
     }
 
-    char *data_str;
-    char *str;
-    data_str = blobmsg_format_json(msg, true);
-    blob_buf_init(&b_send_network, 0);
-    blobmsg_add_string(&b_send_network, "method", method);
-    blobmsg_add_string(&b_send_network, "data", data_str);
+    // a big clients table doesn't fit into a datagram
+    return strlen(str) + (network_config.use_symm_enc ? GCRYPT_OVERHEAD : 0) <= MAX_RECV_STRING;
+}
 
-    str = blobmsg_format_json(b_send_network.head, true);
+// messages to a single peer must not be passed on
+static int network_msg_relayed(const char *method) {
+    return strcmp(method, "decision") != 0 && strcmp(method, "kick") != 0 && strcmp(method, "sync-request") != 0 &&
+           strcmp(method, "sync") != 0;
+}
 
-    if (network_config.network_option == 2) {
-        send_tcp(str);
-    } else {
-        if (network_config.use_symm_enc) {
-            send_string_enc(str);
-        } else {
-            send_string(str);
-        }
+// a message supersedes a queued one with the same method, bssid and client
+// deltas build on each other and never replace one another
+static const char *network_msg_key(struct blob_attr *msg, const char *method, char *key, int key_len) {
+    struct blob_attr *tb[__HOSTAPD_NOTIFY_MAX];
+
+    if (network_msg_prio(method) != TCP_PRIO_DROPPABLE || strcmp(method, "clients-delta") == 0) {
+        return NULL;
     }
 
-    free(data_str);
-    free(str);
+    blobmsg_parse(hostapd_notify_policy, __HOSTAPD_NOTIFY_MAX, tb, blob_data(msg), blob_len(msg));
 
-    return 0;
+    snprintf(key, key_len, "%s|%s|%s", method,
+             tb[HOSTAPD_NOTIFY_BSSID_ADDR] ? blobmsg_get_string(tb[HOSTAPD_NOTIFY_BSSID_ADDR]) : "",
+             tb[HOSTAPD_NOTIFY_CLIENT_ADDR] ? blobmsg_get_string(tb[HOSTAPD_NOTIFY_CLIENT_ADDR]) : "");
+    return key;
 }
 
-static int hostapd_notify(struct ubus_context *ctx, struct ubus_object *obj,
-                          struct ubus_request_data *req, const char *method,
-                          struct blob_attr *msg) {
-    char *str;
-    str = blobmsg_format_json(msg, true);
-    printf("Method new: %s : %s\n", method, str);
-    free(str);
+static const char *network_msg_ssid(struct blob_attr *msg) {
+    struct blob_attr *tb[__NETWORK_MSG_MAX];
 
-    struct hostapd_sock_entry *entry;
-    struct ubus_subscriber *subscriber;
+    blobmsg_parse(network_msg_policy, __NETWORK_MSG_MAX, tb, blob_data(msg), blob_len(msg));
+    return tb[NETWORK_MSG_SSID] ? blobmsg_get_string(tb[NETWORK_MSG_SSID]) : NULL;
+}
 
-    subscriber = container_of(obj, struct ubus_subscriber, obj);
-    entry = container_of(subscriber, struct hostapd_sock_entry, subscriber);
+static int serves_ssid(const char *ssid) {
+    struct hostapd_sock_entry *sub;
+    int num_ssids = 0;
 
-    struct blob_attr *cur; int rem;
-    blob_buf_init(&b_notify, 0);
-    blobmsg_for_each_attr(cur, msg, rem){
-        blobmsg_add_blob(&b_notify, cur);
+    if (ssid == NULL) {
+        return 1;
     }
 
-    blobmsg_add_macaddr(&b_notify, "bssid", entry->bssid_addr);
-    blobmsg_add_string(&b_notify, "ssid", entry->ssid);
+    list_for_each_entry(sub, &hostapd_sock_list, list)
+    {
+        if (sub->subscribed) {
+            if (strcmp(sub->ssid, ssid) == 0) {
+                return 1;
+            }
+            num_ssids++;
+        }
+    }
 
-    if (strncmp(method, "probe", 5) == 0) {
+    // without own interfaces (controller) everything is interesting
+    return num_ssids == 0;
+}
+
+int ubus_get_hostapd_id(uint8_t *bssid_addr, uint32_t *id) {
+    struct hostapd_sock_entry *sub;
+
+    list_for_each_entry(sub, &hostapd_sock_list, list)
+    {
+        if (sub->subscribed && mac_is_equal(sub->bssid_addr, bssid_addr)) {
+            *id = sub->id;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static int bssid_to_ssid(uint8_t *bssid_addr, char *ssid) {
+    struct hostapd_sock_entry *sub;
+
+    list_for_each_entry(sub, &hostapd_sock_list, list)
+    {
+        if (mac_is_equal(sub->bssid_addr, bssid_addr)) {
+            snprintf(ssid, SSID_MAX_LEN + 1, "%s", sub->ssid);
+            return 0;
+        }
+    }
+
+    ap ap_entry = ap_array_get_ap(bssid_addr);
+    if (mac_is_equal(ap_entry.bssid_addr, bssid_addr)) {
+        snprintf(ssid, SSID_MAX_LEN + 1, "%.*s", SSID_MAX_LEN, (char *) ap_entry.ssid);
+        return 0;
+    }
+    return -1;
+}
+
+static char *format_network_msg(struct blob_attr *msg, char *method, int to_all) {
+    char *data_str;
+    char *str;
+
+    data_str = blobmsg_format_json(msg, true);
+    blob_buf_init(&b_send_network, 0);
+    blobmsg_add_string(&b_send_network, "method", method);
+    blobmsg_add_string(&b_send_network, "data", data_str);
+    gossip_add_envelope(&b_send_network, to_all);
+
+    str = blobmsg_format_json(b_send_network.head, true);
+    free(data_str);
+    return str;
+}
+
+static int send_blob_attr_via_network_to(uint32_t con_id, struct blob_attr *msg, char *method) {
+    char key[TCP_FRAME_KEY_LEN];
+    char *str;
+    int ret;
+
+    if (!msg) {
+        return -1;
+    }
+
+    str = format_network_msg(msg, method, 0);
+    ret = send_tcp_to(con_id, str, network_msg_prio(method), network_msg_key(msg, method, key, sizeof(key)));
+    free(str);
+
+    return ret;
+}
+
+int send_blob_attr_via_network(struct blob_attr *msg, char *method) {
+
+    if (!msg) {
+        return -1;
+    }
+
+    // a full mesh only sends messages of an ssid to the peers that serve it,
+    // in hybrid mode such a message may still go out as datagram to all peers, it is just not numbered then
+    const char *ssid = network_msg_ssid(msg);
+    int filtered = network_config.network_option >= 2 && network_config.role == DAWN_ROLE_PEER &&
+                   network_config.gossip_fanout <= 0 && ssid != NULL;
+    char *str = format_network_msg(msg, method, !filtered);
+
+    if (network_config.network_option == 2 ||
+        (network_config.network_option == 3 && !network_msg_datagram(method, str))) {
+        char key[TCP_FRAME_KEY_LEN];
+
+        send_tcp(str, network_msg_prio(method), network_msg_key(msg, method, key, sizeof(key)), ssid);
+    } else {
+        if (network_config.use_symm_enc) {
+            send_string_enc(str);
+        } else {
+            send_string(str);
+        }
+    }
+
+    free(str);
+
+    return 0;
+}
+
+// pass a gossip message on with the original envelope and one more hop
+static void relay_network_msg(struct blob_attr **tb, struct blob_attr *data) {
+    char *method = blobmsg_get_string(tb[NETWORK_METHOD]);
+    enum tcp_prio prio = network_msg_prio(method);
+    char key[TCP_FRAME_KEY_LEN];
+    char *str;
+
+    blob_buf_init(&b_send_network, 0);
+    blobmsg_add_string(&b_send_network, "method", method);
+    blobmsg_add_string(&b_send_network, "data", blobmsg_get_string(tb[NETWORK_DATA]));
+    blobmsg_add_u32(&b_send_network, "node", blobmsg_get_u32(tb[NETWORK_NODE]));
+    blobmsg_add_u32(&b_send_network, "seq", blobmsg_get_u32(tb[NETWORK_SEQ]));
+    if (tb[NETWORK_ALL_SEQ]) {
+        blobmsg_add_u32(&b_send_network, "all_seq", blobmsg_get_u32(tb[NETWORK_ALL_SEQ]));
+    }
+    blobmsg_add_u32(&b_send_network, "hops", (tb[NETWORK_HOPS] ? blobmsg_get_u32(tb[NETWORK_HOPS]) : 0) + 1);
+    if (tb[NETWORK_TS] && tb[NETWORK_TS_MS]) {
+        blobmsg_add_u32(&b_send_network, "ts", blobmsg_get_u32(tb[NETWORK_TS]));
+        blobmsg_add_u32(&b_send_network, "ts_ms", blobmsg_get_u32(tb[NETWORK_TS_MS]));
+    }
+
+    str = blobmsg_format_json(b_send_network.head, true);
+    send_tcp(str, prio, network_msg_key(data, method, key, sizeof(key)), network_msg_ssid(data));
+    free(str);
+}
+
+// decide_function for all request types at once, the comparison with the other aps is only done once
+static uint8_t decide_all(probe_entry *prob_req) {
+    uint8_t allow = DECISION_ALLOW_PROBE | DECISION_ALLOW_AUTH | DECISION_ALLOW_ASSOC;
+
+    if (mac_in_maclist(prob_req->client_addr)) {
+        return allow;
+    }
+
+    if (prob_req->counter < dawn_metric.min_probe_count) {
+        return 0;
+    }
+
+    if (!dawn_metric.eval_probe_req && !dawn_metric.eval_auth_req && !dawn_metric.eval_assoc_req) {
+        return allow;
+    }
+
+    if (better_ap_available(prob_req->bssid_addr, prob_req->client_addr, NULL, 0)) {
+        if (dawn_metric.eval_probe_req)
+            allow &= ~DECISION_ALLOW_PROBE;
+        if (dawn_metric.eval_auth_req)
+            allow &= ~DECISION_ALLOW_AUTH;
+        if (dawn_metric.eval_assoc_req)
+            allow &= ~DECISION_ALLOW_ASSOC;
+    }
+    return allow;
+}
+
+// tell the agents about changed allow/deny decisions for the client
+// the agent that sends the clients of an ap is the one the decisions for the ap go to
+static void controller_owner_from_clients(struct blob_attr *msg) {
+    struct blob_attr *tb_clients[__CLIENT_TABLE_MAX];
+    uint8_t bssid_addr[ETH_ALEN];
+
+    blobmsg_parse(client_table_policy, __CLIENT_TABLE_MAX, tb_clients, blob_data(msg), blob_len(msg));
+    if (tb_clients[CLIENT_TABLE_BSSID] && hwaddr_aton(blobmsg_data(tb_clients[CLIENT_TABLE_BSSID]), bssid_addr) == 0) {
+        controller_set_owner(bssid_addr, tcp_rx_con_id());
+    }
+}
+
+static void controller_push_decisions(uint8_t *client_addr) {
+    int i;
+
+    pthread_mutex_lock(&client_array_mutex);
+    pthread_mutex_lock(&probe_array_mutex);
+
+    // the probes of a client are next to each other
+    for (i = 0; i <= probe_entry_last; i++) {
+        if (mac_is_equal(probe_array[i].client_addr, client_addr)) {
+            break;
+        }
+    }
+
+    for (; i <= probe_entry_last && mac_is_equal(probe_array[i].client_addr, client_addr); i++) {
+        probe_entry *entry = &probe_array[i];
+
+        uint32_t owner = controller_get_owner(entry->bssid_addr);
+        if (owner == 0) {
+            continue;
+        }
+
+        uint8_t allow = decide_all(entry);
+        if (!decision_cache_update(entry->bssid_addr, client_addr, allow)) {
+            continue;
+        }
+
+        blob_buf_init(&b_control, 0);
+        blobmsg_add_macaddr(&b_control, "bssid", entry->bssid_addr);
+        blobmsg_add_macaddr(&b_control, "address", client_addr);
+        blobmsg_add_u32(&b_control, "allow", allow);
+        send_blob_attr_via_network_to(owner, b_control.head, "decision");
+    }
+
+    pthread_mutex_unlock(&probe_array_mutex);
+    pthread_mutex_unlock(&client_array_mutex);
+}
+
+int send_kick_via_network(uint8_t *bssid_addr, uint8_t *client_addr, char *neighbor_report, int deauth) {
+    uint32_t owner = controller_get_owner(bssid_addr);
+
+    if (owner == 0) {
+        fprintf(stderr, "No agent for bssid " MACSTR "\n", MAC2STR(bssid_addr));
+        return -1;
+    }
+
+    blob_buf_init(&b_control, 0);
+    blobmsg_add_macaddr(&b_control, "bssid", bssid_addr);
+    blobmsg_add_macaddr(&b_control, "address", client_addr);
+    blobmsg_add_string(&b_control, "neighbor_report", neighbor_report ? neighbor_report : "");
+    blobmsg_add_u8(&b_control, "deauth", deauth);
+    return send_blob_attr_via_network_to(owner, b_control.head, "kick");
+}
+
+static int handle_decision(struct blob_attr *msg) {
+    struct blob_attr *tb[__CONTROL_MAX];
+    uint8_t bssid_addr[ETH_ALEN];
+    uint8_t client_addr[ETH_ALEN];
+
+    blobmsg_parse(control_policy, __CONTROL_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (!tb[CONTROL_BSSID_ADDR] || !tb[CONTROL_CLIENT_ADDR] || !tb[CONTROL_ALLOW])
+        return UBUS_STATUS_INVALID_ARGUMENT;
+
+    if (hwaddr_aton(blobmsg_data(tb[CONTROL_BSSID_ADDR]), bssid_addr))
+        return UBUS_STATUS_INVALID_ARGUMENT;
+
+    if (hwaddr_aton(blobmsg_data(tb[CONTROL_CLIENT_ADDR]), client_addr))
+        return UBUS_STATUS_INVALID_ARGUMENT;
+
+    decision_cache_set(bssid_addr, client_addr, blobmsg_get_u32(tb[CONTROL_ALLOW]));
+    return 0;
+}
+
+// kick command of the controller, the agent only checks if the client is busy
+static int handle_kick(struct blob_attr *msg) {
+    struct blob_attr *tb[__CONTROL_MAX];
+    struct hostapd_sock_entry *sub, *entry = NULL;
+    uint8_t bssid_addr[ETH_ALEN];
+    client client_entry;
+
+    blobmsg_parse(control_policy, __CONTROL_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (!tb[CONTROL_BSSID_ADDR] || !tb[CONTROL_CLIENT_ADDR])
+        return UBUS_STATUS_INVALID_ARGUMENT;
+
+    if (hwaddr_aton(blobmsg_data(tb[CONTROL_BSSID_ADDR]), bssid_addr))
+        return UBUS_STATUS_INVALID_ARGUMENT;
+
+    if (hwaddr_aton(blobmsg_data(tb[CONTROL_CLIENT_ADDR]), client_entry.client_addr))
+        return UBUS_STATUS_INVALID_ARGUMENT;
+
+    list_for_each_entry(sub, &hostapd_sock_list, list)
+    {
+        if (sub->subscribed && mac_is_equal(sub->bssid_addr, bssid_addr)) {
+            entry = sub;
+        }
+    }
+
+    if (entry == NULL) {
+        fprintf(stderr, "Kick for unknown bssid " MACSTR "\n", MAC2STR(bssid_addr));
+        return -1;
+    }
+
+    if (tb[CONTROL_DEAUTH] && blobmsg_get_u8(tb[CONTROL_DEAUTH])) {
+        del_client_interface(entry->id, client_entry.client_addr, 0, 1, 0);
+        return 0;
+    }
+
+    float rx_rate, tx_rate;
+    if (get_bandwidth_iwinfo(client_entry.client_addr, &rx_rate, &tx_rate) &&
+        rx_rate > dawn_metric.bandwidth_threshold) {
+        printf("Client is probably in active transmisison. Don't kick! RxRate is: %f\n", rx_rate);
+        return 0;
+    }
+
+    send_set_probe(client_entry.client_addr, bssid_addr);
+    wnm_disassoc_imminent(entry->id, client_entry.client_addr,
+                          tb[CONTROL_NEIGHBOR] ? blobmsg_get_string(tb[CONTROL_NEIGHBOR]) : NULL, 12);
+
+    memcpy(client_entry.bssid_addr, bssid_addr, ETH_ALEN);
+    pthread_mutex_lock(&client_array_mutex);
+    client_array_delete(client_entry);
+    pthread_mutex_unlock(&client_array_mutex);
+    return 0;
+}
+
+// a peer tells which ssids it serves, only accepted directly from the peer
+static int handle_interest(struct blob_attr **tb, struct blob_attr *msg) {
+    struct blob_attr *tb_interest[__INTEREST_MAX];
+    struct blob_attr *attr;
+    struct in_addr addr;
+    int len;
+
+    if (!tb[NETWORK_NODE] || (tb[NETWORK_HOPS] && blobmsg_get_u32(tb[NETWORK_HOPS]) > 0) || tcp_rx_addr(&addr))
+        return -1;
+
+    blobmsg_parse(interest_policy, __INTEREST_MAX, tb_interest, blob_data(msg), blob_len(msg));
+
+    if (!tb_interest[INTEREST_SSIDS])
+        return UBUS_STATUS_INVALID_ARGUMENT;
+
+    struct peer_s *peer = peer_get(blobmsg_get_u32(tb[NETWORK_NODE]), 1);
+    if (peer == NULL) {
+        return 0;
+    }
+    peer->addr = addr;
+    // the message came over the connection of the peer, its port is the one it listens on
+    peer->port = tb_interest[INTEREST_PORT] ? blobmsg_get_u32(tb_interest[INTEREST_PORT]) : network_config.tcp_port;
+    peer->last_seen = time(0);
+    peer->interest_time = time(0);
+    peer->num_ssids = 0;
+
+    len = blobmsg_data_len(tb_interest[INTEREST_SSIDS]);
+    __blob_for_each_attr(attr, blobmsg_data(tb_interest[INTEREST_SSIDS]), len)
+    {
+        if (peer->num_ssids >= PEER_MAX_SSIDS) {
+            // can't remember all, don't filter for this peer
+            peer->interest_time = 0;
+            break;
+        }
+        snprintf(peer->ssids[peer->num_ssids].ssid, SSID_MAX_LEN + 1, "%s", blobmsg_name(attr));
+        peer->ssids[peer->num_ssids].bands = blobmsg_get_u32(attr);
+        peer->num_ssids++;
+    }
+    return 0;
+}
+
+// liveness and aps of a peer, a direct heartbeat also echoes our last one for the rtt
+static int handle_heartbeat(struct blob_attr **tb, struct blob_attr *msg) {
+    struct blob_attr *tb_heartbeat[__HEARTBEAT_MAX];
+    struct blob_attr *tb_echo[__HEARTBEAT_ECHO_MAX];
+    struct blob_attr *attr;
+    uint8_t bssids[PEER_MAX_BSSIDS][ETH_ALEN];
+    int num_bssids = 0;
+    struct in_addr addr;
+    char node_buf[9];
+    int len;
+
+    if (!tb[NETWORK_NODE])
+        return -1;
+
+    blobmsg_parse(heartbeat_policy, __HEARTBEAT_MAX, tb_heartbeat, blob_data(msg), blob_len(msg));
+
+    if (!tb_heartbeat[HEARTBEAT_SEQ])
+        return UBUS_STATUS_INVALID_ARGUMENT;
+
+    int direct = !tb[NETWORK_HOPS] || blobmsg_get_u32(tb[NETWORK_HOPS]) == 0;
+    struct peer_s *peer = peer_get(blobmsg_get_u32(tb[NETWORK_NODE]), 1);
+
+    if (peer == NULL) {
+        return 0;
+    }
+    if (direct && tcp_rx_addr(&addr) == 0) {
+        peer->addr = addr;
+    }
+    peer_heartbeat_received(peer, blobmsg_get_u32(tb_heartbeat[HEARTBEAT_SEQ]), direct);
+
+    if (tb_heartbeat[HEARTBEAT_BSSIDS]) {
+        len = blobmsg_data_len(tb_heartbeat[HEARTBEAT_BSSIDS]);
+        __blob_for_each_attr(attr, blobmsg_data(tb_heartbeat[HEARTBEAT_BSSIDS]), len)
+        {
+            if (num_bssids >= PEER_MAX_BSSIDS) {
+                break;
+            }
+            if (hwaddr_aton(blobmsg_data(attr), bssids[num_bssids]) == 0) {
+                num_bssids++;
+            }
+        }
+        peer_set_bssids(peer, bssids, num_bssids);
+    }
+
+    if (direct && tb_heartbeat[HEARTBEAT_ECHO]) {
+        sprintf(node_buf, "%08x", gossip_node_id);
+
+        len = blobmsg_data_len(tb_heartbeat[HEARTBEAT_ECHO]);
+        __blob_for_each_attr(attr, blobmsg_data(tb_heartbeat[HEARTBEAT_ECHO]), len)
+        {
+            if (strcmp(blobmsg_name(attr), node_buf) != 0) {
+                continue;
+            }
+            blobmsg_parse(heartbeat_echo_policy, __HEARTBEAT_ECHO_MAX, tb_echo, blobmsg_data(attr),
+                          blobmsg_data_len(attr));
+            if (tb_echo[HEARTBEAT_ECHO_SEQ] && tb_echo[HEARTBEAT_ECHO_HELD]) {
+                peer_handle_echo(peer, blobmsg_get_u32(tb_echo[HEARTBEAT_ECHO_SEQ]),
+                                 blobmsg_get_u32(tb_echo[HEARTBEAT_ECHO_HELD]));
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+static void send_heartbeat() {
+    static uint32_t heartbeat_seq = 0;
+    struct hostapd_sock_entry *sub;
+    void *bssid_list;
+
+    heartbeat_seq++;
+
+    blob_buf_init(&b_control, 0);
+    blobmsg_add_u32(&b_control, "hb_seq", heartbeat_seq);
+    bssid_list = blobmsg_open_array(&b_control, "bssids");
+    list_for_each_entry(sub, &hostapd_sock_list, list)
+    {
+        if (sub->subscribed) {
+            blobmsg_add_macaddr(&b_control, NULL, sub->bssid_addr);
+        }
+    }
+    blobmsg_close_array(&b_control, bssid_list);
+    peer_add_heartbeat_echo(&b_control);
+
+    peer_heartbeat_sent(heartbeat_seq);
+    send_blob_attr_via_network(b_control.head, "heartbeat");
+}
+
+void handle_tcp_connected(uint32_t con_id) {
+    // controller and agents don't share a full view
+    if (network_config.role != DAWN_ROLE_PEER || sync_done || time(0) - sync_start_time > SYNC_JOIN_PERIOD) {
+        return;
+    }
+
+    // one peer at a time, the next one is asked if it doesn't answer
+    if (sync_con_id != 0 && time(0) - sync_request_time < SYNC_TIMEOUT) {
+        return;
+    }
+
+    blob_buf_init(&b_control, 0);
+    blobmsg_add_u32(&b_control, "max_age", timeout_config.remove_probe);
+    if (send_blob_attr_via_network_to(con_id, b_control.head, "sync-request") == 0) {
+        printf("Requesting state snapshot\n");
+        sync_con_id = con_id;
+        sync_request_time = time(0);
+    }
+}
+
+static int handle_sync_request(struct blob_attr **tb, struct blob_attr *msg) {
+    struct blob_attr *tb_sync[__SYNC_MAX];
+    struct sync_job_s *job = NULL;
+    uint32_t con_id = tcp_rx_con_id();
+
+    if (con_id == 0 || (tb[NETWORK_HOPS] && blobmsg_get_u32(tb[NETWORK_HOPS]) > 0))
+        return -1;
+
+    blobmsg_parse(sync_policy, __SYNC_MAX, tb_sync, blob_data(msg), blob_len(msg));
+
+    for (int i = 0; i < SYNC_MAX_JOBS; i++) {
+        if (sync_jobs[i].con_id == con_id || (job == NULL && sync_jobs[i].con_id == 0)) {
+            job = &sync_jobs[i];
+        }
+    }
+
+    if (job == NULL) {
+        fprintf(stderr, "Too many state snapshots in progress!\n");
+        return -1;
+    }
+
+    job->con_id = con_id;
+    job->max_age = tb_sync[SYNC_MAX_AGE] ? blobmsg_get_u32(tb_sync[SYNC_MAX_AGE]) : timeout_config.remove_probe;
+    job->ap_pos = 0;
+    job->probe_pos = 0;
+
+    uloop_timeout_set(&sync_timer, 0);
+    return 0;
+}
+
+// the arrays may change between the chunks, an entry that moved meanwhile is skipped or sent twice
+static int send_sync_chunk(struct sync_job_s *job) {
+    ap aps[SYNC_CHUNK_LEN];
+    probe_entry probes[SYNC_CHUNK_LEN];
+    int num_aps = 0;
+    int num_probes = 0;
+    int last;
+    time_t now = time(0);
+    void *list, *entry;
+
+    pthread_mutex_lock(&ap_array_mutex);
+    while (job->ap_pos <= ap_entry_last && num_aps < SYNC_CHUNK_LEN) {
+        aps[num_aps++] = ap_array[job->ap_pos++];
+    }
+    pthread_mutex_unlock(&ap_array_mutex);
+
+    pthread_mutex_lock(&probe_array_mutex);
+    while (job->probe_pos <= probe_entry_last && num_aps + num_probes < SYNC_CHUNK_LEN) {
+        if (now - probe_array[job->probe_pos].time <= job->max_age) {
+            probes[num_probes++] = probe_array[job->probe_pos];
+        }
+        job->probe_pos++;
+    }
+    last = job->ap_pos > ap_entry_last && job->probe_pos > probe_entry_last;
+    pthread_mutex_unlock(&probe_array_mutex);
+
+    blob_buf_init(&b_sync, 0);
+    list = blobmsg_open_array(&b_sync, "aps");
+    for (int i = 0; i < num_aps; i++) {
+        entry = blobmsg_open_table(&b_sync, NULL);
+        blobmsg_add_macaddr(&b_sync, "bssid", aps[i].bssid_addr);
+        blobmsg_add_string(&b_sync, "ssid", (char *) aps[i].ssid);
+        blobmsg_add_u32(&b_sync, "freq", aps[i].freq);
+        blobmsg_add_u8(&b_sync, "ht_supported", aps[i].ht_support);
+        blobmsg_add_u8(&b_sync, "vht_supported", aps[i].vht_support);
+        blobmsg_add_u32(&b_sync, "channel_utilization", aps[i].channel_utilization);
+        blobmsg_add_u32(&b_sync, "num_sta", aps[i].station_count);
+        blobmsg_add_u32(&b_sync, "collision_domain", aps[i].collision_domain);
+        blobmsg_add_u32(&b_sync, "bandwidth", aps[i].bandwidth);
+        blobmsg_add_u32(&b_sync, "ap_weight", aps[i].ap_weight);
+        char *nr = blobmsg_alloc_string_buffer(&b_sync, "neighbor_report", NEIGHBOR_REPORT_LEN);
+        nr_store_get_hex(aps[i].bssid_addr, -1, nr, NEIGHBOR_REPORT_LEN);
+        blobmsg_add_string_buffer(&b_sync);
+        blobmsg_add_u32(&b_sync, "age", now - aps[i].time);
+        blobmsg_close_table(&b_sync, entry);
+    }
+    blobmsg_close_array(&b_sync, list);
+
+    list = blobmsg_open_array(&b_sync, "probes");
+    for (int i = 0; i < num_probes; i++) {
+        entry = blobmsg_open_table(&b_sync, NULL);
+        blobmsg_add_macaddr(&b_sync, "bssid", probes[i].bssid_addr);
+        blobmsg_add_macaddr(&b_sync, "address", probes[i].client_addr);
+        blobmsg_add_macaddr(&b_sync, "target", probes[i].target_addr);
+        blobmsg_add_u32(&b_sync, "signal", probes[i].signal);
+        blobmsg_add_u32(&b_sync, "freq", probes[i].freq);
+        blobmsg_add_u32(&b_sync, "rcpi", probes[i].rcpi);
+        blobmsg_add_u32(&b_sync, "rsni", probes[i].rsni);
+        if (probes[i].ht_capabilities) {
+            blobmsg_close_table(&b_sync, blobmsg_open_table(&b_sync, "ht_capabilities"));
+        }
+        if (probes[i].vht_capabilities) {
+            blobmsg_close_table(&b_sync, blobmsg_open_table(&b_sync, "vht_capabilities"));
+        }
+        blobmsg_add_u32(&b_sync, "counter", probes[i].counter);
+        blobmsg_add_u32(&b_sync, "age", now - probes[i].time);
+        blobmsg_close_table(&b_sync, entry);
+    }
+    blobmsg_close_array(&b_sync, list);
+    blobmsg_add_u8(&b_sync, "last", last);
+
+    send_blob_attr_via_network_to(job->con_id, b_sync.head, "sync");
+    return last;
+}
+
+void update_sync(struct uloop_timeout *t) {
+    int pending = 0;
+
+    for (int i = 0; i < SYNC_MAX_JOBS; i++) {
+        struct sync_job_s *job = &sync_jobs[i];
+
+        if (job->con_id == 0) {
+            continue;
+        }
+
+        int queued = tcp_con_queued_bytes(job->con_id);
+        if (queued < 0) {
+            // peer is gone
+            job->con_id = 0;
+            continue;
+        }
+
+        // the peer first has to read the previous chunks
+        if (queued < SYNC_QUEUE_LIMIT && send_sync_chunk(job)) {
+            job->con_id = 0;
+            continue;
+        }
+        pending = 1;
+    }
+
+    if (pending) {
+        uloop_timeout_set(&sync_timer, SYNC_CHUNK_INTERVAL);
+    }
+}
+
+static int handle_sync(struct blob_attr *msg) {
+    struct blob_attr *tb_sync[__SYNC_MAX];
+    struct blob_attr *tb_ap[__CLIENT_TABLE_MAX];
+    struct blob_attr *tb_entry[__SYNC_ENTRY_MAX];
+    struct blob_attr *attr;
+    time_t now = time(0);
+    int len;
+
+    if (tcp_rx_con_id() == 0 || tcp_rx_con_id() != sync_con_id)
+        return -1;
+
+    blobmsg_parse(sync_policy, __SYNC_MAX, tb_sync, blob_data(msg), blob_len(msg));
+
+    if (tb_sync[SYNC_APS]) {
+        len = blobmsg_data_len(tb_sync[SYNC_APS]);
+        __blob_for_each_attr(attr, blobmsg_data(tb_sync[SYNC_APS]), len)
+        {
+            ap ap_entry;
+
+            blobmsg_parse(client_table_policy, __CLIENT_TABLE_MAX, tb_ap, blobmsg_data(attr), blobmsg_data_len(attr));
+            blobmsg_parse(sync_entry_policy, __SYNC_ENTRY_MAX, tb_entry, blobmsg_data(attr), blobmsg_data_len(attr));
+
+            if (!tb_ap[CLIENT_TABLE_BSSID] || !tb_ap[CLIENT_TABLE_FREQ] || !tb_entry[SYNC_ENTRY_AGE] ||
+                hwaddr_aton(blobmsg_data(tb_ap[CLIENT_TABLE_BSSID]), ap_entry.bssid_addr)) {
+                continue;
+            }
+
+            memset(ap_entry.ssid, 0, sizeof(ap_entry.ssid));
+            if (tb_ap[CLIENT_TABLE_SSID]) {
+                strncpy((char *) ap_entry.ssid, blobmsg_get_string(tb_ap[CLIENT_TABLE_SSID]), SSID_MAX_LEN - 1);
+            }
+            ap_entry.freq = blobmsg_get_u32(tb_ap[CLIENT_TABLE_FREQ]);
+            ap_entry.ht_support = tb_ap[CLIENT_TABLE_HT] ? blobmsg_get_u8(tb_ap[CLIENT_TABLE_HT]) : false;
+            ap_entry.vht_support = tb_ap[CLIENT_TABLE_VHT] ? blobmsg_get_u8(tb_ap[CLIENT_TABLE_VHT]) : false;
+            ap_entry.channel_utilization =
+                    tb_ap[CLIENT_TABLE_CHAN_UTIL] ? blobmsg_get_u32(tb_ap[CLIENT_TABLE_CHAN_UTIL]) : 0;
+            ap_entry.station_count = tb_ap[CLIENT_TABLE_NUM_STA] ? blobmsg_get_u32(tb_ap[CLIENT_TABLE_NUM_STA]) : 0;
+            ap_entry.collision_domain =
+                    tb_ap[CLIENT_TABLE_COL_DOMAIN] ? blobmsg_get_u32(tb_ap[CLIENT_TABLE_COL_DOMAIN]) : -1;
+            ap_entry.bandwidth = tb_ap[CLIENT_TABLE_BANDWIDTH] ? blobmsg_get_u32(tb_ap[CLIENT_TABLE_BANDWIDTH]) : -1;
+            ap_entry.ap_weight = tb_ap[CLIENT_TABLE_WEIGHT] ? blobmsg_get_u32(tb_ap[CLIENT_TABLE_WEIGHT]) : 0;
+            ap_entry.time = now - blobmsg_get_u32(tb_entry[SYNC_ENTRY_AGE]);
+
+            // the neighbor report belongs to the entry, an older one doesn't replace the own
+            if (ap_array_merge(ap_entry)) {
+                sync_num_aps++;
+                if (tb_ap[CLIENT_TABLE_NEIGHBOR]) {
+                    nr_store_set(ap_entry.bssid_addr, blobmsg_get_string(tb_ap[CLIENT_TABLE_NEIGHBOR]));
+                }
+            }
+        }
+    }
+
+    if (tb_sync[SYNC_PROBES]) {
+        len = blobmsg_data_len(tb_sync[SYNC_PROBES]);
+        __blob_for_each_attr(attr, blobmsg_data(tb_sync[SYNC_PROBES]), len)
+        {
+            probe_entry entry;
+
+            memset(&entry, 0, sizeof(entry));
+            blobmsg_parse(sync_entry_policy, __SYNC_ENTRY_MAX, tb_entry, blobmsg_data(attr), blobmsg_data_len(attr));
+            if (!tb_entry[SYNC_ENTRY_AGE]) {
+                continue;
+            }
+
+            // the table has the layout of a probe message, parse_to_probe_req expects it as message
+            blob_buf_init(&b_sync_entry, 0);
+            blob_put_raw(&b_sync_entry, blobmsg_data(attr), blobmsg_data_len(attr));
+            if (parse_to_probe_req(b_sync_entry.head, &entry)) {
+                continue;
+            }
+
+            entry.time = now - blobmsg_get_u32(tb_entry[SYNC_ENTRY_AGE]);
+            entry.counter = tb_entry[SYNC_ENTRY_COUNTER] ? blobmsg_get_u32(tb_entry[SYNC_ENTRY_COUNTER]) : 0;
+            entry.deny_counter = 0;
+            entry.max_supp_datarate = 0;
+            entry.min_supp_datarate = 0;
+
+            sync_num_probes += probe_array_merge(entry);
+        }
+    }
+
+    if (tb_sync[SYNC_LAST] && blobmsg_get_u8(tb_sync[SYNC_LAST])) {
+        printf("State synced %ld seconds after start: %d aps, %d probes\n", (long) (now - sync_start_time),
+               sync_num_aps, sync_num_probes);
+        sync_done = 1;
+        sync_con_id = 0;
+    }
+    return 0;
+}
+
+static void send_interest() {
+    struct hostapd_sock_entry *sub, *other;
+    void *ssid_list;
+
+    blob_buf_init(&b_control, 0);
+    ssid_list = blobmsg_open_table(&b_control, "ssids");
+    list_for_each_entry(sub, &hostapd_sock_list, list)
+    {
+        uint8_t bands = 0;
+        int first = 1;
+
+        if (!sub->subscribed) {
+            continue;
+        }
+
+        // one entry per ssid with the bands of all its interfaces
+        list_for_each_entry(other, &hostapd_sock_list, list)
+        {
+            if (!other->subscribed || strcmp(other->ssid, sub->ssid) != 0) {
+                continue;
+            }
+            if (other == sub) {
+                break;
+            }
+            first = 0;
+        }
+        if (!first) {
+            continue;
+        }
+
+        list_for_each_entry(other, &hostapd_sock_list, list)
+        {
+            if (other->subscribed && other->freq && strcmp(other->ssid, sub->ssid) == 0) {
+                bands |= other->freq > 4000 ? PEER_BAND_5G : PEER_BAND_2G;
+            }
+        }
+        blobmsg_add_u32(&b_control, sub->ssid, bands);
+    }
+    blobmsg_close_table(&b_control, ssid_list);
+    blobmsg_add_u32(&b_control, "port", network_config.tcp_port);
+
+    send_blob_attr_via_network(b_control.head, "interest");
+}
+
+static int hostapd_notify(struct ubus_context *ctx, struct ubus_object *obj,
+                          struct ubus_request_data *req, const char *method,
+                          struct blob_attr *msg) {
+    char *str;
+    str = blobmsg_format_json(msg, true);
+    printf("Method new: %s : %s\n", method, str);
+    free(str);
+
+    struct hostapd_sock_entry *entry;
+    struct ubus_subscriber *subscriber;
+
+    subscriber = container_of(obj, struct ubus_subscriber, obj);
+    entry = container_of(subscriber, struct hostapd_sock_entry, subscriber);
+
+    struct blob_attr *cur; int rem;
+    blob_buf_init(&b_notify, 0);
+    blobmsg_for_each_attr(cur, msg, rem){
+        blobmsg_add_blob(&b_notify, cur);
+    }
+
+    blobmsg_add_macaddr(&b_notify, "bssid", entry->bssid_addr);
+    blobmsg_add_string(&b_notify, "ssid", entry->ssid);
+
+    if (strncmp(method, "probe", 5) == 0) {
         return handle_probe_req(b_notify.head);
     } else if (strncmp(method, "auth", 4) == 0) {
         return handle_auth_req(b_notify.head);
@@ -840,15 +2110,33 @@ int dawn_init_ubus(const char *ubus_socket, const char *hostapd_dir) {
     if(timeout_config.update_beacon_reports) // allow setting timeout to 0
         uloop_timeout_add(&beacon_reports_timer);
 
+    if (timeout_config.heartbeat)
+        uloop_timeout_add(&heartbeat_timer);
+
+    uloop_timeout_add(&ratelimit_timer);
+
+    clock_gettime(CLOCK_MONOTONIC, &overload_due);
+    uloop_timeout_add(&overload_timer);
+
+    sync_start_time = time(0);
+
     ubus_add_oject();
 
-    if (network_config.network_option == 2)
+    if (network_config.network_option == 2 || network_config.network_option == 3)
     {
         start_umdns_update();
         if(run_server(network_config.tcp_port))
             uloop_timeout_set(&usock_timer, 1 * 1000);
     }
 
+    // broadcast, multicast and hybrid (multicast next to tcp) are read in the uloop,
+    // so all messages are handled in one thread with the peer table and the hostapd sockets
+    if (network_config.network_option == 0) {
+        init_socket_uloop(network_config.broadcast_ip, network_config.broadcast_port, 0);
+    } else if (network_config.network_option == 1 || network_config.network_option == 3) {
+        init_socket_uloop(network_config.broadcast_ip, network_config.broadcast_port, 1);
+    }
+
     subscribe_to_new_interfaces(hostapd_dir_glob);
 
     uloop_run();
@@ -951,6 +2239,36 @@ dump_client_table(struct blob_attr *head, int len, const char *bssid_addr, uint3
 }
 
 int parse_to_clients(struct blob_attr *msg, int do_kick, uint32_t id) {
+    return parse_to_clients_table(msg, do_kick, id, 1);
+}
+
+// adds the addresses of a clients table (or an array of addresses) to addrs, returns the new count
+static int clients_addrs(struct blob_attr *list, int is_table, uint8_t (*addrs)[ETH_ALEN], int n, int max) {
+    struct blob_attr *attr;
+    int len = blobmsg_data_len(list);
+
+    __blob_for_each_attr(attr, blobmsg_data(list), len)
+    {
+        if (n < max && hwaddr_aton(is_table ? blobmsg_name(attr) : blobmsg_data(attr), addrs[n]) == 0) {
+            n++;
+        }
+    }
+    return n;
+}
+
+static int clients_count(struct blob_attr *list) {
+    struct blob_attr *attr;
+    int len = blobmsg_data_len(list), n = 0;
+
+    __blob_for_each_attr(attr, blobmsg_data(list), len)
+    {
+        n++;
+    }
+    return n;
+}
+
+// full: the table has all clients of the ap, the ones that are not in it are gone
+static int parse_to_clients_table(struct blob_attr *msg, int do_kick, uint32_t id, int full) {
     struct blob_attr *tb[__CLIENT_TABLE_MAX];
 
     if (!msg) {
@@ -969,6 +2287,17 @@ int parse_to_clients(struct blob_attr *msg, int do_kick, uint32_t id) {
 
     if (tb[CLIENT_TABLE] && tb[CLIENT_TABLE_BSSID] && tb[CLIENT_TABLE_FREQ]) {
         int num_stations = 0;
+
+        if (full) {
+            uint8_t bssid_addr[ETH_ALEN];
+            int max = clients_count(tb[CLIENT_TABLE]);
+            uint8_t (*addrs)[ETH_ALEN] = malloc((max + 1) * ETH_ALEN);
+
+            if (addrs != NULL && hwaddr_aton(blobmsg_data(tb[CLIENT_TABLE_BSSID]), bssid_addr) == 0) {
+                client_array_keep(bssid_addr, addrs, clients_addrs(tb[CLIENT_TABLE], 1, addrs, 0, max));
+            }
+            free(addrs);
+        }
          num_stations = dump_client_table(blobmsg_data(tb[CLIENT_TABLE]), blobmsg_data_len(tb[CLIENT_TABLE]),
                           blobmsg_data(tb[CLIENT_TABLE_BSSID]), blobmsg_get_u32(tb[CLIENT_TABLE_FREQ]),
                           blobmsg_get_u8(tb[CLIENT_TABLE_HT]), blobmsg_get_u8(tb[CLIENT_TABLE_VHT]));
@@ -989,49 +2318,310 @@ int parse_to_clients(struct blob_attr *msg, int do_kick, uint32_t id) {
             ap_entry.vht_support = false;
         }
 
-        if(tb[CLIENT_TABLE_CHAN_UTIL]) {
-            ap_entry.channel_utilization = blobmsg_get_u32(tb[CLIENT_TABLE_CHAN_UTIL]);
-        } else // if this is not existing set to 0?
+        if(tb[CLIENT_TABLE_CHAN_UTIL]) {
+            ap_entry.channel_utilization = blobmsg_get_u32(tb[CLIENT_TABLE_CHAN_UTIL]);
+        } else // if this is not existing set to 0?
+        {
+            ap_entry.channel_utilization = 0;
+        }
+
+        if(tb[CLIENT_TABLE_SSID]) {
+            strcpy((char *) ap_entry.ssid, blobmsg_get_string(tb[CLIENT_TABLE_SSID]));
+        }
+
+        if (tb[CLIENT_TABLE_COL_DOMAIN]) {
+            ap_entry.collision_domain = blobmsg_get_u32(tb[CLIENT_TABLE_COL_DOMAIN]);
+        } else {
+            ap_entry.collision_domain = -1;
+        }
+
+        if (tb[CLIENT_TABLE_BANDWIDTH]) {
+            ap_entry.bandwidth = blobmsg_get_u32(tb[CLIENT_TABLE_BANDWIDTH]);
+        } else {
+            ap_entry.bandwidth = -1;
+        }
+
+        // a delta update only carries the changed stations
+        if (tb[CLIENT_TABLE_NUM_STA]) {
+            ap_entry.station_count = blobmsg_get_u32(tb[CLIENT_TABLE_NUM_STA]);
+        } else {
+            ap_entry.station_count = num_stations;
+        }
+
+        if (tb[CLIENT_TABLE_WEIGHT]) {
+            ap_entry.ap_weight = blobmsg_get_u32(tb[CLIENT_TABLE_WEIGHT]);
+        } else {
+            ap_entry.ap_weight = 0;
+        }
+
+
+        // only sent when it changed, otherwise the stored one stays
+        if (tb[CLIENT_TABLE_NEIGHBOR]) {
+            nr_store_set(ap_entry.bssid_addr, blobmsg_get_string(tb[CLIENT_TABLE_NEIGHBOR]));
+        }
+
+        insert_to_ap_array(ap_entry);
+
+        // overloaded: the kicks are evaluated with one of the next client updates
+        if (do_kick && dawn_metric.kicking && overload_get_mode() < OVERLOAD_DEFER_KICKS) {
+            kick_clients(ap_entry.bssid_addr, id);
+        }
+    }
+    return 0;
+}
+
+static int parse_to_clients_delta(struct blob_attr *msg, int do_kick) {
+    struct blob_attr *tb[__CLIENT_TABLE_MAX];
+    struct blob_attr *attr;
+    client client_entry;
+    int len;
+
+    blobmsg_parse(client_table_policy, __CLIENT_TABLE_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (!tb[CLIENT_TABLE_BSSID] || hwaddr_aton(blobmsg_data(tb[CLIENT_TABLE_BSSID]), client_entry.bssid_addr))
+        return UBUS_STATUS_INVALID_ARGUMENT;
+
+    // the changed and the unchanged clients are all clients of the ap, so a lost removal doesn't leave a ghost
+    if (tb[CLIENT_TABLE_UNCHANGED]) {
+        int max = clients_count(tb[CLIENT_TABLE_UNCHANGED]) + (tb[CLIENT_TABLE] ? clients_count(tb[CLIENT_TABLE]) : 0);
+        uint8_t (*addrs)[ETH_ALEN] = malloc((max + 1) * ETH_ALEN);
+        int n;
+
+        if (addrs != NULL) {
+            n = clients_addrs(tb[CLIENT_TABLE_UNCHANGED], 0, addrs, 0, max);
+            // only the listed clients are refreshed
+            for (int i = 0; i < n; i++) {
+                client_array_touch(client_entry.bssid_addr, addrs[i]);
+            }
+            if (tb[CLIENT_TABLE]) {
+                n = clients_addrs(tb[CLIENT_TABLE], 1, addrs, n, max);
+            }
+            client_array_keep(client_entry.bssid_addr, addrs, n);
+            free(addrs);
+        }
+    }
+
+    if (tb[CLIENT_TABLE_REMOVED]) {
+        len = blobmsg_data_len(tb[CLIENT_TABLE_REMOVED]);
+        __blob_for_each_attr(attr, blobmsg_data(tb[CLIENT_TABLE_REMOVED]), len)
+        {
+            if (hwaddr_aton(blobmsg_data(attr), client_entry.client_addr) == 0) {
+                pthread_mutex_lock(&client_array_mutex);
+                client_array_delete(client_entry);
+                pthread_mutex_unlock(&client_array_mutex);
+            }
+        }
+    }
+
+    return parse_to_clients_table(msg, do_kick, 0, 0);
+}
+
+static struct clients_seq_s *clients_seq_get(uint8_t *bssid_addr) {
+    for (int i = 0; i <= clients_seq_last; i++) {
+        if (mac_is_equal(clients_seq_array[i].bssid_addr, bssid_addr)) {
+            return &clients_seq_array[i];
+        }
+    }
+
+    if (clients_seq_last >= ARRAY_AP_LEN - 1) {
+        return NULL;
+    }
+
+    clients_seq_last++;
+    memcpy(clients_seq_array[clients_seq_last].bssid_addr, bssid_addr, ETH_ALEN);
+    clients_seq_array[clients_seq_last].seq = 0;
+    clients_seq_array[clients_seq_last].resync_time = 0;
+    return &clients_seq_array[clients_seq_last];
+}
+
+// returns 0 if the update can be applied
+static int handle_clients_seq(struct blob_attr *msg, int delta) {
+    struct blob_attr *tb[__CLIENT_TABLE_MAX];
+    uint8_t bssid_addr[ETH_ALEN];
+
+    blobmsg_parse(client_table_policy, __CLIENT_TABLE_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (!tb[CLIENT_TABLE_BSSID] || hwaddr_aton(blobmsg_data(tb[CLIENT_TABLE_BSSID]), bssid_addr))
+        return -1;
+
+    // old peers don't number their updates
+    if (!tb[CLIENT_TABLE_SEQ])
+        return delta ? -1 : 0;
+
+    struct clients_seq_s *seq_entry = clients_seq_get(bssid_addr);
+    uint32_t seq = blobmsg_get_u32(tb[CLIENT_TABLE_SEQ]);
+
+    if (seq_entry == NULL)
+        return delta ? -1 : 0;
+
+    if (!delta) {
+        seq_entry->seq = seq;
+        return 0;
+    }
+
+    if (seq_entry->seq != 0 && seq == seq_entry->seq + 1) {
+        seq_entry->seq = seq;
+        return 0;
+    }
+
+    // the same update twice
+    if (seq_entry->seq != 0 && seq == seq_entry->seq)
+        return -1;
+
+    // missed an update or the numbers went backwards (the sender restarted),
+    // ask for the full table once per update period
+    if (time(0) - seq_entry->resync_time >= timeout_config.update_client) {
+        seq_entry->resync_time = time(0);
+        printf("Missed clients update of " MACSTR ", requesting full update\n", MAC2STR(bssid_addr));
+
+        blob_buf_init(&b_control, 0);
+        blobmsg_add_macaddr(&b_control, "bssid", bssid_addr);
+        send_blob_attr_via_network(b_control.head, "clients-resync");
+    }
+    return -1;
+}
+
+static int handle_clients_resync(struct blob_attr *msg) {
+    struct blob_attr *tb[__CLIENT_TABLE_MAX];
+    struct hostapd_sock_entry *sub;
+    uint8_t bssid_addr[ETH_ALEN];
+
+    blobmsg_parse(client_table_policy, __CLIENT_TABLE_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (!tb[CLIENT_TABLE_BSSID] || hwaddr_aton(blobmsg_data(tb[CLIENT_TABLE_BSSID]), bssid_addr))
+        return UBUS_STATUS_INVALID_ARGUMENT;
+
+    list_for_each_entry(sub, &hostapd_sock_list, list)
+    {
+        if (mac_is_equal(sub->bssid_addr, bssid_addr)) {
+            sub->clients_full_requested = 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t client_digest_hash(const void *data, int len) {
+    return hash_update(HASH_INIT, data, len);
+}
+
+static struct client_digest_s *client_digest_find(struct client_digest_s *digests, int num_digests,
+                                                  uint8_t *client_addr) {
+    for (int i = 0; i < num_digests; i++) {
+        if (mac_is_equal(digests[i].client_addr, client_addr)) {
+            return &digests[i];
+        }
+    }
+    return NULL;
+}
+
+// sends the full clients table or only the changes since the last update
+static void send_clients_via_network(struct hostapd_sock_entry *entry, struct blob_buf *buf) {
+    struct blob_attr *tb[__CLIENT_TABLE_MAX];
+    struct blob_attr *attr;
+    struct client_digest_s *digests = NULL;
+    int num_digests = 0;
+    int len, rem;
+
+    entry->clients_seq++;
+    blobmsg_add_u32(buf, "clients_seq", entry->clients_seq);
+
+    blobmsg_parse(client_table_policy, __CLIENT_TABLE_MAX, tb, blob_data(buf->head), blob_len(buf->head));
+
+    if (tb[CLIENT_TABLE]) {
+        len = blobmsg_data_len(tb[CLIENT_TABLE]);
+        __blob_for_each_attr(attr, blobmsg_data(tb[CLIENT_TABLE]), len)
         {
-            ap_entry.channel_utilization = 0;
-        }
-
-        if(tb[CLIENT_TABLE_SSID]) {
-            strcpy((char *) ap_entry.ssid, blobmsg_get_string(tb[CLIENT_TABLE_SSID]));
+            num_digests++;
         }
 
-        if (tb[CLIENT_TABLE_COL_DOMAIN]) {
-            ap_entry.collision_domain = blobmsg_get_u32(tb[CLIENT_TABLE_COL_DOMAIN]);
+        digests = calloc(num_digests ? num_digests : 1, sizeof(struct client_digest_s));
+        if (digests == NULL) {
+            num_digests = 0;
         } else {
-            ap_entry.collision_domain = -1;
+            num_digests = 0;
+            len = blobmsg_data_len(tb[CLIENT_TABLE]);
+            __blob_for_each_attr(attr, blobmsg_data(tb[CLIENT_TABLE]), len)
+            {
+                if (hwaddr_aton(blobmsg_name(attr), digests[num_digests].client_addr) == 0) {
+                    digests[num_digests].hash = client_digest_hash(blobmsg_data(attr), blobmsg_data_len(attr));
+                    num_digests++;
+                }
+            }
         }
+    }
 
-        if (tb[CLIENT_TABLE_BANDWIDTH]) {
-            ap_entry.bandwidth = blobmsg_get_u32(tb[CLIENT_TABLE_BANDWIDTH]);
-        } else {
-            ap_entry.bandwidth = -1;
-        }
+    if (digests == NULL || entry->client_digests == NULL || entry->clients_full_requested ||
+        ++entry->clients_since_full >= CLIENTS_FULL_INTERVAL) {
+        send_blob_attr_via_network(buf->head, "clients");
 
-        ap_entry.station_count = num_stations;
+        entry->clients_since_full = 0;
+        entry->clients_full_requested = 0;
+        entry->sent_nr_hash = nr_store_hash(entry->bssid_addr);
+    } else {
+        void *list;
 
-        if (tb[CLIENT_TABLE_WEIGHT]) {
-            ap_entry.ap_weight = blobmsg_get_u32(tb[CLIENT_TABLE_WEIGHT]);
-        } else {
-            ap_entry.ap_weight = 0;
+        blob_buf_init(&b_clients_delta, 0);
+        blob_for_each_attr(attr, buf->head, rem)
+        {
+            // ap metadata is small and copied, the neighbor report only if it changed
+            if (attr == tb[CLIENT_TABLE] ||
+                (attr == tb[CLIENT_TABLE_NEIGHBOR] && entry->sent_nr_hash == nr_store_hash(entry->bssid_addr))) {
+                continue;
+            }
+            blobmsg_add_blob(&b_clients_delta, attr);
         }
+        entry->sent_nr_hash = nr_store_hash(entry->bssid_addr);
+        blobmsg_add_u32(&b_clients_delta, "num_sta", num_digests);
 
+        list = blobmsg_open_table(&b_clients_delta, "clients");
+        len = blobmsg_data_len(tb[CLIENT_TABLE]);
+        __blob_for_each_attr(attr, blobmsg_data(tb[CLIENT_TABLE]), len)
+        {
+            uint8_t client_addr[ETH_ALEN];
+            struct client_digest_s *old;
 
-        if (tb[CLIENT_TABLE_NEIGHBOR]) {
-            strcpy(ap_entry.neighbor_report, blobmsg_get_string(tb[CLIENT_TABLE_NEIGHBOR]));
+            if (hwaddr_aton(blobmsg_name(attr), client_addr)) {
+                continue;
+            }
+            old = client_digest_find(entry->client_digests, entry->num_client_digests, client_addr);
+            if (old == NULL || old->hash != client_digest_hash(blobmsg_data(attr), blobmsg_data_len(attr))) {
+                blobmsg_add_blob(&b_clients_delta, attr);
+            }
         }
+        blobmsg_close_table(&b_clients_delta, list);
 
-        insert_to_ap_array(ap_entry);
+        // the unchanged clients are listed, so the receiver knows all clients of the ap
+        list = blobmsg_open_array(&b_clients_delta, "unchanged");
+        len = blobmsg_data_len(tb[CLIENT_TABLE]);
+        __blob_for_each_attr(attr, blobmsg_data(tb[CLIENT_TABLE]), len)
+        {
+            uint8_t client_addr[ETH_ALEN];
+            struct client_digest_s *old;
 
-        if (do_kick && dawn_metric.kicking) {
-            kick_clients(ap_entry.bssid_addr, id);
+            if (hwaddr_aton(blobmsg_name(attr), client_addr)) {
+                continue;
+            }
+            old = client_digest_find(entry->client_digests, entry->num_client_digests, client_addr);
+            if (old != NULL && old->hash == client_digest_hash(blobmsg_data(attr), blobmsg_data_len(attr))) {
+                blobmsg_add_macaddr(&b_clients_delta, NULL, client_addr);
+            }
         }
+        blobmsg_close_array(&b_clients_delta, list);
+
+        list = blobmsg_open_array(&b_clients_delta, "removed");
+        for (int i = 0; i < entry->num_client_digests; i++) {
+            if (client_digest_find(digests, num_digests, entry->client_digests[i].client_addr) == NULL) {
+                blobmsg_add_macaddr(&b_clients_delta, NULL, entry->client_digests[i].client_addr);
+            }
+        }
+        blobmsg_close_array(&b_clients_delta, list);
+
+        send_blob_attr_via_network(b_clients_delta.head, "clients-delta");
     }
-    return 0;
+
+    free(entry->client_digests);
+    entry->client_digests = digests;
+    entry->num_client_digests = num_digests;
 }
 
 static void ubus_get_clients_cb(struct ubus_request *req, int type, struct blob_attr *msg) {
@@ -1063,6 +2653,12 @@ static void ubus_get_clients_cb(struct ubus_request *req, int type, struct blob_
         return;
     }
 
+    struct blob_attr *tb[__CLIENT_TABLE_MAX];
+    blobmsg_parse(client_table_policy, __CLIENT_TABLE_MAX, tb, blob_data(msg), blob_len(msg));
+    if (tb[CLIENT_TABLE_FREQ]) {
+        entry->freq = blobmsg_get_u32(tb[CLIENT_TABLE_FREQ]);
+    }
+
     blobmsg_add_macaddr(&b_domain, "bssid", entry->bssid_addr);
     blobmsg_add_string(&b_domain, "ssid", entry->ssid);
     blobmsg_add_u8(&b_domain, "ht_supported", entry->ht_support);
@@ -1070,13 +2666,15 @@ static void ubus_get_clients_cb(struct ubus_request *req, int type, struct blob_
 
     blobmsg_add_u32(&b_domain, "ap_weight", dawn_metric.ap_weight);
 
-    //int channel_util = get_channel_utilization(entry->iface_name, &entry->last_channel_time, &entry->last_channel_time_busy);
     blobmsg_add_u32(&b_domain, "channel_utilization", entry->chan_util_average);
 
-    blobmsg_add_string(&b_domain, "neighbor_report", entry->neighbor_report);
+    char *nr = blobmsg_alloc_string_buffer(&b_domain, "neighbor_report", NEIGHBOR_REPORT_LEN);
+    nr_store_get_hex(entry->bssid_addr, -1, nr, NEIGHBOR_REPORT_LEN);
+    blobmsg_add_string_buffer(&b_domain);
 
-    send_blob_attr_via_network(b_domain.head, "clients");
-    parse_to_clients(b_domain.head, 1, req->peer);
+    send_clients_via_network(entry, &b_domain);
+    // agents leave kicking to the controller
+    parse_to_clients(b_domain.head, network_config.role != DAWN_ROLE_AGENT, req->peer);
 
     print_client_array();
     print_ap_array();
@@ -1126,8 +2724,9 @@ static void ubus_get_rrm_cb(struct ubus_request *req, int type, struct blob_attr
          if(i==2)
          {
             char* neighborreport = blobmsg_get_string(blobmsg_data(attr));
-            strcpy(entry->neighbor_report,neighborreport);
-            printf("Copied Neighborreport: %s,\n", entry->neighbor_report);
+            if (entry != NULL && nr_store_set(entry->bssid_addr, neighborreport) > 0) {
+                printf("Stored Neighborreport: %s,\n", neighborreport);
+            }
          }
          i++;
      }
@@ -1159,22 +2758,82 @@ void run_server_update(struct uloop_timeout *t) {
         uloop_timeout_set(&usock_timer, 1 * 1000);
 }
 
+static struct chan_survey_s *chan_survey_get(const char *phy_name) {
+    for (int i = 0; i < num_chan_surveys; i++) {
+        if (strcmp(chan_surveys[i].phy_name, phy_name) == 0) {
+            return &chan_surveys[i];
+        }
+    }
+    if (num_chan_surveys == CHAN_SURVEY_MAX_RADIOS) {
+        return NULL;
+    }
+    memset(&chan_surveys[num_chan_surveys], 0, sizeof(struct chan_survey_s));
+    snprintf(chan_surveys[num_chan_surveys].phy_name, MAX_INTERFACE_NAME, "%s", phy_name);
+    return &chan_surveys[num_chan_surveys++];
+}
+
+static void chan_survey_sample(struct chan_survey_s *survey, const char *ifname) {
+    uint64_t active_time, busy_time;
+    int freq;
+
+    if (get_channel_survey(ifname, &freq, &active_time, &busy_time)) {
+        return;
+    }
+
+    // other channel, the counters and the average of the old one mean nothing here
+    if (freq != survey->freq || active_time < survey->last_active_time) {
+        survey->freq = freq;
+        survey->samples = 0;
+    } else if (active_time > survey->last_active_time) {
+        uint32_t util = (busy_time - survey->last_busy_time) * 255 * CHAN_UTIL_FRAC /
+                        (active_time - survey->last_active_time);
+
+        if (util > 255 * CHAN_UTIL_FRAC) {
+            util = 255 * CHAN_UTIL_FRAC;
+        }
+
+        // ewma with the weight of a moving average over chan_util_avg_period samples
+        if (survey->samples++ == 0) {
+            survey->average = util;
+        } else {
+            int period = dawn_metric.chan_util_avg_period > 0 ? dawn_metric.chan_util_avg_period : 1;
+            survey->average += ((int64_t) util - survey->average) * 2 / (period + 1);
+        }
+    }
+    survey->last_active_time = active_time;
+    survey->last_busy_time = busy_time;
+}
+
 void update_channel_utilization(struct uloop_timeout *t) {
     struct hostapd_sock_entry *sub;
 
+    for (int i = 0; i < num_chan_surveys; i++) {
+        chan_surveys[i].sampled = 0;
+    }
+
     list_for_each_entry(sub, &hostapd_sock_list, list)
     {
 
         if (sub->subscribed) {
-            sub->chan_util_samples_sum += get_channel_utilization(sub->iface_name, &sub->last_channel_time,
-                                                                  &sub->last_channel_time_busy);
-            sub->chan_util_num_sample_periods++;
-
-            if (sub->chan_util_num_sample_periods > dawn_metric.chan_util_avg_period) {
-                sub->chan_util_average = sub->chan_util_samples_sum / sub->chan_util_num_sample_periods;
-                sub->chan_util_samples_sum = 0;
-                sub->chan_util_num_sample_periods = 0;
+            struct chan_survey_s *survey;
+
+            // without a phy name the interface is treated as its own radio
+            if (sub->phy_name[0] == '\0' && get_phy_name(sub->iface_name, sub->phy_name)) {
+                snprintf(sub->phy_name, MAX_INTERFACE_NAME, "%s", sub->iface_name);
+            }
+
+            survey = chan_survey_get(sub->phy_name);
+            if (survey == NULL) {
+                fprintf(stderr, "Too many radios for channel surveys\n");
+                continue;
+            }
+
+            // the vaps of a radio share the survey
+            if (!survey->sampled) {
+                chan_survey_sample(survey, sub->iface_name);
+                survey->sampled = 1;
             }
+            sub->chan_util_average = (survey->average + CHAN_UTIL_FRAC / 2) / CHAN_UTIL_FRAC;
         }
     }
     uloop_timeout_set(&channel_utilization_timer, timeout_config.update_chan_util * 1000);
@@ -1197,25 +2856,99 @@ void ubus_send_beacon_report(uint8_t client[], int id)
     ubus_invoke(ctx, id, "rrm_beacon_req", b_beacon.head, NULL, NULL, timeout * 1000);
 }
 
+void update_heartbeat(struct uloop_timeout *t) {
+    send_heartbeat();
+    peer_check_timeouts();
+    uloop_timeout_set(&heartbeat_timer, timeout_config.heartbeat * 1000);
+}
+
+int beacon_req_enqueue(uint8_t *bssid_addr, uint8_t *client_addr, uint32_t id) {
+    if (beacon_req_len == ARRAY_CLIENT_LEN) {
+        return -1;
+    }
+    memcpy(beacon_reqs[beacon_req_len].bssid_addr, bssid_addr, ETH_ALEN);
+    memcpy(beacon_reqs[beacon_req_len].client_addr, client_addr, ETH_ALEN);
+    beacon_reqs[beacon_req_len].id = id;
+    beacon_req_len++;
+    return 0;
+}
+
+// one request per tick, so the clients don't all leave the channel at once
+static void beacon_req_cb(struct uloop_timeout *t) {
+    while (beacon_req_next < beacon_req_len) {
+        struct beacon_req_s *r = &beacon_reqs[beacon_req_next++];
+
+        pthread_mutex_lock(&client_array_mutex);
+        int connected = is_connected(r->bssid_addr, r->client_addr);
+        pthread_mutex_unlock(&client_array_mutex);
+
+        if (!connected) {
+            continue;
+        }
+        ubus_send_beacon_report(r->client_addr, r->id);
+        beacon_stats.requests++;
+        break;
+    }
+
+    if (beacon_req_next < beacon_req_len) {
+        uloop_timeout_set(&beacon_req_timer, beacon_req_gap_ms);
+    }
+}
+
 void update_beacon_reports(struct uloop_timeout *t) {
     if(!timeout_config.update_beacon_reports) // if 0 just return
     {
         return;
     }
-    printf("Sending beacon report!\n");
+
+    // requests that didn't fit into the last period are dropped, the clients are asked again now
+    beacon_stats.skipped += beacon_req_len - beacon_req_next;
+    beacon_req_len = 0;
+    beacon_req_next = 0;
+
     struct hostapd_sock_entry *sub;
     list_for_each_entry(sub, &hostapd_sock_list, list)
     {
         if (sub->subscribed) {
-            printf("Sending beacon report Sub!\n");
             send_beacon_reports(sub->bssid_addr, sub->id);
         }
     }
+
+    // spread the requests over the period, but never closer than beacon_req_gap
+    beacon_req_gap_ms = beacon_req_len ? timeout_config.update_beacon_reports * 1000 / beacon_req_len : 0;
+    if (beacon_req_gap_ms < timeout_config.beacon_req_gap) {
+        beacon_req_gap_ms = timeout_config.beacon_req_gap;
+    }
+    printf("Requesting beacon reports of %d clients, every %u ms\n", beacon_req_len, beacon_req_gap_ms);
+
+    if (beacon_req_len > 0) {
+        uloop_timeout_set(&beacon_req_timer, 0);
+    }
     uloop_timeout_set(&beacon_reports_timer, timeout_config.update_beacon_reports * 1000);
 }
 
+static int build_beacon_overview(struct blob_buf *b) {
+    blob_buf_init(b, 0);
+    blobmsg_add_u32(b, "interval_ms", beacon_req_gap_ms);
+    blobmsg_add_u32(b, "queued", beacon_req_len - beacon_req_next);
+    blobmsg_add_u32(b, "requests", beacon_stats.requests);
+    blobmsg_add_u32(b, "skipped", beacon_stats.skipped);
+    blobmsg_add_u32(b, "reports", beacon_stats.reports);
+    blobmsg_add_u32(b, "new_entries", beacon_stats.new_entries);
+    blobmsg_add_u32(b, "dropped", beacon_stats.dropped);
+    return 0;
+}
+
 void update_tcp_connections(struct uloop_timeout *t) {
-    ubus_call_umdns();
+    // agents only talk to the controller, the controller waits for its agents
+    if (network_config.role == DAWN_ROLE_AGENT) {
+        if (network_config.controller_ip != NULL) {
+            add_tcp_conncection((char *) network_config.controller_ip, network_config.tcp_port);
+        }
+    } else if (network_config.role != DAWN_ROLE_CONTROLLER) {
+        ubus_call_umdns();
+    }
+    send_interest();
     uloop_timeout_set(&umdns_timer, timeout_config.update_tcp_con * 1000);
 }
 
@@ -1237,9 +2970,19 @@ void ubus_set_nr(){
     {
         if (sub->subscribed) {
             int timeout = 1;
+            uint32_t hash;
             blob_buf_init(&b_nr, 0);
-            ap_get_nr(&b_nr, sub->bssid_addr);
-            ubus_invoke(ctx, sub->id, "rrm_nr_set", b_nr.head, NULL, NULL, timeout * 1000);
+            sub->nr_count = ap_get_nr(&b_nr, sub->bssid_addr, &hash);
+
+            // hostapd keeps the list, only send it again if it changed
+            if (sub->nr_pushes > 0 && hash == sub->nr_hash) {
+                sub->nr_skipped++;
+                continue;
+            }
+            if (ubus_invoke(ctx, sub->id, "rrm_nr_set", b_nr.head, NULL, NULL, timeout * 1000) == 0) {
+                sub->nr_hash = hash;
+                sub->nr_pushes++;
+            }
         }
     }
 }
@@ -1282,30 +3025,55 @@ void del_client_interface(uint32_t id, const uint8_t *client_addr, uint32_t reas
 
 }
 
-void wnm_disassoc_imminent(uint32_t id, const uint8_t *client_addr, char* dest_ap, uint32_t duration) {
-    struct hostapd_sock_entry *sub;
+static void wnm_disassoc_complete_cb(struct ubus_request *req, int ret) {
+    if (ret) {
+        fprintf(stderr, "wnm_disassoc_imminent failed: %s\n", ubus_strerror(ret));
+    }
+    wnm_reqs_used[req - wnm_reqs] = 0;
+}
+
+int wnm_disassoc_imminent(uint32_t id, const uint8_t *client_addr, char* dest_ap, uint32_t duration) {
+    int slot;
+
+    for (slot = 0; slot < WNM_MAX_PENDING; slot++) {
+        if (!wnm_reqs_used[slot]) {
+            break;
+        }
+    }
+    if (slot == WNM_MAX_PENDING) {
+        fprintf(stderr, "Too many pending wnm_disassoc_imminent requests\n");
+        return -1;
+    }
 
     blob_buf_init(&b, 0);
     blobmsg_add_macaddr(&b, "addr", client_addr);
     blobmsg_add_u32(&b, "duration", duration);
     blobmsg_add_u8(&b, "abridged", 1); // prefer aps in neighborlist
 
-    // ToDo: maybe exchange to a list of aps
+    // candidate list, ordered by preference
     void* nbs = blobmsg_open_array(&b, "neighbors");
     if(dest_ap!=NULL)
     {
-        blobmsg_add_string(&b, NULL, dest_ap);
-        printf("BSS TRANSITION TO %s\n", dest_ap);
+        char candidates[NEIGHBOR_REPORT_LIST_LEN];
+        char *nr, *saveptr;
+
+        snprintf(candidates, sizeof(candidates), "%s", dest_ap);
+        for (nr = strtok_r(candidates, ",", &saveptr); nr != NULL; nr = strtok_r(NULL, ",", &saveptr)) {
+            blobmsg_add_string(&b, NULL, nr);
+            printf("BSS TRANSITION TO %s\n", nr);
+        }
     }
 
     blobmsg_close_array(&b, nbs);
-    list_for_each_entry(sub, &hostapd_sock_list, list)
-    {
-        if (sub->subscribed) {
-            int timeout = 1; //TDO: Maybe ID is wrong?! OR CHECK HERE ID
-            ubus_invoke(ctx, id, "wnm_disassoc_imminent", b.head, NULL, NULL, timeout * 1000);
-        }
+
+    // don't block the uloop while hostapd handles it, the kick planner sends several at once
+    if (ubus_invoke_async(ctx, id, "wnm_disassoc_imminent", b.head, &wnm_reqs[slot])) {
+        return -1;
     }
+    wnm_reqs[slot].complete_cb = wnm_disassoc_complete_cb;
+    wnm_reqs_used[slot] = 1;
+    ubus_complete_request_async(ctx, &wnm_reqs[slot]);
+    return 0;
 }
 
 static void ubus_umdns_cb(struct ubus_request *req, int type, struct blob_attr *msg) {
@@ -1322,10 +3090,29 @@ static void ubus_umdns_cb(struct ubus_request *req, int type, struct blob_attr *
 
     struct blob_attr *attr;
     struct blobmsg_hdr *hdr;
+    struct blob_attr *peers[ARRAY_NETWORK_LEN];
+    int num_peers = 0;
     int len = blobmsg_data_len(tb[DAWN_UMDNS_TABLE]);
 
     __blob_for_each_attr(attr, blobmsg_data(tb[DAWN_UMDNS_TABLE]), len)
     {
+        if (num_peers < ARRAY_NETWORK_LEN) {
+            peers[num_peers++] = attr;
+        }
+    }
+
+    // in gossip mode only some peers are connected, pick them randomly so the overlay stays connected
+    if (network_config.gossip_fanout > 0) {
+        for (int i = num_peers - 1; i > 0; i--) {
+            int j = random() % (i + 1);
+            attr = peers[i];
+            peers[i] = peers[j];
+            peers[j] = attr;
+        }
+    }
+
+    for (int i = 0; i < num_peers; i++) {
+        attr = peers[i];
         hdr = blob_data(attr);
 
         struct blob_attr *tb_dawn[__DAWN_UMDNS_MAX];
@@ -1336,24 +3123,54 @@ static void ubus_umdns_cb(struct ubus_request *req, int type, struct blob_attr *
             printf("IPV4: %s\n", blobmsg_get_string(tb_dawn[DAWN_UMDNS_IPV4]));
             printf("Port: %d\n", blobmsg_get_u32(tb_dawn[DAWN_UMDNS_PORT]));
         } else {
-            return;
+            continue;
         }
         add_tcp_conncection(blobmsg_get_string(tb_dawn[DAWN_UMDNS_IPV4]), blobmsg_get_u32(tb_dawn[DAWN_UMDNS_PORT]));
     }
 }
 
+static void ubus_umdns_browse_complete_cb(struct ubus_request *req, int ret) {
+    umdns_active_req = NULL;
+}
+
+// umdns refreshed its cache, now read it
+static void ubus_umdns_update_complete_cb(struct ubus_request *req, int ret) {
+    blob_buf_init(&b_umdns, 0);
+    if (ubus_invoke_async(ctx, umdns_id, "browse", b_umdns.head, &umdns_browse_req)) {
+        umdns_active_req = NULL;
+        return;
+    }
+    umdns_browse_req.data_cb = ubus_umdns_cb;
+    umdns_browse_req.complete_cb = ubus_umdns_browse_complete_cb;
+    ubus_complete_request_async(ctx, &umdns_browse_req);
+    umdns_active_req = &umdns_browse_req;
+}
+
+// asynchronous, the discovered peers are handed to the tcp connection manager when umdns answers
 int ubus_call_umdns() {
-    u_int32_t id;
-    if (ubus_lookup_id(ctx, "umdns", &id)) {
+    if (umdns_active_req != NULL) {
+        if (time(0) - umdns_request_time < 2 * timeout_config.update_tcp_con) {
+            return 0;
+        }
+        fprintf(stderr, "umdns did not answer, retrying\n");
+        ubus_abort_request(ctx, umdns_active_req);
+        umdns_active_req = NULL;
+    }
+
+    if (ubus_lookup_id(ctx, "umdns", &umdns_id)) {
         fprintf(stderr, "Failed to look up test object for %s\n", "umdns");
         return -1;
     }
 
-    int timeout = 1;
     blob_buf_init(&b_umdns, 0);
-    ubus_invoke(ctx, id, "update", b_umdns.head, NULL, NULL, timeout * 1000);
-    ubus_invoke(ctx, id, "browse", b_umdns.head, ubus_umdns_cb, NULL, timeout * 1000);
+    if (ubus_invoke_async(ctx, umdns_id, "update", b_umdns.head, &umdns_update_req)) {
+        return -1;
+    }
+    umdns_update_req.complete_cb = ubus_umdns_update_complete_cb;
+    ubus_complete_request_async(ctx, &umdns_update_req);
 
+    umdns_active_req = &umdns_update_req;
+    umdns_request_time = time(0);
     return 0;
 }
 
@@ -1369,15 +3186,21 @@ int ubus_send_probe_via_network(struct probe_entry_s probe_entry) {
     blobmsg_add_u32(&b_probe, "rcpi", probe_entry.rcpi);
     blobmsg_add_u32(&b_probe, "rsni", probe_entry.rsni);
 
+    // lets the other aps drop probes for ssids they don't serve
+    char ssid[SSID_MAX_LEN + 1];
+    if (bssid_to_ssid(probe_entry.bssid_addr, ssid) == 0) {
+        blobmsg_add_string(&b_probe, "ssid", ssid);
+    }
+
     if(probe_entry.ht_capabilities)
     {
-        void *ht_cap = blobmsg_open_table(&b, "ht_capabilities");
-        blobmsg_close_table(&b, ht_cap);
+        void *ht_cap = blobmsg_open_table(&b_probe, "ht_capabilities");
+        blobmsg_close_table(&b_probe, ht_cap);
     }
 
     if(probe_entry.vht_capabilities) {
-        void *vht_cap = blobmsg_open_table(&b, "vht_capabilities");
-        blobmsg_close_table(&b, vht_cap);
+        void *vht_cap = blobmsg_open_table(&b_probe, "vht_capabilities");
+        blobmsg_close_table(&b_probe, vht_cap);
     }
 
     send_blob_attr_via_network(b_probe.head, "probe");
@@ -1385,10 +3208,15 @@ int ubus_send_probe_via_network(struct probe_entry_s probe_entry) {
     return 0;
 }
 
-int send_set_probe(uint8_t client_addr[]) {
+int send_set_probe(uint8_t client_addr[], uint8_t bssid_addr[]) {
+    char ssid[SSID_MAX_LEN + 1];
+
     blob_buf_init(&b_probe, 0);
     blobmsg_add_macaddr(&b_probe, "bssid", client_addr);
     blobmsg_add_macaddr(&b_probe, "address", client_addr);
+    if (bssid_to_ssid(bssid_addr, ssid) == 0) {
+        blobmsg_add_string(&b_probe, "ssid", ssid);
+    }
 
     send_blob_attr_via_network(b_probe.head, "setprobe");
 
@@ -1404,10 +3232,32 @@ static const struct blobmsg_policy add_del_policy[__ADD_DEL_MAC_MAX] = {
         [MAC_ADDR] = {"addrs", BLOBMSG_TYPE_ARRAY},
 };
 
+enum {
+    HISTORY_ARG_BSSID,
+    HISTORY_ARG_LEN,
+    __HISTORY_ARG_MAX
+};
+
+static const struct blobmsg_policy history_policy[__HISTORY_ARG_MAX] = {
+        [HISTORY_ARG_BSSID] = {.name = "bssid", .type = BLOBMSG_TYPE_STRING},
+        [HISTORY_ARG_LEN] = {.name = "length", .type = BLOBMSG_TYPE_INT32},
+};
+
 static const struct ubus_method dawn_methods[] = {
         UBUS_METHOD("add_mac", add_mac, add_del_policy),
         UBUS_METHOD_NOARG("get_hearing_map", get_hearing_map),
         UBUS_METHOD_NOARG("get_network", get_network),
+        UBUS_METHOD_NOARG("get_tcp_peers", get_tcp_peers),
+        UBUS_METHOD_NOARG("get_gossip", get_gossip),
+        UBUS_METHOD_NOARG("get_peers", get_peers),
+        UBUS_METHOD_NOARG("get_probe_stats", get_probe_stats),
+        UBUS_METHOD_NOARG("get_rate_limit", get_rate_limit),
+        UBUS_METHOD_NOARG("get_overload", get_overload),
+        UBUS_METHOD_NOARG("get_kick_plan", get_kick_plan),
+        UBUS_METHOD_NOARG("get_beacon_reports", get_beacon_reports),
+        UBUS_METHOD_NOARG("get_neighbor_reports", get_neighbor_reports),
+        UBUS_METHOD_NOARG("get_lb_plan", get_lb_plan),
+        UBUS_METHOD("get_history", get_history, history_policy),
         UBUS_METHOD_NOARG("reload_config", reload_config)
 };
 
@@ -1513,6 +3363,168 @@ static int get_network(struct ubus_context *ctx, struct ubus_object *obj,
     return 0;
 }
 
+static int get_tcp_peers(struct ubus_context *ctx, struct ubus_object *obj,
+                         struct ubus_request_data *req, const char *method,
+                         struct blob_attr *msg) {
+    int ret;
+
+    build_tcp_overview(&b);
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
+static int get_gossip(struct ubus_context *ctx, struct ubus_object *obj,
+                      struct ubus_request_data *req, const char *method,
+                      struct blob_attr *msg) {
+    int ret;
+
+    build_gossip_overview(&b);
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
+static int get_peers(struct ubus_context *ctx, struct ubus_object *obj,
+                     struct ubus_request_data *req, const char *method,
+                     struct blob_attr *msg) {
+    int ret;
+
+    build_peer_overview(&b);
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
+static int get_probe_stats(struct ubus_context *ctx, struct ubus_object *obj,
+                           struct ubus_request_data *req, const char *method,
+                           struct blob_attr *msg) {
+    int ret;
+
+    build_probe_stats(&b);
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
+static int get_rate_limit(struct ubus_context *ctx, struct ubus_object *obj,
+                          struct ubus_request_data *req, const char *method,
+                          struct blob_attr *msg) {
+    int ret;
+
+    build_ratelimit_overview(&b);
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
+static int get_overload(struct ubus_context *ctx, struct ubus_object *obj,
+                        struct ubus_request_data *req, const char *method,
+                        struct blob_attr *msg) {
+    int ret;
+
+    build_overload_overview(&b);
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
+static int get_history(struct ubus_context *ctx, struct ubus_object *obj,
+                       struct ubus_request_data *req, const char *method,
+                       struct blob_attr *msg) {
+    struct blob_attr *tb[__HISTORY_ARG_MAX];
+    uint8_t bssid_addr[ETH_ALEN];
+    int len = 0, ret;
+
+    blobmsg_parse(history_policy, __HISTORY_ARG_MAX, tb, blob_data(msg), blob_len(msg));
+
+    if (tb[HISTORY_ARG_BSSID] && hwaddr_aton(blobmsg_data(tb[HISTORY_ARG_BSSID]), bssid_addr)) {
+        return UBUS_STATUS_INVALID_ARGUMENT;
+    }
+    if (tb[HISTORY_ARG_LEN]) {
+        len = blobmsg_get_u32(tb[HISTORY_ARG_LEN]);
+    }
+
+    build_history_overview(&b, tb[HISTORY_ARG_BSSID] ? bssid_addr : NULL, len);
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
+static int get_kick_plan(struct ubus_context *ctx, struct ubus_object *obj,
+                         struct ubus_request_data *req, const char *method,
+                         struct blob_attr *msg) {
+    int ret;
+
+    build_kick_plan(&b);
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
+static int get_beacon_reports(struct ubus_context *ctx, struct ubus_object *obj,
+                              struct ubus_request_data *req, const char *method,
+                              struct blob_attr *msg) {
+    int ret;
+
+    build_beacon_overview(&b);
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
+static int get_neighbor_reports(struct ubus_context *ctx, struct ubus_object *obj,
+                                struct ubus_request_data *req, const char *method,
+                                struct blob_attr *msg) {
+    struct hostapd_sock_entry *sub;
+    void *list, *entry;
+    int ret;
+
+    blob_buf_init(&b, 0);
+    blobmsg_add_u8(&b, "enabled", dawn_metric.set_hostapd_nr);
+    list = blobmsg_open_array(&b, "interfaces");
+    list_for_each_entry(sub, &hostapd_sock_list, list)
+    {
+        if (!sub->subscribed) {
+            continue;
+        }
+        entry = blobmsg_open_table(&b, NULL);
+        blobmsg_add_string(&b, "iface", sub->iface_name);
+        blobmsg_add_macaddr(&b, "bssid", sub->bssid_addr);
+        blobmsg_add_u32(&b, "neighbors", sub->nr_count);
+        blobmsg_add_u32(&b, "pushes", sub->nr_pushes);
+        blobmsg_add_u32(&b, "unchanged", sub->nr_skipped);
+        blobmsg_close_table(&b, entry);
+    }
+    blobmsg_close_array(&b, list);
+
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
+static int get_lb_plan(struct ubus_context *ctx, struct ubus_object *obj,
+                       struct ubus_request_data *req, const char *method,
+                       struct blob_attr *msg) {
+    int ret;
+
+    build_lb_overview(&b);
+    ret = ubus_send_reply(ctx, req, b.head);
+    if (ret)
+        fprintf(stderr, "Failed to send reply: %s\n", ubus_strerror(ret));
+    return 0;
+}
+
 static void ubus_add_oject() {
     int ret;
 
@@ -1562,6 +3574,8 @@ static void hostapd_handle_remove(struct ubus_context *ctx,
     }
     
     hostapd_sock->subscribed = false;
+    // peers may have removed the clients meanwhile, start over with a full update
+    hostapd_sock->clients_full_requested = 1;
     subscription_wait(&hostapd_sock->wait_handler);
 
 }
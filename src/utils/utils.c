@@ -82,4 +82,13 @@ void write_mac_to_file(char *path, uint8_t addr[]) {
 int rcpi_to_rssi(int rcpi)
 {
     return rcpi / 2 - 110;
+}
+
+uint32_t hash_update(uint32_t hash, const void *data, int len) {
+    const uint8_t *bytes = data;
+
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
 }
\ No newline at end of file